@@ -3,7 +3,12 @@
  * ------------------------------------------------------------------ */
 
 #ifndef WIN32_BUILD
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #else
 #include <windows.h>
 #endif
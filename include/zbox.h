@@ -7,16 +7,97 @@
 #ifndef ZBOX_H
 #define ZBOX_H
 
-#define ZBOX_VERSION "1.0.16"
+#define ZBOX_VERSION "2.0.0"
 
 #define COMP_NONE 0
 #define COMP_ZLIB 10
 
+#define CHECKSUM_CRC32 0
+#define CHECKSUM_CRC32C 1
+
 #define OPTION_VERBOSE 1
 #define OPTION_NOPATHS 2
 #define OPTION_LISTONLY 4
 #define OPTION_TESTONLY 8
 #define OPTION_ZLIB 16
+#define OPTION_GROUP 32
+#define OPTION_DEDUP 64
+#define OPTION_SPARSE 128
+#define OPTION_APPEND 256
+#define OPTION_INCREMENTAL 512
+#define OPTION_FILE_SEGMENTS 1024
+#define OPTION_REUSE 2048
+#define OPTION_DELTA 4096
+#define OPTION_COMPARE 8192
+#define OPTION_CRC32C 16384
+#define OPTION_INPLACE 32768
+#define OPTION_ONE_FS 65536
+#define OPTION_LIST 131072
+#define OPTION_NULL 262144
+#define OPTION_STDOUT 524288
+#define OPTION_POPULATE 1048576
+#define OPTION_DIRECT_IO 2097152
+
+#define HEADER_FLAG_SEGMENTED 2
+#define HEADER_FLAG_EXTENDED 4
+#define HEADER_FLAG_FILE_SEGMENTS 8
+#define HEADER_FLAG_CHECKSUMS 16
+#define HEADER_FLAG_META_CRC32 32
+#define HEADER_FLAG_V2 64
+#define HEADER_FLAG_COMPACT 128
+#define HEADER_FLAG_INPLACE 256
+
+#define ENTITY_FRAMED 0x40000000
+#define ENTITY_LINK 0x20000000
+#define ENTITY_SHADOWED 0x10000000
+#define ENTITY_BASE 0x08000000
+#define ENTITY_DELTA 0x04000000
+#define ENTITY_INDEX_NONE 0xffffffff
+#define ENTITY_PERM 07777
+
+#define RECORD_DATA 1
+#define RECORD_HOLE 3
+#define RECORD_BASE 4
+#define RECORD_REF_HASH 5
+
+#define DEDUP_CHUNK_MIN 2048
+#define DEDUP_CHUNK_AVG 8192
+#define DEDUP_CHUNK_MAX 65536
+#define DEDUP_BUFFER (4 * DEDUP_CHUNK_MAX)
+
+#define SPARSE_BLOCK 4096
+#define SPARSE_RECORD_MAX 0x40000000
+
+#define DELTA_BLOCK 8192
+#define DELTA_BLOCK_MAX 65536
+#define DELTA_BLOCKS_MAX 0x400000
+#define DELTA_MIN_SIZE 65536
+
+#define COPY_WINDOW (8 << 20)
+#define COPY_MIN_SIZE 262144
+#define MAP_WINDOW (64 << 20)
+#define MAP_MIN_SIZE 1048576
+#define READAHEAD_FILES 16
+#define READAHEAD_BYTES (32 << 20)
+#define DIRECT_ALIGN 4096
+#define DIRECT_BUFFER (4 << 20)
+#define DIRECT_OFFSET_NONE 0xffffffffffffffffULL
+
+#define SEGMENT_NONE 0xffffffff
+#define SEGMENT_SPLIT (64 << 20)
+
+#define FILTER_NONE 0
+#define FILTER_INCLUDE 1
+#define FILTER_EXCLUDE 2
+
+#define INPLACE_INDEX_MAX 0x80000000
+
+#define COLUMN_PARENT 0
+#define COLUMN_MODE 1
+#define COLUMN_SIZE 2
+#define COLUMN_NAME 3
+#define COLUMN_COUNT 4
+#define META_COLUMN_BUFSIZE 65536
 
 struct header_t
 {
@@ -25,7 +106,14 @@ struct header_t
     uint32_t nentity;
     uint32_t nameslen;
     uint32_t crc32;
-    uint8_t reserved[44];
+    uint32_t flags;
+    uint64_t meta_offset;
+    uint64_t meta_size;
+    uint32_t meta_crc32;
+    uint32_t checksum;
+    uint32_t nameslen_high;
+    uint64_t inplace_offset;
+    uint32_t inplace_crc32;
 } __attribute__ ( ( packed ) );
 
 struct entity_t
@@ -35,16 +123,165 @@ struct entity_t
     union
     {
         uint32_t id;
-        uint32_t size;
+        uint64_t size;
     };
 } __attribute__ ( ( packed ) );
 
+struct entity_v1_t
+{
+    uint32_t parent;
+    uint32_t mode;
+    uint32_t size;
+} __attribute__ ( ( packed ) );
+
+struct record_t
+{
+    uint32_t type;
+    uint32_t len;
+    uint32_t entity;
+    uint64_t offset;
+} __attribute__ ( ( packed ) );
+
+struct segment_t
+{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t rawsize;
+    uint32_t crc32;
+} __attribute__ ( ( packed ) );
+
+struct location_t
+{
+    uint32_t segment;
+    uint64_t offset;
+    uint64_t size;
+} __attribute__ ( ( packed ) );
+
+struct inplace_header_t
+{
+    uint8_t magic[4];
+    uint32_t nentity;
+    uint64_t size;
+    uint64_t entity_offset;
+    uint64_t child_offset;
+    uint64_t name_offset;
+    uint64_t name_size;
+    uint32_t root_count;
+    uint64_t index_offset;
+    uint32_t index_size;
+    uint8_t reserved[8];
+} __attribute__ ( ( packed ) );
+
+struct inplace_entity_t
+{
+    uint32_t parent;
+    uint32_t mode;
+    uint64_t size;
+    uint64_t name;
+    uint32_t first;
+    uint32_t count;
+    uint32_t segment;
+    uint32_t crc32;
+    uint64_t offset;
+    uint64_t length;
+} __attribute__ ( ( packed ) );
+
+struct inplace_slot_t
+{
+    uint32_t hash;
+    uint32_t entity;
+} __attribute__ ( ( packed ) );
+
+struct inplace_meta_t
+{
+    void *map;
+    size_t map_size;
+    uint32_t nentity;
+    uint32_t root_count;
+    const struct inplace_entity_t *entity_table;
+    const uint32_t *child_table;
+    const char *name_table;
+    uint64_t name_size;
+    const struct inplace_slot_t *slot_table;
+    uint32_t nslot;
+};
+
+struct entity_ext_t
+{
+    uint64_t mtime;
+    uint64_t ctime;
+    uint64_t inode;
+    uint32_t base;
+} __attribute__ ( ( packed ) );
+
 struct node_t
 {
     char *name;
     struct node_t *next;
     struct node_t *sub;
+    struct node_t *parent;
+    const struct node_t *link;
+    uint32_t index;
+    uint32_t crc32;
     struct entity_t entity;
+    struct location_t location;
+    struct entity_ext_t ext;
+};
+
+struct archive_meta_t
+{
+    struct header_t header;
+    struct entity_t *entity_table;
+    char *name_table;
+    uint32_t nsegment;
+    struct segment_t *segment_table;
+    struct location_t *location_table;
+    struct entity_ext_t *ext_table;
+    uint32_t *crc_table;
+    char *base_name;
+    uint32_t base_crc32;
+    struct node_t **node_table;
+    struct node_t *root;
+};
+
+struct dedup_chunk_t
+{
+    uint64_t hash;
+    uint32_t len;
+    const struct node_t *node;
+    uint64_t offset;
+};
+
+struct dedup_context_t
+{
+    uint64_t gear[256];
+    struct dedup_chunk_t *table;
+    size_t size;
+    size_t count;
+    int verify_fd;
+    const struct node_t *verify_node;
+};
+
+struct delta_block_t
+{
+    uint64_t strong;
+    uint64_t offset;
+    uint32_t weak;
+    uint32_t used;
+};
+
+struct delta_context_t
+{
+    size_t block;
+    struct delta_block_t *table;
+    size_t size;
+    size_t count;
+};
+
+struct pack_ahead_t
+{
+    int fd;
+    uint64_t len;
 };
 
 struct pack_context_t
@@ -54,15 +291,84 @@ struct pack_context_t
     char path[PATH_LIMIT];
     unsigned char *workbuf;
     size_t workbuf_size;
+    unsigned char *framebuf;
+    struct dedup_context_t *dedup;
+    struct archive_meta_t *meta;
+    struct ar_istream *base_istream;
+    const struct archive_meta_t *base_meta;
+    struct location_t base_location;
+    struct pack_ahead_t *ahead;
+    uint32_t ahead_next;
+    uint64_t ahead_bytes;
+};
+
+struct pattern_t
+{
+    char *text;
+    size_t prefix;
+    int literal;
+    int basename;
+    int matched;
+};
+
+struct filter_t
+{
+    struct pattern_t *include;
+    size_t ninclude;
+    struct pattern_t *exclude;
+    size_t nexclude;
 };
 
 struct unpack_context_t
 {
     uint32_t options;
+    int dirs_only;
+    int replace;
     struct ar_istream *istream;
     char path[PATH_LIMIT];
     unsigned char *workbuf;
+    unsigned char *cmpbuf;
     size_t workbuf_size;
+    int compare;
+    struct node_t **node_table;
+    uint32_t nentity;
+    int ref_fd;
+    uint32_t ref_index;
+    int base_fd;
+    struct filter_t *filter;
+    uint8_t *selected;
+    uint8_t *shared;
+    uint32_t *standin;
+    int seekable;
+    int file_crc32;
+    uint64_t range_offset;
+    uint64_t range_end;
+    uint64_t written;
+    int out_fd;
+    const char *archive;
+    const char *base_name;
+    const struct segment_t *segment_table;
+    uint32_t nsegment;
+};
+
+struct scan_inode_t
+{
+    uint64_t dev;
+    uint64_t ino;
+    const struct node_t *node;
+};
+
+struct scan_name_t
+{
+    uint64_t hash;
+    struct node_t *node;
+};
+
+struct scan_dir_t
+{
+    uint64_t dev;
+    uint64_t ino;
+    const struct scan_dir_t *parent;
 };
 
 struct scan_context_t
@@ -70,21 +376,32 @@ struct scan_context_t
     uint32_t next_id;
     char path[PATH_LIMIT];
     char *filter;
-};
-
-struct unpack_parse_context
-{
-    const struct entity_t *entity_table;
-    const char *name_table;
-    const char *name_limit;
-    uint32_t count;
-    uint32_t position;
+    struct filter_t *exclude;
+    int one_fs;
+    uint64_t dev;
+    struct scan_inode_t *inodes;
+    size_t inodes_size;
+    size_t inodes_count;
+    struct scan_name_t *names;
+    size_t names_size;
+    size_t names_count;
+    const struct scan_dir_t *dirs;
 };
 
 struct stream_base_context_t
 {
     int fd;
     uint32_t crc32;
+    uint64_t length;
+    uint32_t checksum;
+    const unsigned char *map;
+    uint64_t map_offset;
+    uint64_t map_size;
+    uint64_t pos;
+    unsigned char *buffer;
+    size_t buffer_len;
+    uint64_t buffer_offset;
+    int direct_fd;
 };
 
 struct ar_stream
@@ -97,7 +414,9 @@ struct ar_ostream
     struct stream_base_context_t *context;
     int ( *set_header ) ( struct ar_ostream *, const struct header_t * );
     int ( *write ) ( struct ar_ostream *, const void *, size_t );
+    int ( *copy ) ( struct ar_ostream *, int, uint64_t );
     int ( *flush ) ( struct ar_ostream * );
+    int ( *reset ) ( struct ar_ostream * );
     void ( *seed_crc32 ) ( struct ar_ostream *, const struct header_t * );
       uint32_t ( *finalize_crc32 ) ( struct ar_ostream * );
     void ( *close ) ( struct ar_ostream * );
@@ -108,6 +427,9 @@ struct ar_istream
     struct stream_base_context_t *context;
     int ( *get_header ) ( struct ar_istream *, struct header_t * );
     int ( *read ) ( struct ar_istream *, void *, size_t );
+    int ( *copy ) ( struct ar_istream *, int, uint64_t );
+    int ( *view ) ( struct ar_istream *, const void **, size_t );
+    int ( *reset ) ( struct ar_istream *, uint64_t );
     void ( *seed_crc32 ) ( struct ar_istream *, const struct header_t * );
       uint32_t ( *finalize_crc32 ) ( struct ar_istream * );
     void ( *close ) ( struct ar_istream * );
@@ -129,9 +451,38 @@ extern struct node_t *node_append ( struct node_t **head );
 extern int path_concat ( char *path, size_t path_size, const char *name );
 
 /**
- * Scan files tree for archive building
+ * Get archive names length
+ */
+extern uint64_t meta_nameslen ( const struct header_t *header );
+
+/**
+ * Load archive metadata tables
+ */
+extern int meta_load ( struct ar_istream *istream, const struct header_t *header,
+    struct archive_meta_t *meta );
+
+/**
+ * Parse archive metadata tables into files tree
+ */
+extern int meta_parse ( struct archive_meta_t *meta );
+
+/**
+ * Free archive metadata
  */
-extern int scan_files_tree ( const char *files[], size_t nfiles, struct node_t **root );
+extern void meta_free ( struct archive_meta_t *meta );
+
+
+/**
+ * Build node path from its parent nodes
+ */
+extern int node_path ( const struct node_t *node, char *path, size_t path_size );
+
+/**
+ * Scan files tree for archive building, excluded paths are pruned,
+ * files are read from list files instead if list option is set
+ */
+extern int scan_files_tree ( const char *files[], size_t nfiles, uint32_t options,
+    struct filter_t *exclude, struct node_t **root );
 
 /**
  * Free node list from memory, also free node names if needed
@@ -143,21 +494,51 @@ extern void free_files_tree ( struct node_t *root, int dynamic_names );
  */
 extern void free_node_list ( struct node_t *root );
 
+/**
+ * Set size from which source files are mapped instead of read
+ */
+extern void pack_set_map_min ( uint64_t size );
+
+/**
+ * Set how many upcoming files and bytes are hinted for readahead
+ */
+extern void pack_set_readahead ( uint32_t files, uint64_t bytes );
+
 /** 
  * Pack files to an archive
  */
 extern int zbox_pack_archive ( const char *archive, uint32_t options, int level,
-    const char *files[], size_t nfiles );
+    const char *base, const char *files[], size_t nfiles, struct filter_t *exclude );
+
+/** 
+ * Append files to an existing archive
+ */
+extern int zbox_append_archive ( const char *archive, uint32_t options, int level,
+    const char *files[], size_t nfiles, struct filter_t *exclude );
 
 /** 
- * Unpack files from an archive
+ * Unpack files from an archive, only files selected by filter if given
  */
-extern int zbox_unpack_archive ( const char *archive, uint32_t options );
+extern int zbox_unpack_archive ( const char *archive, uint32_t options,
+    struct filter_t *filter );
+
+/**
+ * Print byte range of archive files selected by filter to standard output
+ */
+extern int zbox_print_archive ( const char *archive, uint32_t options, struct filter_t *filter,
+    uint64_t offset, uint64_t length );
+
+/**
+ * Open archive input stream and read its header
+ */
+extern struct ar_istream *zbox_archive_istream_open ( int fd, struct header_t *header,
+    uint32_t options );
 
 /**
  * Calculate archive metadata checksum
  */
-extern int zbox_calculate_meta_crc32 ( int archivefd, uint32_t meta_size, uint32_t * crc32 );
+extern uint32_t zbox_calculate_meta_crc32 ( const struct header_t *header, uint32_t crc32,
+    uint64_t len );
 
 /**
  * Show operation progress with current file path
@@ -194,11 +575,84 @@ extern int generic_write ( struct ar_ostream *stream, const void *data, size_t l
  */
 extern int generic_read ( struct ar_istream *stream, void *data, size_t len );
 
+/**
+ * Take input stream data, mapped data is referenced in place
+ */
+extern ssize_t generic_input ( struct stream_base_context_t *context, void *buf, size_t len,
+    const unsigned char **data );
+
+/**
+ * Reference input stream data in archive mapping
+ */
+extern int generic_view ( struct ar_istream *stream, const void **data, size_t len );
+
+/**
+ * Map archive file for reading, input stream keeps using reads if mapping fails
+ */
+extern void generic_map_input ( struct ar_istream *stream, int populate );
+
+/**
+ * Write stream output data, direct I/O output is gathered in aligned buffer
+ */
+extern int generic_output ( struct stream_base_context_t *context, const void *data,
+    size_t len );
+
+/**
+ * Write out data gathered for direct I/O, file position follows written data
+ */
+extern int generic_drain_output ( struct stream_base_context_t *context );
+
+/**
+ * Write archive data bypassing page cache through aligned buffer
+ */
+extern int generic_direct_output ( struct ar_ostream *stream );
+
+/**
+ * Read archive data bypassing page cache through aligned buffer
+ */
+extern int generic_direct_input ( struct ar_istream *stream );
+
+/**
+ * Copy file data into output stream
+ */
+extern int generic_copy_from ( struct ar_ostream *stream, int fd, uint64_t len );
+
+/**
+ * Copy input stream data into file
+ */
+extern int generic_copy_to ( struct ar_istream *stream, int fd, uint64_t len );
+
 /*
  * Finalize output stream
  */
 extern int generic_flush ( struct ar_ostream *stream );
 
+/*
+ * Begin new output stream segment at current position
+ */
+extern int generic_reset_output ( struct ar_ostream *stream );
+
+/*
+ * Begin reading input stream segment at given offset
+ */
+extern int generic_reset_input ( struct ar_istream *stream, uint64_t offset );
+
+/*
+ * Calculate archive header checksum
+ */
+extern uint32_t header_crc32 ( const struct header_t *header );
+
+/*
+ * Begin separate checksum of stream data part, return checksum so far
+ */
+extern uint32_t stream_split_crc32 ( struct stream_base_context_t *context );
+
+/*
+ * Finish separate checksum of stream data part and merge it back
+ */
+extern uint32_t stream_merge_crc32 ( struct stream_base_context_t *context, uint32_t crc32,
+    uint64_t len );
+
 /*
  * Set crc32 checksum for stream
  */
@@ -239,4 +693,185 @@ extern struct ar_istream *zlib_istream_open ( int fd );
  */
 extern uint32_t crc32b ( uint32_t crc, const uint8_t * buf, size_t len );
 
+/**
+ * Combine checksums of two adjacent data blocks, reflected polynomial given
+ */
+extern uint32_t crc32_combine_poly ( uint32_t poly, uint32_t crc1, uint32_t crc2, uint64_t len2 );
+
+/**
+ * Select CRC32C implementation, build lookup tables if needed
+ */
+extern void crc32c_init ( void );
+
+/**
+ * Calculate data checksum of given type
+ */
+extern uint32_t checksum_update ( uint32_t type, uint32_t crc, const uint8_t * buf, size_t len );
+
+/**
+ * Combine checksums of given type of two adjacent data blocks
+ */
+extern uint32_t checksum_combine ( uint32_t type, uint32_t crc1, uint32_t crc2, uint64_t len2 );
+
+/**
+ * Calculate XXH64 hash of data
+ */
+extern uint64_t xxh64 ( uint64_t seed, const uint8_t * buf, size_t len );
+
+/**
+ * Convert 64-bit value from host to network byte order
+ */
+extern uint64_t hton64 ( uint64_t value );
+
+/**
+ * Convert 64-bit value from network to host byte order
+ */
+extern uint64_t ntoh64 ( uint64_t value );
+
+/**
+ * Convert 32-bit value between host and little-endian byte order
+ */
+extern uint32_t le32 ( uint32_t value );
+
+/**
+ * Convert 64-bit value between host and little-endian byte order
+ */
+extern uint64_t le64 ( uint64_t value );
+
+/**
+ * Check if data block contains only zero bytes
+ */
+extern int is_zero_block ( const void *data, size_t len );
+
+/**
+ * Read data from file at given offset
+ */
+extern ssize_t read_at ( int fd, void *data, size_t len, off_t offset );
+
+/**
+ * Write data to file at given offset
+ */
+extern ssize_t write_at ( int fd, const void *data, size_t len, off_t offset );
+
+/**
+ * Prepare deduplication context
+ */
+extern int dedup_init ( struct dedup_context_t *context );
+
+/**
+ * Find content defined chunk boundary with normalized gear hashing
+ */
+extern size_t dedup_cut ( const struct dedup_context_t *context, const uint8_t * data, size_t len );
+
+/**
+ * Find chunk by fingerprint, iterate with previous match for next candidate
+ */
+extern struct dedup_chunk_t *dedup_find ( struct dedup_context_t *context, uint64_t hash,
+    uint32_t len, struct dedup_chunk_t *prev );
+
+/**
+ * Insert chunk fingerprint into table
+ */
+extern int dedup_insert ( struct dedup_context_t *context, uint64_t hash, uint32_t len,
+    const struct node_t *node, uint64_t offset );
+
+/**
+ * Free deduplication context
+ */
+extern void dedup_free ( struct dedup_context_t *context );
+
+/**
+ * Prepare delta context for base file of given size
+ */
+extern int delta_init ( struct delta_context_t *context, uint64_t size );
+
+/**
+ * Calculate rolling checksum of a block
+ */
+extern uint32_t delta_weak ( const uint8_t * data, size_t len );
+
+/**
+ * Roll block checksum forward by one byte
+ */
+extern uint32_t delta_roll ( uint32_t weak, uint8_t out, uint8_t in, size_t len );
+
+/**
+ * Insert base block signature into table
+ */
+extern void delta_insert ( struct delta_context_t *context, uint32_t weak, uint64_t strong,
+    uint64_t offset );
+
+/**
+ * Check if any base block has given rolling checksum
+ */
+extern int delta_lookup ( const struct delta_context_t *context, uint32_t weak );
+
+/**
+ * Find first matching base block at or after given offset
+ */
+extern const struct delta_block_t *delta_find ( const struct delta_context_t *context,
+    uint32_t weak, uint64_t strong, uint64_t offset );
+
+/**
+ * Free delta context
+ */
+extern void delta_free ( struct delta_context_t *context );
+
+/**
+ * Map in-place metadata section of an archive
+ */
+extern int inplace_open ( int fd, const struct header_t *header, struct inplace_meta_t *inplace );
+
+/**
+ * Verify in-place metadata section checksum
+ */
+extern int inplace_verify ( int fd, const struct header_t *header );
+
+/**
+ * Find entity by path with in-place metadata section
+ */
+extern uint32_t inplace_lookup ( const struct inplace_meta_t *inplace, const char *path );
+
+/**
+ * List archive files selected by filter with in-place metadata section
+ */
+extern int inplace_list ( const struct inplace_meta_t *inplace, uint32_t options,
+    struct filter_t *filter );
+
+/**
+ * Unmap in-place metadata section
+ */
+extern void inplace_close ( struct inplace_meta_t *inplace );
+
+/**
+ * Match path against glob pattern, single star stops at
+ * path separator, double star matches across separators
+ */
+extern int glob_match ( const char *pattern, const char *path );
+
+/**
+ * Add include or exclude pattern to filter
+ */
+extern int filter_add ( struct filter_t *filter, const char *text, int exclude );
+
+/**
+ * Load include patterns from list file, one per line
+ */
+extern int filter_load ( struct filter_t *filter, const char *listfile );
+
+/**
+ * Match archive path against filter patterns
+ */
+extern int filter_match ( struct filter_t *filter, const char *path );
+
+/**
+ * Report include patterns not matched by any archive path
+ */
+extern int filter_unmatched ( const struct filter_t *filter );
+
+/**
+ * Free filter patterns
+ */
+extern void filter_free ( struct filter_t *filter );
+
 #endif
@@ -119,3 +119,91 @@ uint32_t crc32b ( uint32_t crc, const uint8_t * buf, size_t len )
 
     return crc;
 }
+
+/**
+ * Multiply GF(2) matrix by vector
+ */
+static uint32_t gf2_matrix_times ( const uint32_t * mat, uint32_t vec )
+{
+    uint32_t sum = 0;
+
+    for ( ; vec; vec >>= 1, mat++ )
+    {
+        if ( vec & 1 )
+        {
+            sum ^= *mat;
+        }
+    }
+
+    return sum;
+}
+
+/**
+ * Square GF(2) matrix
+ */
+static void gf2_matrix_square ( uint32_t * square, const uint32_t * mat )
+{
+    int n;
+
+    for ( n = 0; n < 32; n++ )
+    {
+        square[n] = gf2_matrix_times ( mat, mat[n] );
+    }
+}
+
+/**
+ * Combine checksums of two adjacent data blocks, reflected polynomial given
+ */
+uint32_t crc32_combine_poly ( uint32_t poly, uint32_t crc1, uint32_t crc2, uint64_t len2 )
+{
+    int n;
+    uint32_t row;
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    if ( !len2 )
+    {
+        return crc1;
+    }
+
+    /* Operator for one zero bit in odd */
+    odd[0] = poly;
+    for ( n = 1, row = 1; n < 32; n++, row <<= 1 )
+    {
+        odd[n] = row;
+    }
+
+    /* Operators for two and four zero bits */
+    gf2_matrix_square ( even, odd );
+    gf2_matrix_square ( odd, even );
+
+    /* Apply len2 zero bytes to crc1 */
+    do
+    {
+        gf2_matrix_square ( even, odd );
+
+        if ( len2 & 1 )
+        {
+            crc1 = gf2_matrix_times ( even, crc1 );
+        }
+
+        len2 >>= 1;
+
+        if ( !len2 )
+        {
+            break;
+        }
+
+        gf2_matrix_square ( odd, even );
+
+        if ( len2 & 1 )
+        {
+            crc1 = gf2_matrix_times ( odd, crc1 );
+        }
+
+        len2 >>= 1;
+    }
+    while ( len2 );
+
+    return crc1 ^ crc2;
+}
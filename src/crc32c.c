@@ -0,0 +1,129 @@
+/* ------------------------------------------------------------------
+ * ZBox - Simple Data Achive Utility
+ * ------------------------------------------------------------------ */
+
+#include "zbox.h"
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HW
+#endif
+
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t ( *crc32c_update ) ( uint32_t, const uint8_t *, size_t );
+
+/**
+ * Calculate CRC32C checksum of data, sliced by eight bytes
+ */
+static uint32_t crc32c_sw ( uint32_t crc, const uint8_t * buf, size_t len )
+{
+    for ( ; len >= 8; len -= 8, buf += 8 )
+    {
+        crc ^= buf[0] | ( uint32_t ) buf[1] << 8 | ( uint32_t ) buf[2] << 16
+            | ( uint32_t ) buf[3] << 24;
+        crc = crc32c_table[7][crc & 0xff] ^ crc32c_table[6][( crc >> 8 ) & 0xff]
+            ^ crc32c_table[5][( crc >> 16 ) & 0xff] ^ crc32c_table[4][crc >> 24]
+            ^ crc32c_table[3][buf[4]] ^ crc32c_table[2][buf[5]]
+            ^ crc32c_table[1][buf[6]] ^ crc32c_table[0][buf[7]];
+    }
+
+    for ( ; len; len--, buf++ )
+    {
+        crc = crc32c_table[0][( crc ^ *buf ) & 0xff] ^ ( crc >> 8 );
+    }
+
+    return crc;
+}
+
+#ifdef CRC32C_HW
+/**
+ * Calculate CRC32C checksum of data with SSE4.2 instruction
+ */
+__attribute__ ( ( target ( "sse4.2" ) ) )
+static uint32_t crc32c_hw ( uint32_t crc, const uint8_t * buf, size_t len )
+{
+    uint64_t crc64;
+    uint64_t value;
+
+    for ( ; len && ( ( uintptr_t ) buf & 7 ); len--, buf++ )
+    {
+        crc = _mm_crc32_u8 ( crc, *buf );
+    }
+
+    for ( crc64 = crc; len >= 8; len -= 8, buf += 8 )
+    {
+        memcpy ( &value, buf, sizeof ( value ) );
+        crc64 = _mm_crc32_u64 ( crc64, value );
+    }
+
+    for ( crc = crc64; len; len--, buf++ )
+    {
+        crc = _mm_crc32_u8 ( crc, *buf );
+    }
+
+    return crc;
+}
+#endif
+
+/**
+ * Select CRC32C implementation, build lookup tables if needed
+ */
+void crc32c_init ( void )
+{
+    int i;
+    int j;
+    uint32_t crc;
+
+#ifdef CRC32C_HW
+    if ( __builtin_cpu_supports ( "sse4.2" ) )
+    {
+        crc32c_update = crc32c_hw;
+        return;
+    }
+#endif
+
+    for ( i = 0; i < 256; i++ )
+    {
+        for ( crc = i, j = 0; j < 8; j++ )
+        {
+            crc = crc & 1 ? ( crc >> 1 ) ^ CRC32C_POLY : crc >> 1;
+        }
+
+        crc32c_table[0][i] = crc;
+    }
+
+    for ( i = 0; i < 256; i++ )
+    {
+        for ( j = 1; j < 8; j++ )
+        {
+            crc32c_table[j][i] =
+                crc32c_table[0][crc32c_table[j - 1][i] & 0xff] ^ ( crc32c_table[j - 1][i] >> 8 );
+        }
+    }
+
+    crc32c_update = crc32c_sw;
+}
+
+/**
+ * Calculate data checksum of given type
+ */
+uint32_t checksum_update ( uint32_t type, uint32_t crc, const uint8_t * buf, size_t len )
+{
+    if ( type == CHECKSUM_CRC32C )
+    {
+        return crc32c_update ( crc, buf, len );
+    }
+
+    return crc32b ( crc, buf, len );
+}
+
+/**
+ * Combine checksums of given type of two adjacent data blocks
+ */
+uint32_t checksum_combine ( uint32_t type, uint32_t crc1, uint32_t crc2, uint64_t len2 )
+{
+    return crc32_combine_poly ( type == CHECKSUM_CRC32C ? CRC32C_POLY : 0xedb88320, crc1, crc2,
+        len2 );
+}
@@ -0,0 +1,190 @@
+/* ------------------------------------------------------------------
+ * ZBox - Simple Data Achive Utility
+ * ------------------------------------------------------------------ */
+
+#include "zbox.h"
+
+#ifndef EXTRACT_ONLY
+
+#define DEDUP_MASK_S 0x0003590703530000ULL
+#define DEDUP_MASK_L 0x0000d90003530000ULL
+#define DEDUP_TABLE_INITIAL 4096
+
+/**
+ * Prepare deduplication context
+ */
+int dedup_init ( struct dedup_context_t *context )
+{
+    size_t i;
+    uint64_t seed = 0x5a424f5844454455ULL;
+    uint64_t z;
+
+    /* Generate gear hash table with splitmix64 */
+    for ( i = 0; i < sizeof ( context->gear ) / sizeof ( context->gear[0] ); i++ )
+    {
+        z = ( seed += 0x9e3779b97f4a7c15ULL );
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+        context->gear[i] = z ^ ( z >> 31 );
+    }
+
+    context->count = 0;
+    context->size = DEDUP_TABLE_INITIAL;
+    context->verify_fd = -1;
+    context->verify_node = NULL;
+
+    if ( !( context->table =
+            ( struct dedup_chunk_t * ) calloc ( context->size,
+                sizeof ( struct dedup_chunk_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Find content defined chunk boundary with normalized gear hashing
+ */
+size_t dedup_cut ( const struct dedup_context_t *context, const uint8_t * data, size_t len )
+{
+    size_t i;
+    size_t normal;
+    uint64_t hash = 0;
+
+    if ( len <= DEDUP_CHUNK_MIN )
+    {
+        return len;
+    }
+
+    if ( len > DEDUP_CHUNK_MAX )
+    {
+        len = DEDUP_CHUNK_MAX;
+    }
+
+    normal = len < DEDUP_CHUNK_AVG ? len : DEDUP_CHUNK_AVG;
+
+    for ( i = DEDUP_CHUNK_MIN; i < normal; i++ )
+    {
+        hash = ( hash << 1 ) + context->gear[data[i]];
+
+        if ( !( hash & DEDUP_MASK_S ) )
+        {
+            return i;
+        }
+    }
+
+    for ( ; i < len; i++ )
+    {
+        hash = ( hash << 1 ) + context->gear[data[i]];
+
+        if ( !( hash & DEDUP_MASK_L ) )
+        {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Double fingerprint table size
+ */
+static int dedup_grow ( struct dedup_context_t *context )
+{
+    size_t i;
+    size_t j;
+    size_t size;
+    struct dedup_chunk_t *table;
+
+    size = context->size << 1;
+
+    if ( !( table = ( struct dedup_chunk_t * ) calloc ( size, sizeof ( struct dedup_chunk_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    for ( i = 0; i < context->size; i++ )
+    {
+        if ( !context->table[i].len )
+        {
+            continue;
+        }
+
+        for ( j = context->table[i].hash & ( size - 1 ); table[j].len; j = ( j + 1 ) & ( size - 1 ) );
+
+        table[j] = context->table[i];
+    }
+
+    free ( context->table );
+    context->table = table;
+    context->size = size;
+
+    return 0;
+}
+
+/**
+ * Find chunk by fingerprint, iterate with previous match for next candidate
+ */
+struct dedup_chunk_t *dedup_find ( struct dedup_context_t *context, uint64_t hash, uint32_t len,
+    struct dedup_chunk_t *prev )
+{
+    size_t i;
+
+    i = prev ? ( size_t ) ( prev - context->table + 1 ) : hash;
+
+    for ( i &= context->size - 1; context->table[i].len; i = ( i + 1 ) & ( context->size - 1 ) )
+    {
+        if ( context->table[i].hash == hash && context->table[i].len == len )
+        {
+            return &context->table[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Insert chunk fingerprint into table
+ */
+int dedup_insert ( struct dedup_context_t *context, uint64_t hash, uint32_t len,
+    const struct node_t *node, uint64_t offset )
+{
+    size_t i;
+
+    /* Keep load factor below one half */
+    if ( ( context->count + 1 ) * 2 > context->size && dedup_grow ( context ) < 0 )
+    {
+        return -1;
+    }
+
+    for ( i = hash & ( context->size - 1 ); context->table[i].len;
+        i = ( i + 1 ) & ( context->size - 1 ) );
+
+    context->table[i].hash = hash;
+    context->table[i].len = len;
+    context->table[i].node = node;
+    context->table[i].offset = offset;
+    context->count++;
+
+    return 0;
+}
+
+/**
+ * Free deduplication context
+ */
+void dedup_free ( struct dedup_context_t *context )
+{
+    if ( context->verify_fd >= 0 )
+    {
+        close ( context->verify_fd );
+        context->verify_fd = -1;
+    }
+
+    free ( context->table );
+    context->table = NULL;
+}
+
+#endif
@@ -0,0 +1,168 @@
+/* ------------------------------------------------------------------
+ * ZBox - Simple Data Achive Utility
+ * ------------------------------------------------------------------ */
+
+#include "zbox.h"
+
+#ifndef EXTRACT_ONLY
+
+#define DELTA_PROBE_LIMIT 64
+
+/**
+ * Prepare delta context for base file of given size
+ */
+int delta_init ( struct delta_context_t *context, uint64_t size )
+{
+    uint64_t nblock;
+
+    /* Larger files get larger blocks to bound signatures count */
+    for ( context->block = DELTA_BLOCK;
+        size / context->block > DELTA_BLOCKS_MAX && context->block < DELTA_BLOCK_MAX;
+        context->block <<= 1 );
+
+    nblock = size / context->block;
+
+    if ( nblock > DELTA_BLOCKS_MAX )
+    {
+        nblock = DELTA_BLOCKS_MAX;
+    }
+
+    for ( context->size = 16; context->size < nblock * 2; context->size <<= 1 );
+
+    context->count = 0;
+
+    if ( !( context->table =
+            ( struct delta_block_t * ) calloc ( context->size,
+                sizeof ( struct delta_block_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Calculate rolling checksum of a block
+ */
+uint32_t delta_weak ( const uint8_t * data, size_t len )
+{
+    size_t i;
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    for ( i = 0; i < len; i++ )
+    {
+        a += data[i];
+        b += ( uint32_t ) ( len - i ) * data[i];
+    }
+
+    return ( ( b & 0xffff ) << 16 ) | ( a & 0xffff );
+}
+
+/**
+ * Roll block checksum forward by one byte
+ */
+uint32_t delta_roll ( uint32_t weak, uint8_t out, uint8_t in, size_t len )
+{
+    uint32_t a = weak & 0xffff;
+    uint32_t b = weak >> 16;
+
+    a = ( a - out + in ) & 0xffff;
+    b = ( b - ( uint32_t ) len * out + a ) & 0xffff;
+
+    return ( b << 16 ) | a;
+}
+
+/**
+ * Spread rolling checksum over table slots
+ */
+static size_t delta_slot ( const struct delta_context_t *context, uint32_t weak )
+{
+    return ( ( uint64_t ) weak * 0x9e3779b97f4a7c15ULL >> 32 ) & ( context->size - 1 );
+}
+
+/**
+ * Insert base block signature into table
+ */
+void delta_insert ( struct delta_context_t *context, uint32_t weak, uint64_t strong,
+    uint64_t offset )
+{
+    size_t i;
+    size_t probe = 0;
+
+    /* Keep load factor below one half */
+    if ( ( context->count + 1 ) * 2 > context->size )
+    {
+        return;
+    }
+
+    for ( i = delta_slot ( context, weak ); context->table[i].used;
+        i = ( i + 1 ) & ( context->size - 1 ) )
+    {
+        /* Repeated blocks are kept at few offsets only */
+        if ( ++probe > DELTA_PROBE_LIMIT )
+        {
+            return;
+        }
+    }
+
+    context->table[i].weak = weak;
+    context->table[i].strong = strong;
+    context->table[i].offset = offset;
+    context->table[i].used = 1;
+    context->count++;
+}
+
+/**
+ * Check if any base block has given rolling checksum
+ */
+int delta_lookup ( const struct delta_context_t *context, uint32_t weak )
+{
+    size_t i;
+
+    for ( i = delta_slot ( context, weak ); context->table[i].used;
+        i = ( i + 1 ) & ( context->size - 1 ) )
+    {
+        if ( context->table[i].weak == weak )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Find first matching base block at or after given offset
+ */
+const struct delta_block_t *delta_find ( const struct delta_context_t *context, uint32_t weak,
+    uint64_t strong, uint64_t offset )
+{
+    size_t i;
+    const struct delta_block_t *found = NULL;
+
+    for ( i = delta_slot ( context, weak ); context->table[i].used;
+        i = ( i + 1 ) & ( context->size - 1 ) )
+    {
+        if ( context->table[i].weak == weak && context->table[i].strong == strong
+            && context->table[i].offset >= offset && ( !found
+                || context->table[i].offset < found->offset ) )
+        {
+            found = &context->table[i];
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Free delta context
+ */
+void delta_free ( struct delta_context_t *context )
+{
+    free ( context->table );
+    context->table = NULL;
+}
+
+#endif
@@ -0,0 +1,351 @@
+/* ------------------------------------------------------------------
+ * ZBox - Simple Data Achive Utility
+ * ------------------------------------------------------------------ */
+
+#include "zbox.h"
+
+/**
+ * Match character against bracket expression, return its end or NULL
+ */
+static const char *glob_class ( const char *pattern, char c, int *matched )
+{
+    int negate = 0;
+    const char *p = pattern + 1;
+
+    if ( *p == '!' || *p == '^' )
+    {
+        negate = 1;
+        p++;
+    }
+
+    *matched = 0;
+
+    /* Closing bracket right after opening one is a literal */
+    do
+    {
+        if ( !*p )
+        {
+            return NULL;
+        }
+
+        if ( p[1] == '-' && p[2] && p[2] != ']' )
+        {
+            if ( c >= p[0] && c <= p[2] )
+            {
+                *matched = 1;
+            }
+
+            p += 3;
+
+        } else
+        {
+            if ( c == *p )
+            {
+                *matched = 1;
+            }
+
+            p++;
+        }
+
+    } while ( *p != ']' );
+
+    *matched ^= negate;
+
+    return p + 1;
+}
+
+/**
+ * Match path against glob pattern, single star stops at
+ * path separator, double star matches across separators
+ */
+int glob_match ( const char *pattern, const char *path )
+{
+    int matched;
+    const char *end;
+
+    for ( ; *pattern; pattern++, path++ )
+    {
+        if ( *pattern == '*' )
+        {
+            if ( pattern[1] == '*' )
+            {
+                /* Double star matches any remaining path part,
+                   followed by separator it matches no directory too */
+                for ( pattern += 2; *pattern == '*'; pattern++ );
+
+                if ( *pattern == '/' && glob_match ( pattern + 1, path ) )
+                {
+                    return 1;
+                }
+
+                for ( ;; path++ )
+                {
+                    if ( glob_match ( pattern, path ) )
+                    {
+                        return 1;
+                    }
+
+                    if ( !*path )
+                    {
+                        return 0;
+                    }
+                }
+            }
+
+            for ( pattern++;; path++ )
+            {
+                if ( glob_match ( pattern, path ) )
+                {
+                    return 1;
+                }
+
+                if ( !*path || *path == '/' )
+                {
+                    return 0;
+                }
+            }
+        }
+
+        if ( !*path )
+        {
+            return 0;
+        }
+
+        if ( *pattern == '?' )
+        {
+            if ( *path == '/' )
+            {
+                return 0;
+            }
+
+        } else if ( *pattern == '[' && ( end = glob_class ( pattern, *path, &matched ) ) )
+        {
+            if ( !matched || *path == '/' )
+            {
+                return 0;
+            }
+
+            pattern = end - 1;
+
+        } else
+        {
+            if ( *pattern == '\\' && pattern[1] )
+            {
+                pattern++;
+            }
+
+            if ( *pattern != *path )
+            {
+                return 0;
+            }
+        }
+    }
+
+    return !*path;
+}
+
+/**
+ * Add include or exclude pattern to filter
+ */
+int filter_add ( struct filter_t *filter, const char *text, int exclude )
+{
+    size_t len;
+    struct pattern_t *pattern;
+    struct pattern_t **table = exclude ? &filter->exclude : &filter->include;
+    size_t *count = exclude ? &filter->nexclude : &filter->ninclude;
+
+    /* Archive paths are relative and have no trailing separator */
+    while ( *text == '/' || ( text[0] == '.' && text[1] == '/' ) )
+    {
+        text += *text == '/' ? 1 : 2;
+    }
+
+    for ( len = strlen ( text ); len && text[len - 1] == '/'; len-- );
+
+    if ( !len )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( !( pattern =
+            ( struct pattern_t * ) realloc ( *table,
+                ( *count + 1 ) * sizeof ( struct pattern_t ) ) ) )
+    {
+        perror ( "realloc" );
+        return -1;
+    }
+
+    *table = pattern;
+    pattern += *count;
+
+    if ( !( pattern->text = ( char * ) malloc ( len + 1 ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    memcpy ( pattern->text, text, len );
+    pattern->text[len] = '\0';
+
+    /* Literal prefix rejects most paths without running the matcher */
+    pattern->prefix = strcspn ( pattern->text, "*?[\\" );
+    pattern->literal = !pattern->text[pattern->prefix];
+
+    /* Exclude pattern without separator matches name at any depth */
+    pattern->basename = exclude && !strchr ( pattern->text, '/' );
+    pattern->matched = 0;
+    ( *count )++;
+
+    return 0;
+}
+
+/**
+ * Load include patterns from list file, one per line
+ */
+int filter_load ( struct filter_t *filter, const char *listfile )
+{
+    int status = 0;
+    size_t len;
+    char line[PATH_LIMIT];
+    FILE *file;
+
+    if ( !strcmp ( listfile, "-" ) )
+    {
+        file = stdin;
+
+    } else if ( !( file = fopen ( listfile, "r" ) ) )
+    {
+        perror ( listfile );
+        return -1;
+    }
+
+    while ( fgets ( line, sizeof ( line ), file ) )
+    {
+        len = strlen ( line );
+
+        if ( len && line[len - 1] == '\n' )
+        {
+            line[--len] = '\0';
+
+        } else if ( !feof ( file ) )
+        {
+            errno = ENAMETOOLONG;
+            perror ( listfile );
+            status = -1;
+            break;
+        }
+
+        if ( len && filter_add ( filter, line, 0 ) < 0 )
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    if ( file != stdin )
+    {
+        fclose ( file );
+    }
+
+    return status;
+}
+
+/**
+ * Check if path matches pattern
+ */
+static int pattern_match ( struct pattern_t *pattern, const char *path )
+{
+    const char *name;
+
+    if ( pattern->basename && ( name = strrchr ( path, '/' ) ) )
+    {
+        path = name + 1;
+    }
+
+    if ( strncmp ( pattern->text, path, pattern->prefix ) )
+    {
+        return 0;
+    }
+
+    if ( pattern->literal ? path[pattern->prefix] != '\0' : !glob_match ( pattern->text +
+            pattern->prefix, path + pattern->prefix ) )
+    {
+        return 0;
+    }
+
+    pattern->matched = 1;
+
+    return 1;
+}
+
+/**
+ * Match archive path against filter patterns
+ */
+int filter_match ( struct filter_t *filter, const char *path )
+{
+    size_t i;
+    int status = FILTER_NONE;
+
+    for ( i = 0; i < filter->nexclude; i++ )
+    {
+        if ( pattern_match ( &filter->exclude[i], path ) )
+        {
+            return FILTER_EXCLUDE;
+        }
+    }
+
+    /* Each include pattern is marked when matched */
+    for ( i = 0; i < filter->ninclude; i++ )
+    {
+        if ( pattern_match ( &filter->include[i], path ) )
+        {
+            status = FILTER_INCLUDE;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Report include patterns not matched by any archive path
+ */
+int filter_unmatched ( const struct filter_t *filter )
+{
+    size_t i;
+    int status = 0;
+
+    for ( i = 0; i < filter->ninclude; i++ )
+    {
+        if ( !filter->include[i].matched )
+        {
+            fprintf ( stderr, "%s: not found in archive\n", filter->include[i].text );
+            errno = ENOENT;
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Free filter patterns
+ */
+void filter_free ( struct filter_t *filter )
+{
+    size_t i;
+
+    for ( i = 0; i < filter->ninclude; i++ )
+    {
+        free ( filter->include[i].text );
+    }
+
+    for ( i = 0; i < filter->nexclude; i++ )
+    {
+        free ( filter->exclude[i].text );
+    }
+
+    free ( filter->include );
+    free ( filter->exclude );
+    memset ( filter, '\0', sizeof ( struct filter_t ) );
+}
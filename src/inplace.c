@@ -0,0 +1,531 @@
+/* ------------------------------------------------------------------
+ * ZBox - Simple Data Achive Utility
+ * ------------------------------------------------------------------ */
+
+#include "zbox.h"
+
+/**
+ * Read in-place metadata section header and validate its bounds
+ */
+static int inplace_load_header ( int fd, const struct header_t *header,
+    struct inplace_header_t *inplace_header, uint64_t file_size )
+{
+    uint64_t nentity;
+
+    if ( ~header->flags & HEADER_FLAG_INPLACE || header->inplace_offset & 7
+        || header->inplace_offset > file_size
+        || file_size - header->inplace_offset < sizeof ( struct inplace_header_t ) )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( read_at ( fd, inplace_header, sizeof ( struct inplace_header_t ),
+            header->inplace_offset ) != sizeof ( struct inplace_header_t ) )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    inplace_header->nentity = le32 ( inplace_header->nentity );
+    inplace_header->size = le64 ( inplace_header->size );
+    inplace_header->entity_offset = le64 ( inplace_header->entity_offset );
+    inplace_header->child_offset = le64 ( inplace_header->child_offset );
+    inplace_header->name_offset = le64 ( inplace_header->name_offset );
+    inplace_header->name_size = le64 ( inplace_header->name_size );
+    inplace_header->root_count = le32 ( inplace_header->root_count );
+    inplace_header->index_offset = le64 ( inplace_header->index_offset );
+    inplace_header->index_size = le32 ( inplace_header->index_size );
+    nentity = inplace_header->nentity;
+
+    /* Tables must be aligned and fit in order within the section */
+    if ( inplace_header->magic[0] != 'z' || inplace_header->magic[1] != 'b'
+        || inplace_header->magic[2] != 'd' || inplace_header->magic[3] != 't'
+        || inplace_header->nentity != header->nentity
+        || inplace_header->size > file_size - header->inplace_offset
+        || inplace_header->entity_offset & 7
+        || inplace_header->entity_offset < sizeof ( struct inplace_header_t )
+        || inplace_header->child_offset < inplace_header->entity_offset
+        + nentity * sizeof ( struct inplace_entity_t ) || inplace_header->child_offset & 3
+        || inplace_header->name_offset < inplace_header->child_offset
+        + nentity * sizeof ( uint32_t )
+        || !inplace_header->name_size || inplace_header->name_offset > inplace_header->size
+        || inplace_header->name_size > inplace_header->size - inplace_header->name_offset
+        || inplace_header->root_count > nentity || inplace_header->index_offset & 7
+        || inplace_header->index_size & ( inplace_header->index_size - 1 )
+        || inplace_header->index_offset > inplace_header->size
+        || inplace_header->index_size > ( inplace_header->size - inplace_header->index_offset )
+        / sizeof ( struct inplace_slot_t ) )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Map in-place metadata section of an archive, its checksum is verified
+ */
+int inplace_open ( int fd, const struct header_t *header, struct inplace_meta_t *inplace )
+{
+#ifndef WIN32_BUILD
+    size_t page;
+    uint64_t start;
+    struct stat statbuf;
+    struct inplace_header_t inplace_header;
+    const unsigned char *section;
+
+    if ( fstat ( fd, &statbuf ) < 0 )
+    {
+        perror ( "fstat" );
+        return -1;
+    }
+
+    if ( inplace_load_header ( fd, header, &inplace_header, statbuf.st_size ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Section is mapped from its page, tables are used in place */
+    page = sysconf ( _SC_PAGESIZE );
+    start = header->inplace_offset - header->inplace_offset % page;
+    inplace->map_size = header->inplace_offset - start + inplace_header.size;
+
+    if ( ( inplace->map =
+            mmap ( NULL, inplace->map_size, PROT_READ, MAP_SHARED, fd, start ) ) == MAP_FAILED )
+    {
+        perror ( "mmap" );
+        return -1;
+    }
+
+    section = ( const unsigned char * ) inplace->map + ( header->inplace_offset - start );
+
+    /* Section is used only if its checksum matches */
+    if ( ~checksum_update ( header->checksum, 0xffffffff, section,
+            inplace_header.size ) != header->inplace_crc32 )
+    {
+        inplace_close ( inplace );
+        errno = EINVAL;
+        return -1;
+    }
+
+    inplace->nentity = inplace_header.nentity;
+    inplace->root_count = inplace_header.root_count;
+    inplace->entity_table =
+        ( const struct inplace_entity_t * ) ( section + inplace_header.entity_offset );
+    inplace->child_table = ( const uint32_t * ) ( section + inplace_header.child_offset );
+    inplace->name_table = ( const char * ) ( section + inplace_header.name_offset );
+    inplace->name_size = inplace_header.name_size;
+    inplace->slot_table =
+        ( const struct inplace_slot_t * ) ( section + inplace_header.index_offset );
+    inplace->nslot = inplace_header.index_size;
+
+    /* Name table must ends with zero byte */
+    if ( inplace->name_table[inplace->name_size - 1] != '\0' )
+    {
+        inplace_close ( inplace );
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+#else
+    UNUSED ( fd );
+    UNUSED ( header );
+    UNUSED ( inplace );
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * Verify in-place metadata section checksum
+ */
+int inplace_verify ( int fd, const struct header_t *header )
+{
+    ssize_t len;
+    uint64_t left;
+    uint64_t offset;
+    uint32_t crc32 = 0xffffffff;
+    struct stat statbuf;
+    struct inplace_header_t inplace_header;
+    unsigned char *buf;
+
+    if ( fstat ( fd, &statbuf ) < 0 )
+    {
+        perror ( "fstat" );
+        return -1;
+    }
+
+    if ( inplace_load_header ( fd, header, &inplace_header, statbuf.st_size ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( !( buf = ( unsigned char * ) malloc ( WORKBUF_LIMIT ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    for ( left = inplace_header.size, offset = header->inplace_offset; left;
+        left -= len, offset += len )
+    {
+        len = left > WORKBUF_LIMIT ? WORKBUF_LIMIT : left;
+
+        if ( read_at ( fd, buf, len, offset ) != len )
+        {
+            free ( buf );
+            errno = EINVAL;
+            return -1;
+        }
+
+        crc32 = checksum_update ( header->checksum, crc32, buf, len );
+    }
+
+    free ( buf );
+
+    if ( ~crc32 != header->inplace_crc32 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get entity name with in-place metadata section
+ */
+static const char *inplace_name ( const struct inplace_meta_t *inplace, uint32_t index )
+{
+    uint64_t name = le64 ( inplace->entity_table[index].name );
+
+    if ( name >= inplace->name_size )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return inplace->name_table + name;
+}
+
+/**
+ * List directory children with in-place metadata section, paths are
+ * matched against filter if given, included directory includes its contents
+ */
+static int inplace_list_next ( const struct inplace_meta_t *inplace, struct filter_t *filter,
+    uint32_t options, uint32_t parent, uint32_t first, uint32_t count, char *path,
+    size_t path_size, int included )
+{
+    int match;
+    int selected;
+    uint32_t i;
+    uint32_t index;
+    uint32_t mode;
+    size_t path_len;
+    const char *name;
+    const struct inplace_entity_t *entity;
+
+    if ( first > inplace->nentity || count > inplace->nentity - first )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for ( i = first; i < first + count; i++ )
+    {
+        index = le32 ( inplace->child_table[i] );
+
+        /* Children follow their parent, cycles are not possible */
+        if ( index >= inplace->nentity || ( parent != ENTITY_INDEX_NONE && index <= parent ) )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        entity = &inplace->entity_table[index];
+        mode = le32 ( entity->mode );
+
+        if ( !( name = inplace_name ( inplace, index ) ) )
+        {
+            return -1;
+        }
+
+        path_len = strlen ( path );
+
+        if ( path_concat ( path, path_size, name ) < 0 )
+        {
+            return -1;
+        }
+
+        match = filter ? filter_match ( filter, path ) : FILTER_NONE;
+        selected = included || match == FILTER_INCLUDE || !filter || !filter->ninclude;
+
+        if ( match != FILTER_EXCLUDE )
+        {
+            if ( selected && ~mode & S_IFDIR && ~mode & ENTITY_SHADOWED )
+            {
+                show_progress ( 'l', options & OPTION_NOPATHS ? name : path );
+            }
+
+            if ( mode & S_IFDIR
+                && inplace_list_next ( inplace, filter, options, index, le32 ( entity->first ),
+                    le32 ( entity->count ), path, path_size, selected ) < 0 )
+            {
+                return -1;
+            }
+        }
+
+        path[path_len] = '\0';
+    }
+
+    return 0;
+}
+
+/**
+ * Build entity path with in-place metadata section
+ */
+static int inplace_path ( const struct inplace_meta_t *inplace, uint32_t index, char *path,
+    size_t path_size )
+{
+    uint32_t parent = le32 ( inplace->entity_table[index].parent );
+    const char *name;
+
+    if ( parent == ENTITY_INDEX_NONE )
+    {
+        path[0] = '\0';
+
+    } else if ( parent >= index )
+    {
+        errno = EINVAL;
+        return -1;
+
+    } else if ( inplace_path ( inplace, parent, path, path_size ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( !( name = inplace_name ( inplace, index ) ) )
+    {
+        return -1;
+    }
+
+    return path_concat ( path, path_size, name );
+}
+
+/**
+ * Find entity by path walking children ranges, used without path index
+ */
+static uint32_t inplace_walk ( const struct inplace_meta_t *inplace, const char *path )
+{
+    size_t len;
+    uint32_t i;
+    uint32_t first = 0;
+    uint32_t count = inplace->root_count;
+    uint32_t index = ENTITY_INDEX_NONE;
+    const char *name;
+    const struct inplace_entity_t *entity;
+
+    for ( ;; )
+    {
+        /* Separators are skipped, path ends after last name */
+        while ( *path == '/' )
+        {
+            path++;
+        }
+
+        if ( !*path )
+        {
+            break;
+        }
+
+        if ( first > inplace->nentity || count > inplace->nentity - first )
+        {
+            errno = EINVAL;
+            return ENTITY_INDEX_NONE;
+        }
+
+        len = strcspn ( path, "/" );
+
+        for ( i = first, index = ENTITY_INDEX_NONE; i < first + count; i++ )
+        {
+            index = le32 ( inplace->child_table[i] );
+
+            if ( index >= inplace->nentity || !( name = inplace_name ( inplace, index ) ) )
+            {
+                errno = EINVAL;
+                return ENTITY_INDEX_NONE;
+            }
+
+            entity = &inplace->entity_table[index];
+
+            if ( ~le32 ( entity->mode ) & ENTITY_SHADOWED && !strncmp ( name, path, len )
+                && !name[len] )
+            {
+                break;
+            }
+
+            index = ENTITY_INDEX_NONE;
+        }
+
+        if ( index == ENTITY_INDEX_NONE )
+        {
+            break;
+        }
+
+        first = le32 ( entity->first );
+        count = le32 ( entity->count );
+        path += len;
+    }
+
+    if ( index == ENTITY_INDEX_NONE )
+    {
+        errno = ENOENT;
+    }
+
+    return index;
+}
+
+/**
+ * Find entity by path with in-place metadata section
+ */
+uint32_t inplace_lookup ( const struct inplace_meta_t *inplace, const char *path )
+{
+    size_t len;
+    size_t slot;
+    uint32_t index;
+    uint64_t hash;
+    char entity_path[PATH_LIMIT];
+
+    if ( !inplace->nslot )
+    {
+        return inplace_walk ( inplace, path );
+    }
+
+    /* Leading and trailing separators do not belong to indexed path */
+    while ( *path == '/' )
+    {
+        path++;
+    }
+
+    for ( len = strlen ( path ); len && path[len - 1] == '/'; len-- );
+
+    hash = xxh64 ( 0, ( const uint8_t * ) path, len );
+
+    for ( slot = hash & ( inplace->nslot - 1 ); inplace->slot_table[slot].entity;
+        slot = ( slot + 1 ) & ( inplace->nslot - 1 ) )
+    {
+        if ( le32 ( inplace->slot_table[slot].hash ) != ( uint32_t ) ( hash >> 32 ) )
+        {
+            continue;
+        }
+
+        index = le32 ( inplace->slot_table[slot].entity ) - 1;
+
+        if ( index >= inplace->nentity )
+        {
+            errno = EINVAL;
+            return ENTITY_INDEX_NONE;
+        }
+
+        /* Hash match is confirmed with entity path */
+        if ( inplace_path ( inplace, index, entity_path, sizeof ( entity_path ) ) < 0 )
+        {
+            return ENTITY_INDEX_NONE;
+        }
+
+        if ( !strncmp ( entity_path, path, len ) && !entity_path[len] )
+        {
+            return index;
+        }
+    }
+
+    errno = ENOENT;
+    return ENTITY_INDEX_NONE;
+}
+
+/**
+ * Check if filter only selects exact paths
+ */
+static int inplace_literal ( const struct filter_t *filter )
+{
+    size_t i;
+
+    for ( i = 0; i < filter->ninclude; i++ )
+    {
+        if ( !filter->include[i].literal )
+        {
+            return 0;
+        }
+    }
+
+    return filter->ninclude && !filter->nexclude;
+}
+
+/**
+ * List archive files selected by filter with in-place metadata section
+ */
+int inplace_list ( const struct inplace_meta_t *inplace, uint32_t options, struct filter_t *filter )
+{
+    size_t i;
+    uint32_t index;
+    char path[PATH_LIMIT];
+    const struct inplace_entity_t *entity;
+
+    path[0] = '\0';
+
+    /* Patterns are matched against every path unless all are exact */
+    if ( !filter || !inplace_literal ( filter ) )
+    {
+        return inplace_list_next ( inplace, filter, options, ENTITY_INDEX_NONE, 0,
+            inplace->root_count, path, sizeof ( path ), 0 );
+    }
+
+    for ( i = 0; i < filter->ninclude; i++ )
+    {
+        if ( ( index = inplace_lookup ( inplace, filter->include[i].text ) ) == ENTITY_INDEX_NONE )
+        {
+            if ( errno == ENOENT )
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        filter->include[i].matched = 1;
+
+        if ( inplace_path ( inplace, index, path, sizeof ( path ) ) < 0 )
+        {
+            return -1;
+        }
+
+        entity = &inplace->entity_table[index];
+
+        /* Directories are listed with all their contents */
+        if ( ~le32 ( entity->mode ) & S_IFDIR )
+        {
+            show_progress ( 'l', path );
+
+        } else if ( inplace_list_next ( inplace, NULL, options, index, le32 ( entity->first ),
+                le32 ( entity->count ), path, sizeof ( path ), 1 ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Unmap in-place metadata section
+ */
+void inplace_close ( struct inplace_meta_t *inplace )
+{
+#ifndef WIN32_BUILD
+    munmap ( inplace->map, inplace->map_size );
+#endif
+    inplace->map = NULL;
+}
@@ -9,20 +9,46 @@
  */
 static void show_usage ( void )
 {
-    fprintf ( stderr, "usage: zbox -{cxelth}[snb0..9] archive [path]\n"
+    fprintf ( stderr, "usage: zbox -{caxelpth}[snbgdSIBRDuCM0..9] archive [base] [path]\n"
+        "       zbox -{ca}[...] archive [base] [path] [--exclude=glob] [--one-file-system]\n"
+        "       zbox -{ca}[...] archive [base] -T listfile [--null] [--exclude=glob]\n"
+        "       zbox -{ca}[...] archive [base] [path] [--map-min=size] [--direct-io]\n"
+        "       zbox -{ca}[...] archive [base] [path] [--readahead=N] [--readahead-size=size]\n"
+        "       zbox -{xelt}[su] archive [glob] [-T listfile] [--exclude=glob]\n"
+        "       zbox -{xelt}[su] archive [glob] [--populate] [--direct-io]\n"
+        "       zbox -p archive path [--offset N] [--length M]\n"
         "\n"
         "version: " ZBOX_VERSION "\n"
         "\n"
         "options:\n"
         "  -c    create new archive\n"
+        "  -a    append files to archive\n"
         "  -x    extract archive\n"
         "  -e    extract archive, no paths\n"
-        "  -l    list only files in archive\n"
+        "  -l    list files in archive\n"
+        "  -p    print file in archive to standard output\n"
         "  -t    check archive checksum\n"
         "  -h    show help message\n"
         "  -s    skip additional info\n"
         "  -n    turn off zlib compression\n"
-        "  -b    use best compression ratio\n" "  -0..9 preset compression ratio\n" "\n" );
+        "  -b    use best compression ratio\n"
+        "  -g    group similar files together\n"
+        "  -d    deduplicate repeated data chunks\n"
+        "  -S    store file holes efficiently\n"
+        "  -I    store only files changed since base archive\n"
+        "  -B    store each file in own compressed block\n"
+        "  -R    reuse compressed blocks of base archive\n"
+        "  -D    store changed files as delta to base archive\n"
+        "  -u    skip extracting files unchanged on disk\n"
+        "  -C    use hardware accelerated CRC32C checksums\n"
+        "  -M    store metadata copy for in-place use\n"
+        "  -0..9 preset compression ratio\n"
+        "\n"
+        "paths:\n"
+        "  path arguments are stored as given, absolute ones or ones\n"
+        "  with parent references are stored from their last name\n"
+        "  listfile paths are stored whole without leading separator,\n"
+        "  parent references are not allowed there\n" "\n" );
 }
 
 /** 
@@ -33,6 +59,239 @@ static int check_flag ( const char *str, char flag )
     return strchr ( str, flag ) != NULL;
 }
 
+/**
+ * Build member filter from include globs, list files and exclude globs,
+ * archive read options are taken too
+ */
+static int parse_filter ( struct filter_t *filter, uint32_t * options, int argc, char *argv[] )
+{
+    int i;
+
+    for ( i = 0; i < argc; i++ )
+    {
+        if ( !strcmp ( argv[i], "--populate" ) )
+        {
+            *options |= OPTION_POPULATE;
+
+        } else if ( !strcmp ( argv[i], "--direct-io" ) )
+        {
+            *options |= OPTION_DIRECT_IO;
+
+        } else if ( !strcmp ( argv[i], "-T" ) )
+        {
+            if ( ++i == argc )
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            if ( filter_load ( filter, argv[i] ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( !strncmp ( argv[i], "--exclude=", 10 ) )
+        {
+            if ( filter_add ( filter, argv[i] + 10, 1 ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( filter_add ( filter, argv[i], 0 ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Parse plain decimal number
+ */
+static int parse_number ( const char *text, uint64_t * value )
+{
+    char *end;
+
+    if ( *text < '0' || *text > '9' )
+    {
+        return -1;
+    }
+
+    errno = 0;
+    *value = strtoull ( text, &end, 10 );
+
+    return errno || *end ? -1 : 0;
+}
+
+/**
+ * Parse byte size with optional K, M or G suffix
+ */
+static int parse_size ( const char *text, uint64_t * size )
+{
+    char *end;
+
+    if ( *text < '0' || *text > '9' )
+    {
+        return -1;
+    }
+
+    errno = 0;
+    *size = strtoull ( text, &end, 10 );
+
+    if ( errno )
+    {
+        return -1;
+    }
+
+    if ( *end == 'K' )
+    {
+        *size <<= 10;
+        end++;
+
+    } else if ( *end == 'M' )
+    {
+        *size <<= 20;
+        end++;
+
+    } else if ( *end == 'G' )
+    {
+        *size <<= 30;
+        end++;
+    }
+
+    return *end ? -1 : 0;
+}
+
+/**
+ * Take exclude globs and scan options out of input paths, arguments left are counted,
+ * list files replace input paths, only base archive may precede them
+ */
+static int parse_scan_options ( struct filter_t *filter, uint32_t * options, int argc,
+    char *argv[] )
+{
+    int i;
+    int paths = 0;
+    int count = 3;
+    uint64_t size;
+    uint32_t ahead_files = READAHEAD_FILES;
+    uint64_t ahead_bytes = READAHEAD_BYTES;
+
+    for ( i = 3; i < argc; i++ )
+    {
+        if ( !strncmp ( argv[i], "--exclude=", 10 ) )
+        {
+            if ( filter_add ( filter, argv[i] + 10, 1 ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( !strcmp ( argv[i], "--one-file-system" ) )
+        {
+            *options |= OPTION_ONE_FS;
+
+        } else if ( !strcmp ( argv[i], "--null" ) )
+        {
+            *options |= OPTION_NULL;
+
+        } else if ( !strcmp ( argv[i], "--direct-io" ) )
+        {
+            *options |= OPTION_DIRECT_IO;
+
+        } else if ( !strncmp ( argv[i], "--map-min=", 10 ) )
+        {
+            if ( parse_size ( argv[i] + 10, &size ) < 0 )
+            {
+                return -1;
+            }
+#ifndef EXTRACT_ONLY
+            pack_set_map_min ( size );
+#endif
+
+        } else if ( !strncmp ( argv[i], "--readahead=", 12 ) )
+        {
+            if ( parse_number ( argv[i] + 12, &size ) < 0 || size > 65536 )
+            {
+                return -1;
+            }
+
+            ahead_files = size;
+
+        } else if ( !strncmp ( argv[i], "--readahead-size=", 17 ) )
+        {
+            if ( parse_size ( argv[i] + 17, &ahead_bytes ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( !strcmp ( argv[i], "-T" ) )
+        {
+            if ( ++i == argc )
+            {
+                return -1;
+            }
+
+            *options |= OPTION_LIST;
+            argv[count++] = argv[i];
+
+        } else if ( *options & OPTION_LIST )
+        {
+            return -1;
+
+        } else
+        {
+            argv[count++] = argv[i];
+            paths++;
+        }
+    }
+
+    if ( *options & OPTION_LIST && paths > ( *options & ( OPTION_INCREMENTAL | OPTION_REUSE )
+            ? 1 : 0 ) )
+    {
+        return -1;
+    }
+#ifndef EXTRACT_ONLY
+    pack_set_readahead ( ahead_files, ahead_bytes );
+#else
+    UNUSED ( ahead_files );
+    UNUSED ( ahead_bytes );
+#endif
+
+    return count;
+}
+
+/**
+ * Parse printed byte range options
+ */
+static int parse_range ( int argc, char *argv[], uint64_t * offset, uint64_t * length )
+{
+    int i;
+    uint64_t *value;
+
+    for ( i = 0; i < argc; i++ )
+    {
+        if ( !strcmp ( argv[i], "--offset" ) )
+        {
+            value = offset;
+
+        } else if ( !strcmp ( argv[i], "--length" ) )
+        {
+            value = length;
+
+        } else
+        {
+            return -1;
+        }
+
+        if ( ++i == argc || parse_number ( argv[i], value ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Program entry point
  */
@@ -44,12 +303,27 @@ int main ( int argc, char *argv[] )
 #endif
     uint32_t options = OPTION_VERBOSE | OPTION_ZLIB;
     int flag_c;
+    int flag_a;
     int flag_x;
     int flag_e;
     int flag_l;
+    int flag_p;
     int flag_t;
     int flag_s;
     int flag_n;
+    int flag_g;
+    int flag_d;
+    int flag_S;
+    int flag_I;
+    int flag_B;
+    int flag_R;
+    int flag_D;
+    int flag_u;
+    int flag_C;
+    int flag_M;
+    uint64_t offset = 0;
+    uint64_t length = ( uint64_t ) - 1;
+    struct filter_t filter;
 
     /* Validate arguments count */
     if ( argc < 3 )
@@ -58,24 +332,39 @@ int main ( int argc, char *argv[] )
         return 1;
     }
 
+    /* Select checksum implementation */
+    crc32c_init (  );
+
     /* Parse flags from arguments */
     flag_c = check_flag ( argv[1], 'c' );
+    flag_a = check_flag ( argv[1], 'a' );
     flag_x = check_flag ( argv[1], 'x' );
     flag_e = check_flag ( argv[1], 'e' );
     flag_l = check_flag ( argv[1], 'l' );
+    flag_p = check_flag ( argv[1], 'p' );
     flag_t = check_flag ( argv[1], 't' );
     flag_s = check_flag ( argv[1], 's' );
     flag_n = check_flag ( argv[1], 'n' );
+    flag_g = check_flag ( argv[1], 'g' );
+    flag_d = check_flag ( argv[1], 'd' );
+    flag_S = check_flag ( argv[1], 'S' );
+    flag_I = check_flag ( argv[1], 'I' );
+    flag_B = check_flag ( argv[1], 'B' );
+    flag_R = check_flag ( argv[1], 'R' );
+    flag_D = check_flag ( argv[1], 'D' );
+    flag_u = check_flag ( argv[1], 'u' );
+    flag_C = check_flag ( argv[1], 'C' );
+    flag_M = check_flag ( argv[1], 'M' );
 
     /* Validate selected tasks count */
-    if ( flag_c + flag_x + flag_e + flag_l + flag_t != 1 )
+    if ( flag_c + flag_a + flag_x + flag_e + flag_l + flag_p + flag_t != 1 )
     {
         show_usage (  );
         return 1;
     }
 
-    /* Unset verbose if silent mode flag set */
-    if ( flag_s )
+    /* Unset verbose if silent mode flag set, printed file data is the only output */
+    if ( flag_s || flag_p )
     {
         options &= ~OPTION_VERBOSE;
     }
@@ -86,6 +375,12 @@ int main ( int argc, char *argv[] )
         options |= OPTION_LISTONLY;
     }
 
+    /* Set append option if needed */
+    if ( flag_a )
+    {
+        options |= OPTION_APPEND;
+    }
+
     /* Set test only option if needed */
     if ( flag_t )
     {
@@ -104,6 +399,66 @@ int main ( int argc, char *argv[] )
         options &= ~OPTION_ZLIB;
     }
 
+    /* Set group similar files option if needed */
+    if ( flag_g )
+    {
+        options |= OPTION_GROUP;
+    }
+
+    /* Set deduplicate data option if needed */
+    if ( flag_d )
+    {
+        options |= OPTION_DEDUP;
+    }
+
+    /* Set sparse files option if needed */
+    if ( flag_S )
+    {
+        options |= OPTION_SPARSE;
+    }
+
+    /* Set incremental archive option if needed */
+    if ( flag_I )
+    {
+        options |= OPTION_INCREMENTAL;
+    }
+
+    /* Set file segments option if needed */
+    if ( flag_B )
+    {
+        options |= OPTION_FILE_SEGMENTS;
+    }
+
+    /* Set reuse compressed data option if needed, files get own segments */
+    if ( flag_R )
+    {
+        options |= OPTION_REUSE | OPTION_FILE_SEGMENTS;
+    }
+
+    /* Set delta encoding option if needed */
+    if ( flag_D )
+    {
+        options |= OPTION_DELTA;
+    }
+
+    /* Set compare with existing files option if needed */
+    if ( flag_u )
+    {
+        options |= OPTION_COMPARE;
+    }
+
+    /* Set CRC32C checksum option if needed */
+    if ( flag_C )
+    {
+        options |= OPTION_CRC32C;
+    }
+
+    /* Set in-place metadata option if needed */
+    if ( flag_M )
+    {
+        options |= OPTION_INPLACE;
+    }
+
 #ifndef EXTRACT_ONLY
     /* Adjust compression level */
     if ( strchr ( argv[1], '0' ) )
@@ -149,25 +504,79 @@ int main ( int argc, char *argv[] )
 #endif
 
     /* Perform appriopriate action */
-    if ( flag_c )
+    if ( flag_c || flag_a )
     {
-        if ( argc < 4 )
+        memset ( &filter, '\0', sizeof ( filter ) );
+
+        /* Scan options are taken out of input paths */
+        if ( ( argc = parse_scan_options ( &filter, &options, argc, argv ) ) < 0 || argc < 4
+            || flag_I + flag_R > 1 || ( ( flag_I || flag_R ) && ( flag_a || argc < 5 ) )
+            || ( flag_D && !flag_I ) )
         {
+            filter_free ( &filter );
             show_usage (  );
             return 1;
         }
 #ifndef EXTRACT_ONLY
-        status =
-            zbox_pack_archive ( argv[2], options, level, ( const char ** ) ( argv + 3 ), argc - 3 );
+        if ( options & OPTION_APPEND )
+        {
+            status =
+                zbox_append_archive ( argv[2], options, level, ( const char ** ) ( argv + 3 ),
+                argc - 3, &filter );
+
+        } else if ( options & ( OPTION_INCREMENTAL | OPTION_REUSE ) )
+        {
+            status =
+                zbox_pack_archive ( argv[2], options, level, argv[3],
+                ( const char ** ) ( argv + 4 ), argc - 4, &filter );
+
+        } else
+        {
+            status =
+                zbox_pack_archive ( argv[2], options, level, NULL,
+                ( const char ** ) ( argv + 3 ), argc - 3, &filter );
+        }
+
+        filter_free ( &filter );
 #else
 
         fprintf ( stderr, "archive create not enabled.\n" );
         status = -1;
 #endif
 
+    } else if ( flag_p )
+    {
+        memset ( &filter, '\0', sizeof ( filter ) );
+
+        if ( argc < 4 || parse_range ( argc - 4, argv + 4, &offset, &length ) < 0
+            || filter_add ( &filter, argv[3], 0 ) < 0 )
+        {
+            filter_free ( &filter );
+            show_usage (  );
+            return 1;
+        }
+
+        if ( ( status = zbox_print_archive ( argv[2], options, &filter, offset, length ) ) >= 0
+            && filter_unmatched ( &filter ) < 0 )
+        {
+            status = -1;
+        }
+
+        filter_free ( &filter );
+
     } else if ( flag_x || flag_e || flag_l || flag_t )
     {
-        status = zbox_unpack_archive ( argv[2], options );
+        memset ( &filter, '\0', sizeof ( filter ) );
+
+        /* Only selected files are unpacked, every include glob must match */
+        if ( ( status = parse_filter ( &filter, &options, argc - 3, argv + 3 ) ) >= 0
+            && ( status = zbox_unpack_archive ( argv[2], options, &filter ) ) >= 0
+            && filter_unmatched ( &filter ) < 0 )
+        {
+            status = -1;
+        }
+
+        filter_free ( &filter );
     }
 
     /* Show failure message if needed */
@@ -0,0 +1,825 @@
+/* ------------------------------------------------------------------
+ * ZBox - Simple Data Achive Utility
+ * ------------------------------------------------------------------ */
+
+#include "zbox.h"
+
+/**
+ * Load archive segment and location tables
+ */
+static int meta_load_segments ( struct ar_istream *istream, struct archive_meta_t *meta )
+{
+    uint32_t i;
+    uint32_t nsegment_net;
+
+    /* Read segments count */
+    if ( istream->read ( istream, &nsegment_net, sizeof ( nsegment_net ) ) < 0 )
+    {
+        return -1;
+    }
+
+    meta->nsegment = ntohl ( nsegment_net );
+
+    /* Allocate segment table */
+    if ( !( meta->segment_table =
+            ( struct segment_t * ) malloc ( ( meta->nsegment ? meta->nsegment : 1 ) *
+                sizeof ( struct segment_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    /* Read segment table */
+    if ( istream->read ( istream, meta->segment_table,
+            meta->nsegment * sizeof ( struct segment_t ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Convert segments to host byte order */
+    for ( i = 0; i < meta->nsegment; i++ )
+    {
+        meta->segment_table[i].offset = ntoh64 ( meta->segment_table[i].offset );
+        meta->segment_table[i].size = ntoh64 ( meta->segment_table[i].size );
+        meta->segment_table[i].rawsize = ntoh64 ( meta->segment_table[i].rawsize );
+        meta->segment_table[i].crc32 = ntohl ( meta->segment_table[i].crc32 );
+    }
+
+    /* Allocate location table */
+    if ( !( meta->location_table =
+            ( struct location_t * ) malloc ( meta->header.nentity *
+                sizeof ( struct location_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    /* Read location table */
+    if ( istream->read ( istream, meta->location_table,
+            meta->header.nentity * sizeof ( struct location_t ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Convert locations to host byte order */
+    for ( i = 0; i < meta->header.nentity; i++ )
+    {
+        meta->location_table[i].segment = ntohl ( meta->location_table[i].segment );
+        meta->location_table[i].offset = ntoh64 ( meta->location_table[i].offset );
+        meta->location_table[i].size = ntoh64 ( meta->location_table[i].size );
+
+        if ( meta->location_table[i].segment != SEGMENT_NONE
+            && ( meta->location_table[i].segment >= meta->nsegment
+                || meta->location_table[i].offset + meta->location_table[i].size >
+                meta->segment_table[meta->location_table[i].segment].rawsize ) )
+        {
+            fprintf ( stderr, "archive data location: bad\n" );
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Load archive extended metadata, base archive and files state
+ */
+static int meta_load_extended ( struct ar_istream *istream, struct archive_meta_t *meta )
+{
+    uint32_t i;
+    uint32_t base_net[2];
+
+    /* Read base archive checksum and name length */
+    if ( istream->read ( istream, base_net, sizeof ( base_net ) ) < 0 )
+    {
+        return -1;
+    }
+
+    meta->base_crc32 = ntohl ( base_net[0] );
+    base_net[1] = ntohl ( base_net[1] );
+
+    /* Read base archive name if present */
+    if ( base_net[1] )
+    {
+        if ( base_net[1] >= PATH_LIMIT )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( !( meta->base_name = ( char * ) malloc ( base_net[1] + 1 ) ) )
+        {
+            perror ( "malloc" );
+            return -1;
+        }
+
+        if ( istream->read ( istream, meta->base_name, base_net[1] ) < 0 )
+        {
+            return -1;
+        }
+
+        meta->base_name[base_net[1]] = '\0';
+    }
+
+    /* Allocate files state table */
+    if ( !( meta->ext_table =
+            ( struct entity_ext_t * ) malloc ( ( meta->header.nentity ? meta->header.nentity : 1 )
+                * sizeof ( struct entity_ext_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    /* Read files state table */
+    if ( istream->read ( istream, meta->ext_table,
+            meta->header.nentity * sizeof ( struct entity_ext_t ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Convert files state to host byte order */
+    for ( i = 0; i < meta->header.nentity; i++ )
+    {
+        meta->ext_table[i].mtime = ntoh64 ( meta->ext_table[i].mtime );
+        meta->ext_table[i].ctime = ntoh64 ( meta->ext_table[i].ctime );
+        meta->ext_table[i].inode = ntoh64 ( meta->ext_table[i].inode );
+        meta->ext_table[i].base = ntohl ( meta->ext_table[i].base );
+    }
+
+    return 0;
+}
+
+/**
+ * Load files data checksums
+ */
+static int meta_load_checksums ( struct ar_istream *istream, struct archive_meta_t *meta )
+{
+    uint32_t i;
+
+    /* Allocate checksum table */
+    if ( !( meta->crc_table =
+            ( uint32_t * ) malloc ( ( meta->header.nentity ? meta->header.nentity : 1 ) *
+                sizeof ( uint32_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    /* Read checksum table */
+    if ( istream->read ( istream, meta->crc_table, meta->header.nentity * sizeof ( uint32_t ) ) <
+        0 )
+    {
+        return -1;
+    }
+
+    /* Convert checksums to host byte order */
+    for ( i = 0; i < meta->header.nentity; i++ )
+    {
+        meta->crc_table[i] = ntohl ( meta->crc_table[i] );
+    }
+
+    return 0;
+}
+
+/**
+ * Get archive names length
+ */
+uint64_t meta_nameslen ( const struct header_t *header )
+{
+    if ( header->flags & HEADER_FLAG_V2 )
+    {
+        return ( uint64_t ) header->nameslen_high << 32 | header->nameslen;
+    }
+
+    return header->nameslen;
+}
+
+/**
+ * Set entity size or directory identifier
+ */
+static void meta_entity_size ( struct entity_t *entity, uint64_t value )
+{
+    if ( entity->mode & S_IFDIR )
+    {
+        entity->size = 0;
+        entity->id = value;
+
+    } else
+    {
+        entity->size = value;
+    }
+}
+
+/**
+ * Load archive entity table, v1 entities have 32-bit sizes
+ */
+static int meta_load_entities ( struct ar_istream *istream, struct archive_meta_t *meta )
+{
+    uint32_t i;
+    uint32_t nentity = meta->header.nentity;
+    struct entity_v1_t *entity_v1;
+    struct entity_t *entity_table;
+
+    /* Allocate entity table */
+    if ( !( meta->entity_table =
+            ( struct entity_t * ) malloc ( ( nentity ? nentity : 1 ) *
+                sizeof ( struct entity_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    entity_table = meta->entity_table;
+
+    if ( meta->header.flags & HEADER_FLAG_V2 )
+    {
+        /* Read entity table */
+        if ( istream->read ( istream, entity_table, nentity * sizeof ( struct entity_t ) ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Convert entities to host byte order */
+        for ( i = 0; i < nentity; i++ )
+        {
+            entity_table[i].parent = ntohl ( entity_table[i].parent );
+            entity_table[i].mode = ntohl ( entity_table[i].mode );
+            meta_entity_size ( &entity_table[i], ntoh64 ( entity_table[i].size ) );
+        }
+
+        return 0;
+    }
+
+    if ( !( entity_v1 =
+            ( struct entity_v1_t * ) malloc ( ( nentity ? nentity : 1 ) *
+                sizeof ( struct entity_v1_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    /* Read v1 entity table */
+    if ( istream->read ( istream, entity_v1, nentity * sizeof ( struct entity_v1_t ) ) < 0 )
+    {
+        free ( entity_v1 );
+        return -1;
+    }
+
+    /* Convert entities to host byte order */
+    for ( i = 0; i < nentity; i++ )
+    {
+        entity_table[i].parent = ntohl ( entity_v1[i].parent );
+        entity_table[i].mode = ntohl ( entity_v1[i].mode );
+        meta_entity_size ( &entity_table[i], ntohl ( entity_v1[i].size ) );
+    }
+
+    free ( entity_v1 );
+
+    return 0;
+}
+
+/**
+ * Metadata column being decoded
+ */
+struct column_reader_t
+{
+    struct ar_istream *istream;
+    uint64_t left;
+    size_t pos;
+    size_t len;
+    unsigned char buf[META_COLUMN_BUFSIZE];
+};
+
+/**
+ * Refill metadata column buffer from archive stream
+ */
+static int column_fill ( struct column_reader_t *column )
+{
+    size_t part;
+
+    memmove ( column->buf, column->buf + column->pos, column->len - column->pos );
+    column->len -= column->pos;
+    column->pos = 0;
+
+    part = sizeof ( column->buf ) - column->len;
+
+    if ( part > column->left )
+    {
+        part = column->left;
+    }
+
+    if ( part && column->istream->read ( column->istream, column->buf + column->len, part ) < 0 )
+    {
+        return -1;
+    }
+
+    column->len += part;
+    column->left -= part;
+
+    return 0;
+}
+
+/**
+ * Decode variable length integer from metadata column
+ */
+static int column_varint ( struct column_reader_t *column, uint64_t * value )
+{
+    unsigned int shift;
+    unsigned char byte;
+
+    /* Keep whole longest integer buffered */
+    if ( column->len - column->pos < 10 && column->left && column_fill ( column ) < 0 )
+    {
+        return -1;
+    }
+
+    for ( *value = 0, shift = 0; column->pos < column->len && shift < 64; shift += 7 )
+    {
+        byte = column->buf[column->pos++];
+        *value |= ( uint64_t ) ( byte & 0x7f ) << shift;
+
+        if ( ~byte & 0x80 )
+        {
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Read raw bytes from metadata column
+ */
+static int column_bytes ( struct column_reader_t *column, char *data, size_t len )
+{
+    size_t part;
+
+    for ( ; len; len -= part, data += part )
+    {
+        if ( column->pos == column->len )
+        {
+            if ( !column->left )
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            if ( column_fill ( column ) < 0 )
+            {
+                return -1;
+            }
+        }
+
+        part = column->len - column->pos;
+
+        if ( part > len )
+        {
+            part = len;
+        }
+
+        memcpy ( data, column->buf + column->pos, part );
+        column->pos += part;
+    }
+
+    return 0;
+}
+
+/**
+ * Decode front coded name into name table
+ */
+static int column_name ( struct column_reader_t *column, struct archive_meta_t *meta,
+    uint64_t prefix, uint64_t nameslen, uint64_t * offset, uint64_t * prev_offset )
+{
+    uint64_t len;
+    char *name = meta->name_table + *offset;
+    const char *prev_name = meta->name_table + *prev_offset;
+
+    if ( column_varint ( column, &len ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Shared prefix and name with zero byte must fit */
+    if ( prefix > strlen ( prev_name ) || len >= nameslen - *offset
+        || prefix >= nameslen - *offset - len )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy ( name, prev_name, prefix );
+
+    if ( column_bytes ( column, name + prefix, len ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( memchr ( name + prefix, '\0', len ) )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    name[prefix + len] = '\0';
+    *prev_offset = *offset;
+    *offset += prefix + len + 1;
+
+    return 0;
+}
+
+/**
+ * Decode one metadata column into entity and name tables
+ */
+static int column_decode ( struct column_reader_t *column, uint32_t type,
+    struct archive_meta_t *meta, uint64_t nameslen )
+{
+    uint32_t i;
+    uint32_t prev = 0;
+    uint64_t value;
+    uint64_t prev_value[2] = { 0, 0 };
+    uint64_t offset = 0;
+    uint64_t prev_offset = 0;
+    struct entity_t *entity;
+
+    /* First name has no predecessor */
+    meta->name_table[0] = '\0';
+
+    for ( i = 0; i < meta->header.nentity; i++ )
+    {
+        entity = &meta->entity_table[i];
+
+        if ( column_varint ( column, &value ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( type == COLUMN_PARENT )
+        {
+            prev += ( uint32_t ) ( value >> 1 ) ^ -( uint32_t ) ( value & 1 );
+            entity->parent = prev;
+
+        } else if ( type == COLUMN_MODE )
+        {
+            prev ^= value;
+            entity->mode = prev;
+
+        } else if ( type == COLUMN_SIZE )
+        {
+            /* Files and directories are delta coded separately */
+            value = prev_value[!!( entity->mode & S_IFDIR )] += ( value >> 1 ) ^ -( value & 1 );
+            meta_entity_size ( entity, value );
+
+        } else if ( column_name ( column, meta, value, nameslen, &offset, &prev_offset ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    /* Column must be consumed whole, names must fill name table */
+    if ( column->left || column->pos != column->len
+        || ( type == COLUMN_NAME && offset != nameslen ) )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Load file and directory information and names stored as compact columns
+ */
+static int meta_load_columns ( struct ar_istream *istream, struct archive_meta_t *meta,
+    uint64_t nameslen )
+{
+    uint32_t type;
+    uint64_t sizes[COLUMN_COUNT];
+    struct column_reader_t *column;
+
+    if ( istream->read ( istream, sizes, sizeof ( sizes ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Allocate entity and name tables */
+    if ( !( meta->entity_table =
+            ( struct entity_t * ) malloc ( ( meta->header.nentity ? meta->header.nentity : 1 ) *
+                sizeof ( struct entity_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    if ( !( meta->name_table = ( char * ) malloc ( nameslen ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    if ( !( column = ( struct column_reader_t * ) malloc ( sizeof ( struct column_reader_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    /* Sizes are decoded after modes, they hold directory identifiers too */
+    for ( type = 0; type < COLUMN_COUNT; type++ )
+    {
+        column->istream = istream;
+        column->left = ntoh64 ( sizes[type] );
+        column->pos = 0;
+        column->len = 0;
+
+        if ( column_decode ( column, type, meta, nameslen ) < 0 )
+        {
+            free ( column );
+            return -1;
+        }
+    }
+
+    free ( column );
+
+    return 0;
+}
+
+/**
+ * Load archive metadata tables
+ */
+int meta_load ( struct ar_istream *istream, const struct header_t *header,
+    struct archive_meta_t *meta )
+{
+    uint64_t nameslen = meta_nameslen ( header );
+
+    /* Prepare metadata */
+    memset ( meta, '\0', sizeof ( struct archive_meta_t ) );
+    memcpy ( &meta->header, header, sizeof ( struct header_t ) );
+
+    /* At least one name required */
+    if ( !nameslen || nameslen > SIZE_MAX )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( header->flags & HEADER_FLAG_COMPACT )
+    {
+        /* Decode file and directory information and names */
+        if ( meta_load_columns ( istream, meta, nameslen ) < 0 )
+        {
+            meta_free ( meta );
+            return -1;
+        }
+
+    } else
+    {
+        /* Read file and directory information */
+        if ( meta_load_entities ( istream, meta ) < 0 )
+        {
+            meta_free ( meta );
+            return -1;
+        }
+
+        /* Allocate name table */
+        if ( !( meta->name_table = ( char * ) malloc ( nameslen ) ) )
+        {
+            perror ( "malloc" );
+            meta_free ( meta );
+            return -1;
+        }
+
+        /* Read name table */
+        if ( istream->read ( istream, meta->name_table, nameslen ) < 0 )
+        {
+            meta_free ( meta );
+            return -1;
+        }
+    }
+
+    /* Name table must ends with zero byte */
+    if ( meta->name_table[nameslen - 1] != '\0' )
+    {
+        errno = EINVAL;
+        meta_free ( meta );
+        return -1;
+    }
+
+    /* Read data locations if stored */
+    if ( header->flags & HEADER_FLAG_SEGMENTED && meta_load_segments ( istream, meta ) < 0 )
+    {
+        meta_free ( meta );
+        return -1;
+    }
+
+    /* Read extended metadata if stored */
+    if ( header->flags & HEADER_FLAG_EXTENDED && meta_load_extended ( istream, meta ) < 0 )
+    {
+        meta_free ( meta );
+        return -1;
+    }
+
+    /* Read files data checksums if stored */
+    if ( header->flags & HEADER_FLAG_CHECKSUMS && meta_load_checksums ( istream, meta ) < 0 )
+    {
+        meta_free ( meta );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse archive metadata tables into files tree
+ */
+int meta_parse ( struct archive_meta_t *meta )
+{
+    int status = 0;
+    uint32_t i;
+    uint32_t nentity = meta->header.nentity;
+    const char *name = meta->name_table;
+    const char *name_limit = meta->name_table + meta_nameslen ( &meta->header );
+    struct node_t *node;
+    struct node_t *parent;
+    struct node_t **dirs;
+    struct node_t **tails;
+    struct node_t *root_tail = NULL;
+
+    /* Allocate node table */
+    if ( !( meta->node_table =
+            ( struct node_t ** ) calloc ( nentity ? nentity : 1, sizeof ( struct node_t * ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    /* Directories are looked up by their identifiers */
+    if ( !( dirs = ( struct node_t ** ) calloc ( nentity + 1, sizeof ( struct node_t * ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    if ( !( tails = ( struct node_t ** ) calloc ( nentity + 1, sizeof ( struct node_t * ) ) ) )
+    {
+        perror ( "calloc" );
+        free ( dirs );
+        return -1;
+    }
+
+    for ( i = 0; i < nentity; i++ )
+    {
+        if ( name >= name_limit )
+        {
+            status = -1;
+            break;
+        }
+
+        if ( !( node = ( struct node_t * ) malloc ( sizeof ( struct node_t ) ) ) )
+        {
+            perror ( "malloc" );
+            status = -1;
+            break;
+        }
+
+        node->name = ( char * ) name;
+        node->next = NULL;
+        node->sub = NULL;
+        node->link = NULL;
+        node->index = i;
+        node->crc32 = meta->crc_table ? meta->crc_table[i] : 0;
+        name += strlen ( name ) + 1;
+        memcpy ( &node->entity, &meta->entity_table[i], sizeof ( struct entity_t ) );
+
+        if ( meta->location_table )
+        {
+            memcpy ( &node->location, &meta->location_table[i], sizeof ( struct location_t ) );
+
+        } else
+        {
+            node->location.segment = SEGMENT_NONE;
+            node->location.offset = 0;
+            node->location.size = 0;
+        }
+
+        if ( meta->ext_table )
+        {
+            memcpy ( &node->ext, &meta->ext_table[i], sizeof ( struct entity_ext_t ) );
+
+        } else
+        {
+            memset ( &node->ext, '\0', sizeof ( struct entity_ext_t ) );
+            node->ext.base = ENTITY_INDEX_NONE;
+        }
+
+        /* Parent directory must be defined earlier */
+        if ( node->entity.parent > nentity
+            || ( node->entity.parent && !dirs[node->entity.parent] ) )
+        {
+            free ( node );
+            status = -1;
+            break;
+        }
+
+        parent = node->entity.parent ? dirs[node->entity.parent] : NULL;
+        node->parent = parent;
+
+        if ( parent )
+        {
+            if ( tails[node->entity.parent] )
+            {
+                tails[node->entity.parent]->next = node;
+
+            } else
+            {
+                parent->sub = node;
+            }
+
+            tails[node->entity.parent] = node;
+
+        } else
+        {
+            if ( root_tail )
+            {
+                root_tail->next = node;
+
+            } else
+            {
+                meta->root = node;
+            }
+
+            root_tail = node;
+        }
+
+        meta->node_table[i] = node;
+
+        /* Register directory identifier */
+        if ( node->entity.mode & S_IFDIR )
+        {
+            if ( !node->entity.id || node->entity.id > nentity || dirs[node->entity.id] )
+            {
+                status = -1;
+                break;
+            }
+
+            dirs[node->entity.id] = node;
+        }
+    }
+
+    free ( dirs );
+    free ( tails );
+
+    /* Resolve hard link targets */
+    for ( i = 0; !status && i < nentity; i++ )
+    {
+        node = meta->node_table[i];
+
+        if ( ~node->entity.mode & ENTITY_LINK )
+        {
+            continue;
+        }
+
+        if ( node->entity.size >= nentity
+            || meta->node_table[node->entity.size]->entity.mode & ( S_IFDIR | ENTITY_LINK ) )
+        {
+            status = -1;
+            break;
+        }
+
+        node->link = meta->node_table[node->entity.size];
+    }
+
+    if ( status < 0 )
+    {
+        fprintf ( stderr, "archive metadata: bad\n" );
+        errno = EINVAL;
+    }
+
+    return status;
+}
+
+/**
+ * Free archive metadata
+ */
+void meta_free ( struct archive_meta_t *meta )
+{
+    free ( meta->entity_table );
+    free ( meta->name_table );
+    free ( meta->segment_table );
+    free ( meta->location_table );
+    free ( meta->ext_table );
+    free ( meta->crc_table );
+    free ( meta->base_name );
+    free ( meta->node_table );
+    free_files_tree ( meta->root, 0 );
+
+    meta->entity_table = NULL;
+    meta->name_table = NULL;
+    meta->segment_table = NULL;
+    meta->location_table = NULL;
+    meta->ext_table = NULL;
+    meta->crc_table = NULL;
+    meta->base_name = NULL;
+    meta->node_table = NULL;
+    meta->root = NULL;
+}
@@ -7,22 +7,85 @@
 #ifndef EXTRACT_ONLY
 
 /**
- * Calculate entities count
+ * Base archive matching context
  */
-static uint32_t calc_entities ( const struct node_t *node )
+struct base_match_t
 {
-    if ( !node )
+    struct node_t **slots;
+    size_t size;
+    uint32_t options;
+    const struct archive_meta_t *meta;
+    uint32_t *segment_files;
+};
+
+/**
+ * Metadata column being encoded
+ */
+struct column_t
+{
+    struct ar_ostream *ostream;
+    uint64_t size;
+    size_t len;
+    unsigned char buf[META_COLUMN_BUFSIZE];
+};
+
+/**
+ * Data order grouping entry
+ */
+struct group_entry_t
+{
+    struct node_t *node;
+    const char *basename;
+    const char *ext;
+    size_t ext_len;
+    uint8_t signature[4];
+};
+
+static uint64_t pack_map_min = MAP_MIN_SIZE;
+static uint32_t pack_ahead_files = READAHEAD_FILES;
+static uint64_t pack_ahead_bytes = READAHEAD_BYTES;
+
+/**
+ * Set size from which source files are mapped instead of read
+ */
+void pack_set_map_min ( uint64_t size )
+{
+    pack_map_min = size;
+}
+
+/**
+ * Set how many upcoming files and bytes are hinted for readahead
+ */
+void pack_set_readahead ( uint32_t files, uint64_t bytes )
+{
+    pack_ahead_files = files;
+    pack_ahead_bytes = bytes;
+}
+
+/**
+ * Find base name of file or directory
+ */
+static const char *node_basename ( const char *name )
+{
+    size_t i;
+    size_t len;
+    const char *basename = name;
+
+    for ( i = 0, len = strlen ( name ); i < len; i++ )
     {
-        return 0;
+        if ( name[i] == '/' )
+        {
+            basename = name + i + 1;
+        }
     }
 
-    return calc_entities ( node->sub ) + calc_entities ( node->next ) + 1;
+    return basename;
 }
 
 /**
  * Calculate names length
  */
-static uint32_t calc_nameslen ( const struct node_t *node )
+static uint64_t calc_nameslen ( const struct node_t *node )
 {
     size_t i;
     size_t len;
@@ -47,349 +110,2736 @@ static uint32_t calc_nameslen ( const struct node_t *node )
 }
 
 /**
- * Store single entity data
+ * Calculate count of files to be stored
  */
-static int store_entity ( struct ar_ostream *ostream, const struct entity_t *entity )
+static uint32_t calc_files ( const struct node_t *node, uint32_t first )
 {
-    struct entity_t entity_net;
-
-    entity_net.parent = htonl ( entity->parent );
-    entity_net.mode = htonl ( entity->mode );
-    entity_net.size = htonl ( entity->size );
-
-    if ( ostream->write ( ostream, &entity_net, sizeof ( entity_net ) ) < 0 )
+    if ( !node )
     {
-        return -1;
+        return 0;
     }
 
-    return 0;
+    return calc_files ( node->sub, first ) + calc_files ( node->next, first ) +
+        ( node->index >= first
+        && !( node->entity.mode & ( S_IFDIR | ENTITY_LINK | ENTITY_BASE ) ) );
 }
 
 /**
- * Store file and directory information
+ * Find next free directory identifier
  */
-static int store_entity_table ( struct ar_ostream *ostream, const struct node_t *node )
+static uint32_t calc_next_id ( const struct node_t *node )
 {
-    if ( !node )
-    {
-        return 0;
-    }
-
-    if ( store_entity ( ostream, &node->entity ) < 0 )
-    {
-        return -1;
-    }
+    uint32_t id;
+    uint32_t next_id = 1;
 
-    if ( store_entity_table ( ostream, node->sub ) < 0 )
+    for ( ; node; node = node->next )
     {
-        return -1;
+        if ( node->index != ENTITY_INDEX_NONE && node->entity.mode & S_IFDIR )
+        {
+            if ( node->entity.id >= next_id )
+            {
+                next_id = node->entity.id + 1;
+            }
+
+            if ( ( id = calc_next_id ( node->sub ) ) > next_id )
+            {
+                next_id = id;
+            }
+        }
     }
 
-    return store_entity_table ( ostream, node->next );
+    return next_id;
 }
 
 /**
- * Store single file or directory names
+ * Assign entity indexes and parent links in storage order, entities
+ * already stored in an archive keep their indexes
  */
-static int store_name ( struct ar_ostream *ostream, const char *name )
+static void index_entities ( struct node_t *node, struct node_t *parent, uint32_t * index,
+    uint32_t * next_id )
 {
-    size_t i;
-    size_t len;
-    const char *basename = name;
+    if ( !node )
+    {
+        return;
+    }
 
-    for ( i = 0, len = strlen ( name ); i < len; i++ )
+    node->parent = parent;
+
+    if ( node->index == ENTITY_INDEX_NONE )
     {
-        if ( name[i] == '/' )
+        node->index = ( *index )++;
+        node->entity.parent = parent ? parent->entity.id : 0;
+
+        if ( node->entity.mode & S_IFDIR )
         {
-            basename = name + i + 1;
+            node->entity.id = ( *next_id )++;
         }
     }
 
-    len = name + len - basename + 1;
+    index_entities ( node->sub, node, index, next_id );
+    index_entities ( node->next, parent, index, next_id );
+}
 
-    if ( ostream->write ( ostream, basename, len ) < 0 )
+/**
+ * Build entity table indexed by entity indexes
+ */
+static void table_entities ( struct node_t *node, struct node_t **node_table )
+{
+    if ( !node )
     {
-        return -1;
+        return;
     }
 
-    return 0;
+    node_table[node->index] = node;
+
+    table_entities ( node->sub, node_table );
+    table_entities ( node->next, node_table );
 }
 
 /**
- * Store file and directory names
+ * Point hard link entities at their target entity indexes
  */
-static int store_name_table ( struct ar_ostream *ostream, const struct node_t *node )
+static void resolve_links ( struct node_t *node )
 {
     if ( !node )
     {
-        return 0;
+        return;
     }
 
-    if ( store_name ( ostream, node->name ) < 0 )
+    if ( node->link )
     {
-        return -1;
+        node->entity.size = node->link->index;
     }
 
-    if ( store_name_table ( ostream, node->sub ) < 0 )
+    resolve_links ( node->sub );
+    resolve_links ( node->next );
+}
+
+/**
+ * Find file name extension, numeric version suffixes are skipped
+ */
+static void group_find_ext ( const char *name, const char **ext, size_t *ext_len )
+{
+    size_t i;
+    const char *end;
+    const char *dot;
+
+    *ext = "";
+    *ext_len = 0;
+
+    for ( end = name + strlen ( name ); end > name; end = dot )
     {
-        return -1;
-    }
+        for ( dot = end - 1; dot > name && *dot != '.'; dot-- );
+
+        if ( dot <= name )
+        {
+            return;
+        }
 
-    return store_name_table ( ostream, node->next );
+        *ext = dot + 1;
+        *ext_len = end - dot - 1;
+
+        for ( i = 0; i < *ext_len && ( *ext )[i] >= '0' && ( *ext )[i] <= '9'; i++ );
+
+        if ( i < *ext_len || !*ext_len )
+        {
+            return;
+        }
+    }
 }
 
 /**
- * Pack single file to an archive
+ * Read file type signature from the first content bytes
  */
-static int pack_file ( struct pack_context_t *context )
+static void group_read_signature ( const struct node_t *node, uint8_t * signature, size_t len )
 {
     int fd;
-    ssize_t len;
+    char path[PATH_LIMIT];
 
-    /* Open input file for reading */
-    if ( ( fd = open ( context->path, O_RDONLY | O_BINARY ) ) < 0 )
+    memset ( signature, '\0', len );
+
+    if ( node_path ( node, path, sizeof ( path ) ) < 0 )
     {
-        perror ( context->path );
-        return -1;
+        return;
     }
 
-    /* Store file content into archive */
-    while ( ( len = read ( fd, context->workbuf, context->workbuf_size ) ) > 0 )
+    if ( ( fd = open ( path, O_RDONLY | O_BINARY ) ) < 0 )
     {
-        if ( context->ostream->write ( context->ostream, context->workbuf, len ) < 0 )
-        {
-            perror ( "write" );
-            close ( fd );
-            return -1;
-        }
+        return;
+    }
+
+    if ( read ( fd, signature, len ) < 0 )
+    {
+        memset ( signature, '\0', len );
     }
 
-    /* Close file fd */
     close ( fd );
+}
 
-    /* Check if an error occurred */
-    if ( len < 0 )
+/**
+ * Collect files into data order grouping table
+ */
+static void group_collect ( struct node_t *node, struct group_entry_t **entry, uint32_t first,
+    int similar )
+{
+    if ( !node )
     {
-        perror ( context->path );
-        return -1;
+        return;
     }
 
-    /* Show file add success message */
-    if ( context->options & OPTION_VERBOSE )
+    if ( node->index >= first
+        && !( node->entity.mode & ( S_IFDIR | ENTITY_LINK | ENTITY_BASE ) ) )
     {
-        show_progress ( 'a', context->path );
+        ( *entry )->node = node;
+        ( *entry )->basename = node_basename ( node->name );
+
+        group_find_ext ( ( *entry )->basename, &( *entry )->ext, &( *entry )->ext_len );
+
+        if ( !similar || ( *entry )->ext_len )
+        {
+            memset ( ( *entry )->signature, '\0', sizeof ( ( *entry )->signature ) );
+
+        } else
+        {
+            group_read_signature ( node, ( *entry )->signature, sizeof ( ( *entry )->signature ) );
+        }
+
+        ( *entry )++;
     }
 
-    return 0;
+    group_collect ( node->sub, entry, first, similar );
+    group_collect ( node->next, entry, first, similar );
 }
 
 /**
- * Pack multiple files to an archive (internal)
+ * Compare data order grouping entries
  */
-static int pack_files_in ( struct pack_context_t *context, struct node_t *node )
+static int group_compare ( const void *a, const void *b )
 {
-    size_t path_len;
+    int ca;
+    int cb;
+    size_t i;
+    int ret;
+    const struct group_entry_t *ea = ( const struct group_entry_t * ) a;
+    const struct group_entry_t *eb = ( const struct group_entry_t * ) b;
 
-    if ( !node )
+    /* Group by extension first, case insensitive */
+    for ( i = 0; i < ea->ext_len && i < eb->ext_len; i++ )
     {
-        return 0;
-    }
+        ca = ea->ext[i] >= 'A' && ea->ext[i] <= 'Z' ? ea->ext[i] + 'a' - 'A' : ea->ext[i];
+        cb = eb->ext[i] >= 'A' && eb->ext[i] <= 'Z' ? eb->ext[i] + 'a' - 'A' : eb->ext[i];
 
-    path_len = strlen ( context->path );
+        if ( ca != cb )
+        {
+            return ca - cb;
+        }
+    }
 
-    if ( path_concat ( context->path, sizeof ( context->path ), node->name ) < 0 )
+    if ( ea->ext_len != eb->ext_len )
     {
-        return -1;
+        return ea->ext_len < eb->ext_len ? -1 : 1;
     }
 
-    if ( ~node->entity.mode & S_IFDIR )
+    /* Then by content type signature */
+    if ( ( ret = memcmp ( ea->signature, eb->signature, sizeof ( ea->signature ) ) ) )
     {
-        if ( pack_file ( context ) < 0 )
-        {
-            return -1;
-        }
+        return ret;
     }
 
-    if ( pack_files_in ( context, node->sub ) < 0 )
+    /* Then by similar names */
+    if ( ( ret = strcmp ( ea->basename, eb->basename ) ) )
     {
-        return -1;
+        return ret;
     }
 
-    context->path[path_len] = '\0';
+    if ( ea->node->entity.size != eb->node->entity.size )
+    {
+        return ea->node->entity.size < eb->node->entity.size ? -1 : 1;
+    }
 
-    return pack_files_in ( context, node->next );
+    return ea->node->index < eb->node->index ? -1 : ea->node->index > eb->node->index;
 }
 
 /**
- * Pack multiple files to an archive
+ * Compare data order entries by entity index
  */
-static int pack_files ( uint32_t options, struct ar_ostream *ostream, struct node_t *head )
+static int group_compare_index ( const void *a, const void *b )
 {
-    int retval;
-    struct pack_context_t context;
+    const struct group_entry_t *ea = ( const struct group_entry_t * ) a;
+    const struct group_entry_t *eb = ( const struct group_entry_t * ) b;
 
-    /* Prepare path buffer */
-    context.options = options;
-    context.ostream = ostream;
-    context.path[0] = '\0';
+    return ea->node->index < eb->node->index ? -1 : ea->node->index > eb->node->index;
+}
 
-    /* Allocate work buffer */
-    if ( !( context.workbuf = ( unsigned char * ) malloc ( WORKBUF_LIMIT ) ) )
+/**
+ * Build files data order table, similar files are grouped if needed
+ */
+static struct group_entry_t *group_files ( struct node_t *root, uint32_t first, uint32_t count,
+    int similar )
+{
+    struct group_entry_t *table;
+    struct group_entry_t *entry;
+
+    if ( !( table =
+            ( struct group_entry_t * ) malloc ( ( count ? count : 1 ) *
+                sizeof ( struct group_entry_t ) ) ) )
     {
         perror ( "malloc" );
-        return -1;
+        return NULL;
     }
 
-    context.workbuf_size = WORKBUF_LIMIT;
-
-    /* Pack the files */
-    retval = pack_files_in ( &context, head );
+    entry = table;
+    group_collect ( root, &entry, first, similar );
 
-    /* Free work buffer */
-    free ( context.workbuf );
+    qsort ( table, count, sizeof ( struct group_entry_t ),
+        similar ? group_compare : group_compare_index );
 
-    return retval;
+    return table;
 }
 
-/** 
- * Pack files to an archive stream
+/**
+ * Encode value as variable length integer
  */
-static int zbox_pack_archive_stream ( uint32_t options, struct ar_ostream *ostream,
-    const char *files[], size_t nfiles )
+static size_t varint_encode ( unsigned char *buf, uint64_t value )
 {
-    struct header_t header;
-    struct node_t *root = NULL;
+    size_t len = 0;
 
-    /* Prepare archive header */
-    memset ( &header, '\0', sizeof ( header ) );
+    for ( ; value >= 0x80; value >>= 7 )
+    {
+        buf[len++] = ( value & 0x7f ) | 0x80;
+    }
 
-    /* Set achive header identifier */
-    header.magic[0] = 'z';
-    header.magic[1] = 'b';
-    header.magic[2] = 'o';
-    header.magic[3] = 'x';
+    buf[len++] = value;
 
-    /* Checksum must be set to zero before calculation */
-    header.crc32 = 0;
+    return len;
+}
 
-    /* Set achive compression type */
-    if ( options & OPTION_ZLIB )
-    {
-        header.comp = COMP_ZLIB;
+/**
+ * Append bytes to metadata column, only count them if no stream given
+ */
+static int column_write ( struct column_t *column, const void *data, size_t len )
+{
+    size_t part;
 
-    } else
+    column->size += len;
+
+    if ( !column->ostream )
     {
-        header.comp = COMP_NONE;
+        return 0;
     }
 
-    /* Build files tree */
-    if ( scan_files_tree ( files, nfiles, &root ) < 0 )
+    for ( ; len; len -= part, data = ( const unsigned char * ) data + part )
     {
-        return -1;
+        if ( column->len == sizeof ( column->buf ) )
+        {
+            if ( column->ostream->write ( column->ostream, column->buf, column->len ) < 0 )
+            {
+                return -1;
+            }
+
+            column->len = 0;
+        }
+
+        part = sizeof ( column->buf ) - column->len;
+
+        if ( part > len )
+        {
+            part = len;
+        }
+
+        memcpy ( column->buf + column->len, data, part );
+        column->len += part;
     }
 
-    /* Root must be specified */
-    if ( !root )
+    return 0;
+}
+
+/**
+ * Append variable length integer to metadata column
+ */
+static int column_varint ( struct column_t *column, uint64_t value )
+{
+    unsigned char buf[10];
+
+    return column_write ( column, buf, varint_encode ( buf, value ) );
+}
+
+/**
+ * Encode one metadata column, parents as zigzag deltas, modes as xor with
+ * previous one, sizes and directory identifiers as zigzag deltas to previous
+ * file size or directory identifier and names with prefix shared with
+ * previous name
+ */
+static int column_encode ( struct column_t *column, uint32_t type, struct node_t **node_table,
+    uint32_t nentity )
+{
+    uint32_t i;
+    int dir;
+    int64_t delta;
+    uint64_t value;
+    uint64_t prev_value[2] = { 0, 0 };
+    size_t len;
+    size_t prefix;
+    size_t prev_len = 0;
+    uint32_t prev = 0;
+    const char *name;
+    const char *prev_name = "";
+    const struct entity_t *entity;
+
+    for ( i = 0; i < nentity; i++ )
     {
-        return -1;
-    }
+        entity = &node_table[i]->entity;
+
+        if ( type == COLUMN_PARENT )
+        {
+            delta = ( int64_t ) entity->parent - prev;
+            prev = entity->parent;
+
+            if ( column_varint ( column, ( uint64_t ) delta << 1 ^ ( delta >> 63 ) ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( type == COLUMN_MODE )
+        {
+            if ( column_varint ( column, entity->mode ^ prev ) < 0 )
+            {
+                return -1;
+            }
+
+            prev = entity->mode;
+
+        } else if ( type == COLUMN_SIZE )
+        {
+            dir = !!( entity->mode & S_IFDIR );
+            value = dir ? entity->id : entity->size;
+            delta = ( int64_t ) ( value - prev_value[dir] );
+            prev_value[dir] = value;
 
-    /* Calculate entities count */
-    header.nentity = calc_entities ( root );
+            if ( column_varint ( column, ( uint64_t ) delta << 1 ^ ( delta >> 63 ) ) < 0 )
+            {
+                return -1;
+            }
 
-    /* Calculate names length */
-    header.nameslen = calc_nameslen ( root );
+        } else
+        {
+            name = node_basename ( node_table[i]->name );
+            len = strlen ( name );
+
+            for ( prefix = 0; prefix < len && prefix < prev_len
+                && name[prefix] == prev_name[prefix]; prefix++ );
 
-    /* Seed archive stream checksum */
-    ostream->seed_crc32 ( ostream, &header );
+            if ( column_varint ( column, prefix ) < 0
+                || column_varint ( column, len - prefix ) < 0
+                || column_write ( column, name + prefix, len - prefix ) < 0 )
+            {
+                return -1;
+            }
+
+            prev_name = name;
+            prev_len = len;
+        }
+    }
 
-    /* Store file and directory information */
-    if ( store_entity_table ( ostream, root ) < 0 )
+    /* Flush buffered column data */
+    if ( column->ostream && column->len
+        && column->ostream->write ( column->ostream, column->buf, column->len ) < 0 )
     {
-        free_files_tree ( root, 1 );
         return -1;
     }
 
-    /* Store file and directory names */
-    if ( store_name_table ( ostream, root ) < 0 )
+    return 0;
+}
+
+/**
+ * Store file and directory information and names as compact columns
+ */
+static int store_columns ( struct ar_ostream *ostream, struct node_t **node_table,
+    uint32_t nentity )
+{
+    uint32_t type;
+    uint64_t sizes_net[COLUMN_COUNT];
+    struct column_t *column;
+
+    if ( !( column = ( struct column_t * ) malloc ( sizeof ( struct column_t ) ) ) )
     {
-        free_files_tree ( root, 1 );
+        perror ( "malloc" );
         return -1;
     }
 
-    /* Store multiple files to an archive */
-    if ( pack_files ( options, ostream, root ) < 0 )
+    /* Columns sizes are stored first, measure them */
+    for ( type = 0; type < COLUMN_COUNT; type++ )
     {
-        free_files_tree ( root, 1 );
-        return -1;
+        column->ostream = NULL;
+        column->size = 0;
+        column->len = 0;
+        column_encode ( column, type, node_table, nentity );
+        sizes_net[type] = hton64 ( column->size );
     }
 
-    /* Flush archive stream */
-    if ( ostream->flush ( ostream ) < 0 )
+    if ( ostream->write ( ostream, sizes_net, sizeof ( sizes_net ) ) < 0 )
     {
-        free_files_tree ( root, 1 );
+        free ( column );
         return -1;
     }
 
-    /* Update archive header checksum */
-    header.crc32 = ostream->finalize_crc32 ( ostream );
-
-    /* Update archive header */
-    if ( ostream->set_header ( ostream, &header ) < 0 )
+    for ( type = 0; type < COLUMN_COUNT; type++ )
     {
-        free_files_tree ( root, 1 );
-        return -1;
+        column->ostream = ostream;
+        column->size = 0;
+        column->len = 0;
+
+        if ( column_encode ( column, type, node_table, nentity ) < 0 )
+        {
+            free ( column );
+            return -1;
+        }
     }
 
-    /* Free files tree */
-    free_files_tree ( root, 1 );
+    free ( column );
 
     return 0;
 }
 
-/** 
- * Pack files to an archive
+/**
+ * Store archive data segments information
  */
-int zbox_pack_archive ( const char *archive, uint32_t options, int level, const char *files[],
-    size_t nfiles )
+static int store_segment_table ( struct ar_ostream *ostream, const struct segment_t *segment_table,
+    uint32_t nsegment )
 {
-    int fd;
-    int status;
-    struct ar_ostream *ostream;
+    uint32_t i;
+    uint32_t nsegment_net;
+    struct segment_t segment_net;
 
-    /* Open archive file for writing */
-    if ( ( fd = open ( archive, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0644 ) ) < 0 )
+    nsegment_net = htonl ( nsegment );
+
+    if ( ostream->write ( ostream, &nsegment_net, sizeof ( nsegment_net ) ) < 0 )
     {
-        perror ( archive );
         return -1;
     }
 
-    /* Open archive stream */
-    if ( options & OPTION_ZLIB )
+    for ( i = 0; i < nsegment; i++ )
+    {
+        segment_net.offset = hton64 ( segment_table[i].offset );
+        segment_net.size = hton64 ( segment_table[i].size );
+        segment_net.rawsize = hton64 ( segment_table[i].rawsize );
+        segment_net.crc32 = htonl ( segment_table[i].crc32 );
+
+        if ( ostream->write ( ostream, &segment_net, sizeof ( segment_net ) ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Store files data locations
+ */
+static int store_location_table ( struct ar_ostream *ostream, struct node_t **node_table,
+    uint32_t nentity )
+{
+    uint32_t i;
+    struct location_t location_net;
+
+    for ( i = 0; i < nentity; i++ )
+    {
+        location_net.segment = htonl ( node_table[i]->location.segment );
+        location_net.offset = hton64 ( node_table[i]->location.offset );
+        location_net.size = hton64 ( node_table[i]->location.size );
+
+        if ( ostream->write ( ostream, &location_net, sizeof ( location_net ) ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Store extended metadata, base archive and files state
+ */
+static int store_ext_table ( struct ar_ostream *ostream, const struct archive_meta_t *meta )
+{
+    uint32_t i;
+    uint32_t len;
+    uint32_t base_net[2];
+    struct entity_ext_t ext_net;
+
+    len = meta->base_name ? strlen ( meta->base_name ) : 0;
+    base_net[0] = htonl ( meta->base_crc32 );
+    base_net[1] = htonl ( len );
+
+    if ( ostream->write ( ostream, base_net, sizeof ( base_net ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( len && ostream->write ( ostream, meta->base_name, len ) < 0 )
+    {
+        return -1;
+    }
+
+    for ( i = 0; i < meta->header.nentity; i++ )
+    {
+        ext_net.mtime = hton64 ( meta->node_table[i]->ext.mtime );
+        ext_net.ctime = hton64 ( meta->node_table[i]->ext.ctime );
+        ext_net.inode = hton64 ( meta->node_table[i]->ext.inode );
+        ext_net.base = htonl ( meta->node_table[i]->ext.base );
+
+        if ( ostream->write ( ostream, &ext_net, sizeof ( ext_net ) ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Store files data checksums
+ */
+static int store_crc_table ( struct ar_ostream *ostream, struct node_t **node_table,
+    uint32_t nentity )
+{
+    uint32_t i;
+    uint32_t crc32_net;
+
+    for ( i = 0; i < nentity; i++ )
+    {
+        crc32_net = htonl ( node_table[i]->crc32 );
+
+        if ( ostream->write ( ostream, &crc32_net, sizeof ( crc32_net ) ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Store in-place metadata section entities, children grouped by parent
+ */
+static int store_inplace_entities ( struct column_t *column, struct node_t **node_table,
+    uint32_t nentity, const uint32_t * child_first, const uint32_t * child_count )
+{
+    uint32_t i;
+    uint64_t name = 0;
+    const struct node_t *node;
+    struct inplace_entity_t entity_le;
+
+    for ( i = 0; i < nentity; i++ )
+    {
+        node = node_table[i];
+        entity_le.parent = le32 ( node->parent ? node->parent->index : ENTITY_INDEX_NONE );
+        entity_le.mode = le32 ( node->entity.mode );
+        entity_le.size = le64 ( node->entity.mode & S_IFDIR ? 0 : node->entity.size );
+        entity_le.name = le64 ( name );
+        entity_le.first = le32 ( child_first[i] );
+        entity_le.count = le32 ( child_count[i] );
+        entity_le.segment = le32 ( node->location.segment );
+        entity_le.crc32 = le32 ( node->crc32 );
+        entity_le.offset = le64 ( node->location.offset );
+        entity_le.length = le64 ( node->location.size );
+        name += strlen ( node_basename ( node->name ) ) + 1;
+
+        if ( column_write ( column, &entity_le, sizeof ( entity_le ) ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Store in-place metadata section children and names tables
+ */
+static int store_inplace_tables ( struct column_t *column, struct node_t **node_table,
+    uint32_t nentity, uint32_t * child_first )
+{
+    uint32_t i;
+    uint32_t parent;
+    uint32_t *child_table;
+    const char *name;
+
+    if ( !( child_table = ( uint32_t * ) malloc ( ( nentity ? nentity : 1 ) *
+                sizeof ( uint32_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    /* Root children come first, then each directory children in turn */
+    for ( i = 0; i < nentity; i++ )
+    {
+        parent = node_table[i]->parent ? node_table[i]->parent->index : nentity;
+        child_table[child_first[parent]++] = le32 ( i );
+    }
+
+    if ( column_write ( column, child_table, nentity * sizeof ( uint32_t ) ) < 0 )
+    {
+        free ( child_table );
+        return -1;
+    }
+
+    free ( child_table );
+
+    for ( i = 0; i < nentity; i++ )
+    {
+        name = node_basename ( node_table[i]->name );
+
+        if ( column_write ( column, name, strlen ( name ) + 1 ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Insert entity paths into in-place metadata section path index
+ */
+static int store_inplace_paths ( const struct node_t *node, char *path, size_t path_size,
+    struct inplace_slot_t *slot_table, uint32_t nslot )
+{
+    size_t slot;
+    size_t path_len;
+    uint64_t hash;
+
+    for ( ; node; node = node->next )
+    {
+        path_len = strlen ( path );
+
+        if ( path_concat ( path, path_size, node_basename ( node->name ) ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Only current version of a file is found by path */
+        if ( ~node->entity.mode & ENTITY_SHADOWED )
+        {
+            hash = xxh64 ( 0, ( const uint8_t * ) path, strlen ( path ) );
+
+            for ( slot = hash & ( nslot - 1 ); slot_table[slot].entity;
+                slot = ( slot + 1 ) & ( nslot - 1 ) );
+
+            slot_table[slot].hash = le32 ( hash >> 32 );
+            slot_table[slot].entity = le32 ( node->index + 1 );
+        }
+
+        if ( store_inplace_paths ( node->sub, path, path_size, slot_table, nslot ) < 0 )
+        {
+            return -1;
+        }
+
+        path[path_len] = '\0';
+    }
+
+    return 0;
+}
+
+/**
+ * Store in-place metadata section path index, slots refer to entity index plus one
+ */
+static int store_inplace_index ( struct column_t *column, const struct node_t *root,
+    uint32_t nslot )
+{
+    char path[PATH_LIMIT];
+    struct inplace_slot_t *slot_table;
+
+    if ( !( slot_table =
+            ( struct inplace_slot_t * ) calloc ( nslot, sizeof ( struct inplace_slot_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    path[0] = '\0';
+
+    if ( store_inplace_paths ( root, path, sizeof ( path ), slot_table, nslot ) < 0
+        || column_write ( column, slot_table, nslot * sizeof ( struct inplace_slot_t ) ) < 0 )
+    {
+        free ( slot_table );
+        return -1;
+    }
+
+    free ( slot_table );
+
+    return 0;
+}
+
+/**
+ * Store aligned little-endian metadata section for in-place use
+ */
+static int store_inplace ( struct ar_ostream *ostream, struct header_t *header,
+    const struct node_t *root, struct node_t **node_table, uint64_t nameslen )
+{
+    int status = 0;
+    off_t offset;
+    uint32_t i;
+    uint32_t next;
+    uint32_t nslot;
+    uint32_t nentity = header->nentity;
+    uint32_t *child_first;
+    uint32_t *child_count;
+    struct column_t *column;
+    struct inplace_header_t inplace_le;
+    static const uint8_t padding[8] = { 0 };
+
+    if ( ( offset = lseek ( ostream->context->fd, 0, SEEK_CUR ) ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    /* Section is not compressed, tables are used in place */
+    if ( !( column = ( struct column_t * ) malloc ( sizeof ( struct column_t ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    column->ostream = plain_ostream_open ( ostream->context->fd );
+    column->size = 0;
+    column->len = 0;
+
+    if ( !column->ostream )
+    {
+        free ( column );
+        return -1;
+    }
+
+    column->ostream->context->checksum = header->checksum;
+
+    /* Section checksum starts after alignment padding */
+    if ( column->ostream->write ( column->ostream, padding, -offset & 7 ) < 0 )
+    {
+        column->ostream->close ( column->ostream );
+        free ( column );
+        return -1;
+    }
+
+    column->ostream->reset ( column->ostream );
+    header->inplace_offset = offset + ( -offset & 7 );
+
+    /* Count children, last slot belongs to root */
+    if ( !( child_first = ( uint32_t * ) calloc ( nentity + 1, sizeof ( uint32_t ) ) )
+        || !( child_count = ( uint32_t * ) calloc ( nentity + 1, sizeof ( uint32_t ) ) ) )
+    {
+        perror ( "calloc" );
+        free ( child_first );
+        column->ostream->close ( column->ostream );
+        free ( column );
+        return -1;
+    }
+
+    for ( i = 0; i < nentity; i++ )
+    {
+        child_count[node_table[i]->parent ? node_table[i]->parent->index : nentity]++;
+    }
+
+    for ( next = child_count[nentity], i = 0; i < nentity; i++ )
+    {
+        child_first[i] = next;
+        next += child_count[i];
+    }
+
+    /* Path index is kept below three quarters full, huge archives go without it */
+    for ( nslot = 16; nslot < INPLACE_INDEX_MAX && nslot - nslot / 4 <= nentity; nslot <<= 1 );
+
+    if ( nslot - nslot / 4 <= nentity )
+    {
+        nslot = 0;
+    }
+
+    memset ( &inplace_le, '\0', sizeof ( inplace_le ) );
+    memcpy ( inplace_le.magic, "zbdt", sizeof ( inplace_le.magic ) );
+    inplace_le.nentity = le32 ( nentity );
+    inplace_le.entity_offset = sizeof ( struct inplace_header_t );
+    inplace_le.child_offset =
+        inplace_le.entity_offset + ( uint64_t ) nentity * sizeof ( struct inplace_entity_t );
+    inplace_le.name_offset = inplace_le.child_offset + ( uint64_t ) nentity * sizeof ( uint32_t );
+    inplace_le.name_size = le64 ( nameslen );
+    inplace_le.index_offset = ( inplace_le.name_offset + nameslen + 7 ) & ~7ULL;
+    inplace_le.size = le64 ( inplace_le.index_offset + ( uint64_t ) nslot *
+        sizeof ( struct inplace_slot_t ) );
+    inplace_le.entity_offset = le64 ( inplace_le.entity_offset );
+    inplace_le.child_offset = le64 ( inplace_le.child_offset );
+    inplace_le.name_offset = le64 ( inplace_le.name_offset );
+    inplace_le.root_count = le32 ( child_count[nentity] );
+    inplace_le.index_offset = le64 ( inplace_le.index_offset );
+    inplace_le.index_size = le32 ( nslot );
+
+    if ( column_write ( column, &inplace_le, sizeof ( inplace_le ) ) < 0
+        || store_inplace_entities ( column, node_table, nentity, child_first, child_count ) < 0
+        || store_inplace_tables ( column, node_table, nentity, child_first ) < 0
+        || column_write ( column, padding, -column->size & 7 ) < 0
+        || ( nslot && store_inplace_index ( column, root, nslot ) < 0 ) || ( column->len
+            && column->ostream->write ( column->ostream, column->buf, column->len ) < 0 ) )
+    {
+        status = -1;
+    }
+
+    header->inplace_crc32 = column->ostream->finalize_crc32 ( column->ostream );
+
+    free ( child_count );
+    free ( child_first );
+    column->ostream->close ( column->ostream );
+    free ( column );
+
+    return status;
+}
+
+/**
+ * Mark regular files for framed data storage
+ */
+static void mark_framed ( struct node_t *node, uint32_t first )
+{
+    if ( !node )
+    {
+        return;
+    }
+
+    if ( node->index >= first && node->location.segment == SEGMENT_NONE
+        && !( node->entity.mode & ( S_IFDIR | ENTITY_LINK | ENTITY_BASE ) ) )
+    {
+        node->entity.mode |= ENTITY_FRAMED;
+    }
+
+    mark_framed ( node->sub, first );
+    mark_framed ( node->next, first );
+}
+
+/**
+ * Store framed data record header
+ */
+static int store_record ( struct ar_ostream *ostream, uint32_t type, uint32_t len,
+    uint32_t entity, uint64_t offset )
+{
+    struct record_t record;
+
+    record.type = htonl ( type );
+    record.len = htonl ( len );
+    record.entity = htonl ( entity );
+    record.offset = hton64 ( offset );
+
+    if ( ostream->write ( ostream, &record, sizeof ( record ) ) < 0 )
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Check if chunk content matches previously stored chunk
+ */
+static int pack_verify_chunk ( struct pack_context_t *context, int fd, const struct node_t *node,
+    const struct dedup_chunk_t *chunk, const unsigned char *data )
+{
+    int src;
+    char path[PATH_LIMIT];
+    struct dedup_context_t *dedup = context->dedup;
+
+    /* Reuse already opened source file if possible */
+    if ( chunk->node == node )
+    {
+        src = fd;
+
+    } else
+    {
+        if ( dedup->verify_node != chunk->node )
+        {
+            if ( dedup->verify_fd >= 0 )
+            {
+                close ( dedup->verify_fd );
+                dedup->verify_fd = -1;
+                dedup->verify_node = NULL;
+            }
+
+            if ( node_path ( chunk->node, path, sizeof ( path ) ) < 0 )
+            {
+                return 0;
+            }
+
+            if ( ( dedup->verify_fd = open ( path, O_RDONLY | O_BINARY ) ) < 0 )
+            {
+                return 0;
+            }
+
+            dedup->verify_node = chunk->node;
+        }
+
+        src = dedup->verify_fd;
+    }
+
+    /* Compare stored chunk with current data */
+    if ( read_at ( src, context->workbuf, chunk->len, chunk->offset ) != ( ssize_t ) chunk->len )
+    {
+        return 0;
+    }
+
+    return !memcmp ( context->workbuf, data, chunk->len );
+}
+
+/**
+ * Find length of whole zero blocks at the data begin
+ */
+static size_t sparse_zero_span ( const unsigned char *data, size_t len, uint64_t offset,
+    int final )
+{
+    size_t span = 0;
+    size_t block;
+
+    if ( offset % SPARSE_BLOCK )
+    {
+        return 0;
+    }
+
+    while ( span < len )
+    {
+        block = len - span < SPARSE_BLOCK ? len - span : SPARSE_BLOCK;
+
+        /* Partial block counts only at the end of data */
+        if ( block < SPARSE_BLOCK && !final )
+        {
+            break;
+        }
+
+        if ( !is_zero_block ( data + span, block ) )
+        {
+            break;
+        }
+
+        span += block;
+    }
+
+    return span;
+}
+
+/**
+ * Find length of data up to the next whole zero block
+ */
+static size_t sparse_data_span ( const unsigned char *data, size_t len, uint64_t offset,
+    int final )
+{
+    size_t span;
+
+    for ( span = SPARSE_BLOCK - offset % SPARSE_BLOCK; span < len;
+        span += len - span < SPARSE_BLOCK ? len - span : SPARSE_BLOCK )
+    {
+        if ( sparse_zero_span ( data + span, len - span, offset + span, final ) )
+        {
+            return span;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Store file hole as records
+ */
+static int store_hole ( struct ar_ostream *ostream, uint64_t len )
+{
+    uint32_t part;
+
+    for ( ; len; len -= part )
+    {
+        part = len < SPARSE_RECORD_MAX ? len : SPARSE_RECORD_MAX;
+
+        if ( store_record ( ostream, RECORD_HOLE, part, 0, 0 ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Pack file data extent as records, deduplicated and sparse if needed
+ */
+static int pack_extent ( struct pack_context_t *context, int fd, const struct node_t *node,
+    uint64_t offset, uint64_t left )
+{
+    size_t pos = 0;
+    size_t end = 0;
+    size_t span;
+    size_t cut;
+    ssize_t len;
+    uint64_t hash = 0;
+    unsigned char *buf = context->framebuf;
+    struct dedup_chunk_t *chunk;
+    struct dedup_context_t *dedup = context->dedup;
+
+    for ( ;; )
+    {
+        /* Keep at least one maximum chunk buffered */
+        if ( end - pos < DEDUP_CHUNK_MAX && left )
+        {
+            memmove ( buf, buf + pos, end - pos );
+            end -= pos;
+            pos = 0;
+
+            while ( end < DEDUP_BUFFER && left )
+            {
+                if ( ( len =
+                        read ( fd, buf + end,
+                            DEDUP_BUFFER - end < left ? DEDUP_BUFFER - end : left ) ) < 0 )
+                {
+                    perror ( context->path );
+                    return -1;
+                }
+
+                if ( !len )
+                {
+                    errno = ENODATA;
+                    perror ( context->path );
+                    return -1;
+                }
+
+                end += len;
+                left -= len;
+            }
+        }
+
+        if ( pos == end )
+        {
+            break;
+        }
+
+        /* Store zero blocks as holes */
+        if ( context->options & OPTION_SPARSE )
+        {
+            if ( ( span = sparse_zero_span ( buf + pos, end - pos, offset, !left ) ) )
+            {
+                if ( store_hole ( context->ostream, span ) < 0 )
+                {
+                    return -1;
+                }
+
+                pos += span;
+                offset += span;
+                continue;
+            }
+
+            span = sparse_data_span ( buf + pos, end - pos, offset, !left );
+
+        } else
+        {
+            span = end - pos;
+        }
+
+        if ( !dedup )
+        {
+            /* Store data as is */
+            cut = span < DEDUP_CHUNK_MAX ? span : DEDUP_CHUNK_MAX;
+            chunk = NULL;
+
+        } else
+        {
+            /* Find chunk boundary and fingerprint */
+            cut = dedup_cut ( dedup, buf + pos, span );
+            hash = xxh64 ( 0, buf + pos, cut );
+
+            /* Files in own segments refer to their own data only */
+            for ( chunk = dedup_find ( dedup, hash, cut, NULL );
+                chunk && ( ( context->options & OPTION_FILE_SEGMENTS && chunk->node != node )
+                    || !pack_verify_chunk ( context, fd, node, chunk, buf + pos ) );
+                chunk = dedup_find ( dedup, hash, cut, chunk ) );
+        }
+
+        if ( chunk )
+        {
+            /* Refer to already stored chunk, its hash is verified on extract */
+            if ( store_record ( context->ostream, RECORD_REF_HASH, cut,
+                    chunk->node == node ? ENTITY_INDEX_NONE : chunk->node->index,
+                    chunk->offset ) < 0 )
+            {
+                return -1;
+            }
+
+            hash = hton64 ( hash );
+
+            if ( context->ostream->write ( context->ostream, &hash, sizeof ( hash ) ) < 0 )
+            {
+                return -1;
+            }
+
+        } else
+        {
+            /* Store unique chunk data */
+            if ( store_record ( context->ostream, RECORD_DATA, cut, 0, 0 ) < 0 )
+            {
+                return -1;
+            }
+
+            if ( context->ostream->write ( context->ostream, buf + pos, cut ) < 0 )
+            {
+                return -1;
+            }
+
+            if ( dedup && dedup_insert ( dedup, hash, cut, node, offset ) < 0 )
+            {
+                return -1;
+            }
+        }
+
+        pos += cut;
+        offset += cut;
+    }
+
+    return 0;
+}
+
+/**
+ * Find next file data extent begin
+ */
+static uint64_t pack_seek_data ( int fd, uint64_t offset, uint64_t size )
+{
+#ifdef SEEK_DATA
+    off_t ret;
+
+    if ( ( ret = lseek ( fd, offset, SEEK_DATA ) ) >= 0 )
+    {
+        return ( uint64_t ) ret < size ? ( uint64_t ) ret : size;
+    }
+
+    if ( errno == ENXIO )
+    {
+        return size;
+    }
+#else
+    UNUSED ( fd );
+    UNUSED ( size );
+#endif
+    return offset;
+}
+
+/**
+ * Find next file hole begin
+ */
+static uint64_t pack_seek_hole ( int fd, uint64_t offset, uint64_t size )
+{
+#ifdef SEEK_HOLE
+    off_t ret;
+
+    if ( ( ret = lseek ( fd, offset, SEEK_HOLE ) ) >= 0 && ( uint64_t ) ret > offset )
+    {
+        return ( uint64_t ) ret < size ? ( uint64_t ) ret : size;
+    }
+#else
+    UNUSED ( fd );
+    UNUSED ( offset );
+#endif
+    return size;
+}
+
+/**
+ * Pack single file as data records
+ */
+static int pack_file_framed ( struct pack_context_t *context, int fd, const struct node_t *node )
+{
+    uint64_t data;
+    uint64_t hole;
+    uint64_t offset = 0;
+    uint64_t size = node->entity.size;
+
+    while ( offset < size )
+    {
+        data = offset;
+        hole = size;
+
+        /* Skip file holes without reading them */
+        if ( context->options & OPTION_SPARSE )
+        {
+            data = pack_seek_data ( fd, offset, size );
+            hole = pack_seek_hole ( fd, data, size );
+        }
+
+        if ( data > offset && store_hole ( context->ostream, data - offset ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( hole > data )
+        {
+            if ( lseek ( fd, data, SEEK_SET ) < 0 )
+            {
+                perror ( context->path );
+                return -1;
+            }
+
+            if ( pack_extent ( context, fd, node, data, hole - data ) < 0 )
+            {
+                return -1;
+            }
+        }
+
+        offset = hole;
+    }
+
+    return 0;
+}
+
+/**
+ * Build block signatures of file version stored in base archive
+ */
+static int pack_delta_signatures ( struct pack_context_t *context, struct delta_context_t *delta )
+{
+    size_t len;
+    uint64_t left;
+    uint64_t offset;
+    struct ar_istream *istream = context->base_istream;
+    const struct location_t *location = &context->base_location;
+
+    if ( istream->reset ( istream,
+            context->base_meta->segment_table[location->segment].offset ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    /* Skip data stored before base file version */
+    for ( left = location->offset; left; left -= len )
+    {
+        len = left > context->workbuf_size ? context->workbuf_size : left;
+
+        if ( istream->read ( istream, context->workbuf, len ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    if ( delta_init ( delta, location->size ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Only whole blocks are matched */
+    for ( offset = 0; offset + delta->block <= location->size; offset += delta->block )
+    {
+        if ( istream->read ( istream, context->workbuf, delta->block ) < 0 )
+        {
+            delta_free ( delta );
+            return -1;
+        }
+
+        delta_insert ( delta, delta_weak ( context->workbuf, delta->block ),
+            xxh64 ( 0, context->workbuf, delta->block ), offset );
+    }
+
+    return 0;
+}
+
+/**
+ * Store pending delta records, base copy goes before literal data
+ */
+static int pack_delta_flush ( struct pack_context_t *context, uint64_t * copy_offset,
+    uint32_t * copy_len, const unsigned char *data, size_t len )
+{
+    if ( *copy_len )
+    {
+        if ( store_record ( context->ostream, RECORD_BASE, *copy_len, 0, *copy_offset ) < 0 )
+        {
+            return -1;
+        }
+
+        *copy_len = 0;
+    }
+
+    if ( len )
+    {
+        if ( store_record ( context->ostream, RECORD_DATA, len, 0, 0 ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( context->ostream->write ( context->ostream, data, len ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Pack file as delta to its version stored in base archive
+ */
+static int pack_file_delta ( struct pack_context_t *context, int fd, const struct node_t *node )
+{
+    int rolled = 0;
+    size_t pos = 0;
+    size_t end = 0;
+    size_t lit = 0;
+    size_t block;
+    ssize_t len;
+    uint32_t weak = 0;
+    uint32_t copy_len = 0;
+    uint64_t copy_offset = 0;
+    uint64_t base_pos = 0;
+    uint64_t left = node->entity.size;
+    unsigned char *buf = context->framebuf;
+    const struct delta_block_t *match;
+    struct delta_context_t delta;
+
+    if ( pack_delta_signatures ( context, &delta ) < 0 )
+    {
+        return -1;
+    }
+
+    block = delta.block;
+
+    for ( ;; )
+    {
+        /* Keep at least one block buffered */
+        if ( end - pos < block && left )
+        {
+            if ( pack_delta_flush ( context, &copy_offset, &copy_len, buf + lit, pos - lit ) < 0 )
+            {
+                delta_free ( &delta );
+                return -1;
+            }
+
+            memmove ( buf, buf + pos, end - pos );
+            end -= pos;
+            pos = 0;
+            lit = 0;
+
+            while ( end < DEDUP_BUFFER && left )
+            {
+                if ( ( len =
+                        read ( fd, buf + end,
+                            DEDUP_BUFFER - end < left ? DEDUP_BUFFER - end : left ) ) <= 0 )
+                {
+                    if ( !len )
+                    {
+                        errno = ENODATA;
+                    }
+                    perror ( context->path );
+                    delta_free ( &delta );
+                    return -1;
+                }
+
+                end += len;
+                left -= len;
+            }
+        }
+
+        if ( end - pos < block )
+        {
+            break;
+        }
+
+        if ( !rolled )
+        {
+            weak = delta_weak ( buf + pos, block );
+            rolled = 1;
+        }
+
+        /* Base is matched forward only, so it is read sequentially on extract */
+        match = delta_lookup ( &delta, weak ) ? delta_find ( &delta, weak,
+            xxh64 ( 0, buf + pos, block ), base_pos ) : NULL;
+
+        if ( match )
+        {
+            /* Contiguous base blocks are copied with a single record */
+            if ( ( pos > lit || copy_offset + copy_len != match->offset
+                    || copy_len + block > SPARSE_RECORD_MAX )
+                && pack_delta_flush ( context, &copy_offset, &copy_len, buf + lit,
+                    pos - lit ) < 0 )
+            {
+                delta_free ( &delta );
+                return -1;
+            }
+
+            if ( !copy_len )
+            {
+                copy_offset = match->offset;
+            }
+
+            copy_len += block;
+            base_pos = match->offset + block;
+            pos += block;
+            lit = pos;
+            rolled = 0;
+            continue;
+        }
+
+        /* Move window by one byte */
+        if ( pos + block < end )
+        {
+            weak = delta_roll ( weak, buf[pos], buf[pos + block], block );
+
+        } else
+        {
+            rolled = 0;
+        }
+
+        pos++;
+
+        /* Literal data is stored in bounded chunks */
+        if ( pos - lit >= DEDUP_CHUNK_MAX )
+        {
+            if ( pack_delta_flush ( context, &copy_offset, &copy_len, buf + lit, pos - lit ) < 0 )
+            {
+                delta_free ( &delta );
+                return -1;
+            }
+
+            lit = pos;
+        }
+    }
+
+    delta_free ( &delta );
+
+    /* File tail shorter than a block is stored as is */
+    return pack_delta_flush ( context, &copy_offset, &copy_len, buf + lit, end - lit );
+}
+
+#ifndef WIN32_BUILD
+/**
+ * Feed mapped file content straight to output stream, return one if
+ * file got shorter and must be read instead
+ */
+static int pack_file_mapped ( struct pack_context_t *context, int fd, uint64_t size )
+{
+    size_t chunk;
+    uint64_t offset;
+    void *map;
+    struct stat st;
+
+    /* Mapping past end of file would fault on access */
+    if ( fstat ( fd, &st ) < 0 )
+    {
+        perror ( context->path );
+        return -1;
+    }
+
+    if ( ( uint64_t ) st.st_size < size )
+    {
+        return 1;
+    }
+
+    for ( offset = 0; offset < size; offset += chunk )
+    {
+        chunk = size - offset > MAP_WINDOW ? MAP_WINDOW : size - offset;
+
+        if ( ( map = mmap ( NULL, chunk, PROT_READ, MAP_SHARED, fd, offset ) ) == MAP_FAILED )
+        {
+            perror ( context->path );
+            return -1;
+        }
+
+        madvise ( map, chunk, MADV_SEQUENTIAL );
+
+        if ( context->ostream->write ( context->ostream, map, chunk ) < 0 )
+        {
+            perror ( "write" );
+            munmap ( map, chunk );
+            return -1;
+        }
+
+        munmap ( map, chunk );
+    }
+
+    /* Data appended since scan is read after mapped part */
+    if ( lseek ( fd, size, SEEK_SET ) < 0 )
+    {
+        perror ( context->path );
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * Drop consumed source file from page cache if needed
+ */
+static void pack_drop_cache ( const struct pack_context_t *context, int fd )
+{
+#ifndef WIN32_BUILD
+    if ( context->options & OPTION_DIRECT_IO )
+    {
+        posix_fadvise ( fd, 0, 0, POSIX_FADV_DONTNEED );
+    }
+#else
+    UNUSED ( context );
+    UNUSED ( fd );
+#endif
+}
+
+/**
+ * Pack single file to an archive, file may be opened already
+ */
+static int pack_file ( struct pack_context_t *context, const struct node_t *node, int fd )
+{
+    ssize_t len = 0;
+
+    /* Open input file for reading */
+    if ( fd < 0 && ( fd = open ( context->path, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        perror ( context->path );
+        return -1;
+    }
+
+    /* Store file content as data records if needed */
+    if ( node->entity.mode & ENTITY_FRAMED )
+    {
+        if ( ( node->entity.mode & ENTITY_DELTA ? pack_file_delta ( context, fd,
+                    node ) : pack_file_framed ( context, fd, node ) ) < 0 )
+        {
+            close ( fd );
+            return -1;
+        }
+
+        pack_drop_cache ( context, fd );
+        close ( fd );
+
+        if ( context->options & OPTION_VERBOSE )
+        {
+            show_progress ( 'a', context->path );
+        }
+
+        return 0;
+    }
+
+    /* Large file is copied into uncompressed archive in kernel */
+    if ( context->ostream->copy && node->entity.size >= COPY_MIN_SIZE )
+    {
+        if ( context->ostream->copy ( context->ostream, fd, node->entity.size ) < 0 )
+        {
+            perror ( context->path );
+            close ( fd );
+            return -1;
+        }
+    }
+
+#ifndef WIN32_BUILD
+    /* Large file is compressed from its mapping without buffer copy */
+    if ( !context->ostream->copy && node->entity.size >= pack_map_min && node->entity.size
+        && pack_file_mapped ( context, fd, node->entity.size ) < 0 )
+    {
+        close ( fd );
+        return -1;
+    }
+#endif
+
+    /* Store file content into archive, rest of copied or mapped file too */
+    while ( ( len = read ( fd, context->workbuf, context->workbuf_size ) ) > 0 )
+    {
+        if ( context->ostream->write ( context->ostream, context->workbuf, len ) < 0 )
+        {
+            perror ( "write" );
+            close ( fd );
+            return -1;
+        }
+    }
+
+    /* Close file fd */
+    pack_drop_cache ( context, fd );
+    close ( fd );
+
+    /* Check if an error occurred */
+    if ( len < 0 )
+    {
+        perror ( context->path );
+        return -1;
+    }
+
+    /* Show file add success message */
+    if ( context->options & OPTION_VERBOSE )
+    {
+        show_progress ( 'a', context->path );
+    }
+
+    return 0;
+}
+
+/**
+ * Begin new archive segment at current file position
+ */
+static int segment_begin ( struct ar_ostream *ostream, struct segment_t *segment )
+{
+    off_t offset;
+
+    if ( ostream->reset ( ostream ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( ( offset = lseek ( ostream->context->fd, 0, SEEK_CUR ) ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    segment->offset = offset;
+
+    return 0;
+}
+
+/**
+ * Finish archive segment, save its size and checksum
+ */
+static int segment_end ( struct ar_ostream *ostream, struct segment_t *segment )
+{
+    off_t offset;
+
+    if ( ostream->flush ( ostream ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( ( offset = lseek ( ostream->context->fd, 0, SEEK_CUR ) ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    segment->size = offset - segment->offset;
+    segment->rawsize = ostream->context->length;
+    segment->crc32 = ostream->finalize_crc32 ( ostream );
+
+    return 0;
+}
+
+/**
+ * Begin new data segment of an archive
+ */
+static int pack_segment_begin ( struct pack_context_t *context )
+{
+    struct segment_t *segment_table;
+    struct archive_meta_t *meta = context->meta;
+
+    if ( !( segment_table =
+            ( struct segment_t * ) realloc ( meta->segment_table,
+                ( meta->nsegment + 1 ) * sizeof ( struct segment_t ) ) ) )
+    {
+        perror ( "realloc" );
+        return -1;
+    }
+
+    meta->segment_table = segment_table;
+
+    return segment_begin ( context->ostream, &segment_table[meta->nsegment] );
+}
+
+/**
+ * Finish data segment of an archive
+ */
+static int pack_segment_end ( struct pack_context_t *context )
+{
+    struct archive_meta_t *meta = context->meta;
+
+    if ( segment_end ( context->ostream, &meta->segment_table[meta->nsegment] ) < 0 )
+    {
+        return -1;
+    }
+
+    meta->nsegment++;
+
+    return 0;
+}
+
+/**
+ * Copy compressed data segment of unchanged file from previous archive
+ */
+static int pack_segment_copy ( struct pack_context_t *context, struct node_t *node )
+{
+    int fd = context->ostream->context->fd;
+    size_t len;
+    uint64_t left;
+    uint64_t offset;
+    struct segment_t *segment;
+    const struct segment_t *source = &context->base_meta->segment_table[node->location.segment];
+    struct archive_meta_t *meta = context->meta;
+
+    if ( pack_segment_begin ( context ) < 0 )
+    {
+        return -1;
+    }
+
+    segment = &meta->segment_table[meta->nsegment];
+
+    /* Data is copied as is, it is not decompressed */
+    for ( left = source->size, offset = source->offset; left; left -= len, offset += len )
+    {
+        len = left > context->workbuf_size ? context->workbuf_size : left;
+
+        if ( read_at ( context->base_istream->context->fd, context->workbuf, len,
+                offset ) != ( ssize_t ) len )
+        {
+            errno = ENODATA;
+            perror ( context->path );
+            return -1;
+        }
+
+        if ( write ( fd, context->workbuf, len ) != ( ssize_t ) len )
+        {
+            perror ( "write" );
+            return -1;
+        }
+    }
+
+    /* Segment checksum is kept from previous archive, it covers file data only */
+    segment->size = source->size;
+    segment->rawsize = source->rawsize;
+    segment->crc32 = source->crc32;
+    node->crc32 = source->crc32;
+
+    node->location.segment = meta->nsegment++;
+    node->location.offset = 0;
+
+    if ( context->options & OPTION_VERBOSE )
+    {
+        show_progress ( 'a', context->path );
+    }
+
+    return 0;
+}
+
+/**
+ * Open upcoming files in data order and hint kernel to read them ahead,
+ * return descriptor of current file if it was opened ahead
+ */
+static int pack_readahead ( struct pack_context_t *context, const struct group_entry_t *table,
+    uint32_t count, uint32_t index )
+{
+#ifndef WIN32_BUILD
+    int fd;
+    struct pack_ahead_t *slot;
+    const struct node_t *node;
+    char path[PATH_LIMIT];
+
+    if ( !context->ahead )
+    {
+        return -1;
+    }
+
+    /* Files copied from base archive are passed without hints */
+    if ( context->ahead_next < index )
+    {
+        context->ahead_next = index;
+    }
+
+    while ( context->ahead_next < count && context->ahead_next - index < pack_ahead_files
+        && context->ahead_bytes < pack_ahead_bytes )
+    {
+        node = table[context->ahead_next].node;
+        slot = &context->ahead[context->ahead_next++ % pack_ahead_files];
+
+        /* Data copied from base archive is not read, failed open is reported later */
+        if ( ( node->location.segment != SEGMENT_NONE && ~node->entity.mode & ENTITY_DELTA )
+            || node_path ( node, path, sizeof ( path ) ) < 0
+            || ( fd = open ( path, O_RDONLY | O_BINARY ) ) < 0 )
+        {
+            continue;
+        }
+
+        /* Large file is hinted only as far as bytes limit allows */
+        slot->fd = fd;
+        slot->len = pack_ahead_bytes - context->ahead_bytes;
+
+        if ( slot->len > node->entity.size )
+        {
+            slot->len = node->entity.size;
+        }
+
+        if ( slot->len )
+        {
+            posix_fadvise ( fd, 0, slot->len, POSIX_FADV_WILLNEED );
+        }
+
+        context->ahead_bytes += slot->len;
+    }
+
+    slot = &context->ahead[index % pack_ahead_files];
+    fd = slot->fd;
+    context->ahead_bytes -= slot->len;
+    slot->fd = -1;
+    slot->len = 0;
+
+    return fd;
+#else
+    UNUSED ( context );
+    UNUSED ( table );
+    UNUSED ( count );
+    UNUSED ( index );
+    return -1;
+#endif
+}
+
+/**
+ * Pack multiple files to an archive in data order
+ */
+static int pack_files_ordered ( struct pack_context_t *context, const struct group_entry_t *table,
+    uint32_t count )
+{
+    uint32_t i;
+    uint32_t crc32;
+    int per_file = context->options & OPTION_FILE_SEGMENTS;
+    int opened = 0;
+    struct node_t *node;
+
+    for ( i = 0; i < count; i++ )
+    {
+        node = table[i].node;
+
+        if ( node_path ( node, context->path, sizeof ( context->path ) ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Unchanged file data is copied from previous archive */
+        if ( node->location.segment != SEGMENT_NONE && ~node->entity.mode & ENTITY_DELTA )
+        {
+            if ( pack_segment_copy ( context, node ) < 0 )
+            {
+                return -1;
+            }
+
+            continue;
+        }
+
+        /* Begin new segment unless one is open */
+        if ( !opened )
+        {
+            if ( pack_segment_begin ( context ) < 0 )
+            {
+                return -1;
+            }
+
+            opened = 1;
+        }
+
+        /* Delta is built against file version in base archive */
+        if ( node->entity.mode & ENTITY_DELTA )
+        {
+            memcpy ( &context->base_location, &node->location, sizeof ( struct location_t ) );
+        }
+
+        node->location.segment = context->meta->nsegment;
+        node->location.offset = context->ostream->context->length;
+
+        /* File data gets its own checksum */
+        crc32 = stream_split_crc32 ( context->ostream->context );
+
+        if ( pack_file ( context, node, pack_readahead ( context, table, count, i ) ) < 0 )
+        {
+            return -1;
+        }
+
+        node->location.size = context->ostream->context->length - node->location.offset;
+        node->crc32 =
+            stream_merge_crc32 ( context->ostream->context, crc32, node->location.size );
+
+        /* Stored size follows file content actually read */
+        if ( ~node->entity.mode & ENTITY_FRAMED )
+        {
+            node->entity.size = node->location.size;
+        }
+
+        /* Large segments are split at file boundary, so they can be verified in parallel */
+        if ( per_file || context->ostream->context->length >= SEGMENT_SPLIT )
+        {
+            if ( pack_segment_end ( context ) < 0 )
+            {
+                return -1;
+            }
+
+            opened = 0;
+        }
+    }
+
+    if ( opened && pack_segment_end ( context ) < 0 )
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Pack multiple files to an archive
+ */
+static int pack_files ( uint32_t options, struct ar_ostream *ostream, struct archive_meta_t *meta,
+    const struct group_entry_t *table, uint32_t count, const struct archive_meta_t *base_meta,
+    struct ar_istream *base_istream )
+{
+    int retval;
+    uint32_t i;
+    struct pack_context_t context;
+    struct dedup_context_t dedup;
+
+    /* Prepare path buffer */
+    context.options = options;
+    context.ostream = ostream;
+    context.path[0] = '\0';
+    context.framebuf = NULL;
+    context.dedup = NULL;
+    context.meta = meta;
+    context.base_istream = base_istream;
+    context.base_meta = base_meta;
+    context.ahead = NULL;
+    context.ahead_next = 0;
+    context.ahead_bytes = 0;
+
+    /* Allocate work buffer */
+    if ( !( context.workbuf = ( unsigned char * ) malloc ( WORKBUF_LIMIT ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    context.workbuf_size = WORKBUF_LIMIT;
+
+    /* Allocate data records buffer if needed */
+    if ( options & ( OPTION_DEDUP | OPTION_SPARSE | OPTION_DELTA ) )
+    {
+        if ( !( context.framebuf = ( unsigned char * ) malloc ( DEDUP_BUFFER ) ) )
+        {
+            perror ( "malloc" );
+            free ( context.workbuf );
+            return -1;
+        }
+    }
+
+    /* Prepare deduplication if needed */
+    if ( options & OPTION_DEDUP )
+    {
+        if ( dedup_init ( &dedup ) < 0 )
+        {
+            free ( context.framebuf );
+            free ( context.workbuf );
+            return -1;
+        }
+
+        context.dedup = &dedup;
+    }
+
+    /* Prepare readahead of upcoming files if needed */
+    if ( pack_ahead_files && pack_ahead_bytes )
+    {
+        if ( !( context.ahead =
+                ( struct pack_ahead_t * ) malloc ( pack_ahead_files *
+                    sizeof ( struct pack_ahead_t ) ) ) )
+        {
+            perror ( "malloc" );
+
+            if ( context.dedup )
+            {
+                dedup_free ( context.dedup );
+            }
+
+            free ( context.framebuf );
+            free ( context.workbuf );
+            return -1;
+        }
+
+        for ( i = 0; i < pack_ahead_files; i++ )
+        {
+            context.ahead[i].fd = -1;
+            context.ahead[i].len = 0;
+        }
+    }
+
+    /* Pack the files */
+    retval = pack_files_ordered ( &context, table, count );
+
+    /* Close files opened ahead if packing failed */
+    if ( context.ahead )
+    {
+        for ( i = 0; i < pack_ahead_files; i++ )
+        {
+            if ( context.ahead[i].fd >= 0 )
+            {
+                close ( context.ahead[i].fd );
+            }
+        }
+
+        free ( context.ahead );
+    }
+
+    /* Free deduplication context */
+    if ( context.dedup )
+    {
+        dedup_free ( context.dedup );
+    }
+
+    /* Free data records buffer */
+    free ( context.framebuf );
+
+    /* Free work buffer */
+    free ( context.workbuf );
+
+    return retval;
+}
+
+/** 
+ * Store new files data segments of an archive
+ */
+static int zbox_pack_archive_data ( uint32_t options, struct ar_ostream *ostream,
+    struct archive_meta_t *meta, uint32_t first, const struct archive_meta_t *base_meta,
+    struct ar_istream *base_istream )
+{
+    int status;
+    uint32_t count;
+    struct group_entry_t *table;
+
+    /* Segment is not needed if no file data is stored */
+    if ( !( count = calc_files ( meta->root, first ) ) )
+    {
+        return 0;
+    }
+
+    /* Order files data, group similar files together if needed */
+    if ( !( table = group_files ( meta->root, first, count, options & OPTION_GROUP ) ) )
+    {
+        return -1;
+    }
+
+    /* Store files into new data segments */
+    status = pack_files ( options, ostream, meta, table, count, base_meta, base_istream );
+
+    /* Free data order table */
+    free ( table );
+
+    return status;
+}
+
+/** 
+ * Pack files tree to an archive stream, entities from index
+ * first onwards are new and get their data stored
+ */
+static int zbox_pack_archive_tree ( uint32_t options, struct ar_ostream *ostream,
+    struct archive_meta_t *meta, uint32_t first, const struct archive_meta_t *base_meta,
+    struct ar_istream *base_istream )
+{
+    uint32_t i;
+    uint32_t crc32;
+    uint32_t index = first;
+    uint32_t next_id;
+    uint64_t nameslen;
+    struct node_t **node_table;
+    struct segment_t meta_segment;
+    struct header_t *header = &meta->header;
+
+    /* Assign entity indexes in storage order */
+    next_id = calc_next_id ( meta->root );
+    index_entities ( meta->root, NULL, &index, &next_id );
+
+    /* Calculate entities count and names length */
+    header->nentity = index;
+    nameslen = calc_nameslen ( meta->root );
+    header->nameslen = nameslen;
+    header->nameslen_high = nameslen >> 32;
+
+    /* Hard links refer to entity indexes */
+    resolve_links ( meta->root );
+
+    /* Files are stored as deduplicated or sparse data records if needed */
+    if ( options & ( OPTION_DEDUP | OPTION_SPARSE ) )
+    {
+        mark_framed ( meta->root, first );
+    }
+
+    /* Build node table in entity index order */
+    if ( !( node_table =
+            ( struct node_t ** ) realloc ( meta->node_table,
+                ( header->nentity ? header->nentity : 1 ) * sizeof ( struct node_t * ) ) ) )
+    {
+        perror ( "realloc" );
+        return -1;
+    }
+
+    meta->node_table = node_table;
+    table_entities ( meta->root, node_table );
+
+    /* Store new files data */
+    if ( zbox_pack_archive_data ( options, ostream, meta, first, base_meta, base_istream ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Metadata segment follows files data */
+    if ( segment_begin ( ostream, &meta_segment ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Store file and directory information and names */
+    if ( store_columns ( ostream, node_table, header->nentity ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Store data segments and files data locations */
+    if ( store_segment_table ( ostream, meta->segment_table, meta->nsegment ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( store_location_table ( ostream, node_table, header->nentity ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Store files state for later incremental archives */
+    if ( store_ext_table ( ostream, meta ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Store files data checksums, appended archive must have them already */
+    if ( ( !first || meta->crc_table )
+        && store_crc_table ( ostream, node_table, header->nentity ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Flush archive stream */
+    if ( segment_end ( ostream, &meta_segment ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Point archive header at metadata, it has own checksum */
+    header->flags = HEADER_FLAG_SEGMENTED | HEADER_FLAG_EXTENDED | HEADER_FLAG_META_CRC32
+        | HEADER_FLAG_V2 | HEADER_FLAG_COMPACT;
+    header->inplace_offset = 0;
+    header->inplace_crc32 = 0;
+
+    /* Metadata copy for in-place use follows if needed */
+    if ( options & OPTION_INPLACE )
+    {
+        if ( store_inplace ( ostream, header, meta->root, node_table, nameslen ) < 0 )
+        {
+            return -1;
+        }
+
+        header->flags |= HEADER_FLAG_INPLACE;
+    }
+
+    if ( options & OPTION_FILE_SEGMENTS )
+    {
+        header->flags |= HEADER_FLAG_FILE_SEGMENTS;
+    }
+
+    if ( !first || meta->crc_table )
+    {
+        header->flags |= HEADER_FLAG_CHECKSUMS;
+    }
+
+    header->meta_offset = meta_segment.offset;
+    header->meta_size = meta_segment.size;
+
+    /* Metadata is validated without files data */
+    header->meta_crc32 =
+        zbox_calculate_meta_crc32 ( header, meta_segment.crc32, meta_segment.rawsize );
+
+    /* Checksum covers header and all segments in archive order */
+    header->crc32 = 0;
+    crc32 = header_crc32 ( header );
+
+    for ( i = 0; i < meta->nsegment; i++ )
+    {
+        crc32 =
+            checksum_combine ( header->checksum, crc32, meta->segment_table[i].crc32,
+            meta->segment_table[i].rawsize );
+    }
+
+    header->crc32 =
+        checksum_combine ( header->checksum, crc32, meta_segment.crc32, meta_segment.rawsize );
+
+    /* Update archive header */
+    if ( ostream->set_header ( ostream, header ) < 0 )
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/** 
+ * Load and verify metadata of an archive to be updated
+ */
+static int zbox_load_meta ( struct ar_istream *istream, const struct header_t *header,
+    struct archive_meta_t *meta, uint32_t flags )
+{
+    uint32_t i;
+    uint32_t crc32;
+    struct header_t seed;
+
+    /* Validate header magic field */
+    if ( header->magic[0] != 'z' || header->magic[1] != 'b'
+        || header->magic[2] != 'o' || header->magic[3] != 'x' )
+    {
+        fprintf ( stderr, "archive not recognized.\n" );
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( header->checksum > CHECKSUM_CRC32C )
+    {
+        fprintf ( stderr, "checksum type not supported.\n" );
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Appending needs trailing metadata, base archive also files state */
+    if ( ~header->flags & flags )
+    {
+        fprintf ( stderr, flags & HEADER_FLAG_EXTENDED ? "base archive format not supported.\n"
+            : "archive format does not support append.\n" );
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( istream->reset ( istream, header->meta_offset ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    if ( meta_load ( istream, header, meta ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Stored segment checksums must match archive checksum */
+    memcpy ( &seed, header, sizeof ( seed ) );
+    seed.crc32 = 0;
+    crc32 = header_crc32 ( &seed );
+
+    for ( i = 0; i < meta->nsegment; i++ )
+    {
+        crc32 =
+            checksum_combine ( header->checksum, crc32, meta->segment_table[i].crc32,
+            meta->segment_table[i].rawsize );
+    }
+
+    crc32 =
+        checksum_combine ( header->checksum, crc32, istream->finalize_crc32 ( istream ),
+        istream->context->length );
+
+    if ( crc32 != header->crc32 )
+    {
+        fprintf ( stderr, "archive checksum: bad\n" );
+        errno = EINVAL;
+        meta_free ( meta );
+        return -1;
+    }
+
+    /* Parse archive nodes into memory */
+    if ( meta_parse ( meta ) < 0 )
+    {
+        meta_free ( meta );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Hash file or directory name within its parent directory
+ */
+static size_t base_slot ( uint32_t parent, const char *name, size_t size )
+{
+    return xxh64 ( parent, ( const uint8_t * ) name, strlen ( name ) ) & ( size - 1 );
+}
+
+/**
+ * Build base archive entities lookup table
+ */
+static struct node_t **base_index ( const struct archive_meta_t *meta, size_t *size )
+{
+    uint32_t i;
+    uint32_t parent;
+    size_t slot;
+    struct node_t *node;
+    struct node_t **slots;
+
+    for ( *size = 16; *size < ( size_t ) meta->header.nentity * 2; *size <<= 1 );
+
+    if ( !( slots = ( struct node_t ** ) calloc ( *size, sizeof ( struct node_t * ) ) ) )
+    {
+        perror ( "calloc" );
+        return NULL;
+    }
+
+    for ( i = 0; i < meta->header.nentity; i++ )
+    {
+        node = meta->node_table[i];
+
+        /* Only the latest version of a file is matched */
+        if ( node->entity.mode & ENTITY_SHADOWED )
+        {
+            continue;
+        }
+
+        parent = node->parent ? node->parent->index : ENTITY_INDEX_NONE;
+
+        for ( slot = base_slot ( parent, node->name, *size ); slots[slot];
+            slot = ( slot + 1 ) & ( *size - 1 ) );
+
+        slots[slot] = node;
+    }
+
+    return slots;
+}
+
+/**
+ * Find base archive entity by its parent and name
+ */
+static const struct node_t *base_find ( struct node_t **slots, size_t size, uint32_t parent,
+    const char *name )
+{
+    size_t slot;
+    const struct node_t *node;
+
+    for ( slot = base_slot ( parent, name, size ); ( node = slots[slot] );
+        slot = ( slot + 1 ) & ( size - 1 ) )
+    {
+        if ( ( node->parent ? node->parent->index : ENTITY_INDEX_NONE ) == parent
+            && !strcmp ( node->name, name ) )
+        {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Match files with base archive, unchanged files are referenced
+ * or their data segments are reused if needed
+ */
+static void base_match ( const struct base_match_t *match, struct node_t *node, uint32_t parent )
+{
+    const struct node_t *base;
+    const struct location_t *location;
+
+    for ( ; node; node = node->next )
+    {
+        base = base_find ( match->slots, match->size, parent, node_basename ( node->name ) );
+
+        /* File and directory of the same name do not match */
+        if ( base && !( base->entity.mode & S_IFDIR ) != !( node->entity.mode & S_IFDIR ) )
+        {
+            base = NULL;
+        }
+
+        if ( !base )
+        {
+            continue;
+        }
+
+        if ( match->options & OPTION_INCREMENTAL )
+        {
+            node->ext.base = base->index;
+        }
+
+        /* File is unchanged if its size and state are the same */
+        if ( !( node->entity.mode & ( S_IFDIR | ENTITY_LINK ) )
+            && ~base->entity.mode & ENTITY_LINK
+            && node->entity.size == base->entity.size
+            && node->ext.mtime == base->ext.mtime
+            && node->ext.ctime == base->ext.ctime && node->ext.inode == base->ext.inode )
+        {
+            location = &base->location;
+
+            if ( match->options & OPTION_INCREMENTAL )
+            {
+                node->entity.mode |= ENTITY_BASE;
+
+            } else if ( match->segment_files && location->segment != SEGMENT_NONE
+                && ~base->entity.mode & ENTITY_DELTA
+                && match->segment_files[location->segment] == 1 && !location->offset
+                && location->size == match->meta->segment_table[location->segment].rawsize )
+            {
+                /* File data is stored in its own segment */
+                memcpy ( &node->location, location, sizeof ( struct location_t ) );
+                node->entity.mode =
+                    ( node->entity.mode & ~ENTITY_FRAMED ) | ( base->entity.mode &
+                    ENTITY_FRAMED );
+            }
+
+        } else if ( match->options & OPTION_DELTA
+            && !( node->entity.mode & ( S_IFDIR | ENTITY_LINK ) )
+            && !( base->entity.mode & ( ENTITY_LINK | ENTITY_FRAMED | ENTITY_BASE ) )
+            && base->location.segment != SEGMENT_NONE && base->location.size >= DELTA_MIN_SIZE
+            && node->entity.size >= DELTA_MIN_SIZE )
+        {
+            /* Changed file is stored as delta to its plain base version */
+            memcpy ( &node->location, &base->location, sizeof ( struct location_t ) );
+            node->entity.mode |= ENTITY_FRAMED | ENTITY_DELTA;
+        }
+
+        if ( node->entity.mode & S_IFDIR )
+        {
+            base_match ( match, node->sub, base->index );
+        }
+    }
+}
+
+/**
+ * Count files stored in each base archive segment
+ */
+static uint32_t *base_segment_files ( const struct archive_meta_t *meta )
+{
+    uint32_t i;
+    uint32_t *segment_files;
+
+    if ( !( segment_files =
+            ( uint32_t * ) calloc ( meta->nsegment ? meta->nsegment : 1, sizeof ( uint32_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return NULL;
+    }
+
+    for ( i = 0; i < meta->header.nentity; i++ )
+    {
+        if ( meta->node_table[i]->location.segment != SEGMENT_NONE )
+        {
+            segment_files[meta->node_table[i]->location.segment]++;
+        }
+    }
+
+    return segment_files;
+}
+
+/**
+ * Load base archive, reference unchanged files or reuse their data,
+ * base archive stream is kept open for reading files data
+ */
+static int zbox_pack_base ( const char *base, uint32_t options, struct archive_meta_t *meta,
+    struct archive_meta_t *base_meta, struct ar_istream **base_istream )
+{
+    int fd;
+    struct ar_istream *istream;
+    struct header_t header;
+    struct base_match_t match;
+
+    /* Open base archive file for reading */
+    if ( ( fd = open ( base, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        perror ( base );
+        return -1;
+    }
+
+    /* Open base archive stream */
+    if ( !( istream = zbox_archive_istream_open ( fd, &header, options ) ) )
+    {
+        close ( fd );
+        return -1;
+    }
+
+    /* Load base archive metadata */
+    if ( zbox_load_meta ( istream, &header, base_meta,
+            HEADER_FLAG_SEGMENTED | HEADER_FLAG_EXTENDED ) < 0 )
+    {
+        istream->close ( istream );
+        close ( fd );
+        return -1;
+    }
+
+    match.options = options;
+    match.meta = base_meta;
+    match.segment_files = NULL;
+
+    if ( options & OPTION_INCREMENTAL )
+    {
+        /* Base archive is found next to the incremental archive */
+        meta->base_name = ( char * ) node_basename ( base );
+        meta->base_crc32 = header.crc32;
+
+    } else if ( ~header.flags & HEADER_FLAG_FILE_SEGMENTS || header.comp != meta->header.comp
+        || header.checksum != meta->header.checksum )
+    {
+        /* Compressed data cannot be reused, all files are packed */
+        fprintf ( stderr, "%s: no reusable file segments\n", base );
+
+    } else if ( !( match.segment_files = base_segment_files ( base_meta ) ) )
+    {
+        meta_free ( base_meta );
+        istream->close ( istream );
+        close ( fd );
+        return -1;
+    }
+
+    if ( !( match.slots = base_index ( base_meta, &match.size ) ) )
+    {
+        free ( match.segment_files );
+        meta_free ( base_meta );
+        istream->close ( istream );
+        close ( fd );
+        return -1;
+    }
+
+    base_match ( &match, meta->root, ENTITY_INDEX_NONE );
+
+    free ( match.slots );
+    free ( match.segment_files );
+
+    *base_istream = istream;
+
+    return 0;
+}
+
+/** 
+ * Pack files to an archive stream
+ */
+static int zbox_pack_archive_stream ( uint32_t options, struct ar_ostream *ostream,
+    const char *base, const char *files[], size_t nfiles, struct filter_t *exclude )
+{
+    int status;
+    struct ar_istream *base_istream = NULL;
+    struct archive_meta_t meta;
+    struct archive_meta_t base_meta;
+    struct header_t *header = &meta.header;
+
+    /* Prepare archive header */
+    memset ( &meta, '\0', sizeof ( meta ) );
+
+    /* Set achive header identifier */
+    header->magic[0] = 'z';
+    header->magic[1] = 'b';
+    header->magic[2] = 'o';
+    header->magic[3] = 'x';
+
+    /* Checksum must be set to zero before calculation */
+    header->crc32 = 0;
+
+    /* Set achive compression type */
+    if ( options & OPTION_ZLIB )
+    {
+        header->comp = COMP_ZLIB;
+
+    } else
+    {
+        header->comp = COMP_NONE;
+    }
+
+    /* Set archive checksum type */
+    header->checksum = options & OPTION_CRC32C ? CHECKSUM_CRC32C : CHECKSUM_CRC32;
+    ostream->context->checksum = header->checksum;
+
+    /* Build files tree */
+    if ( scan_files_tree ( files, nfiles, options, exclude, &meta.root ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Root must be specified */
+    if ( !meta.root )
+    {
+        return -1;
+    }
+
+    /* Unchanged files are referenced from base archive if needed */
+    if ( base && zbox_pack_base ( base, options, &meta, &base_meta, &base_istream ) < 0 )
+    {
+        free_files_tree ( meta.root, 1 );
+        return -1;
+    }
+
+    /* Pack files tree into archive */
+    status =
+        zbox_pack_archive_tree ( options, ostream, &meta, 0, base ? &base_meta : NULL,
+        base_istream );
+
+    /* Close base archive */
+    if ( base )
+    {
+        meta_free ( &base_meta );
+        close ( base_istream->context->fd );
+        base_istream->close ( base_istream );
+    }
+
+    /* Free segment and node tables */
+    free ( meta.segment_table );
+    free ( meta.node_table );
+
+    /* Free files tree */
+    free_files_tree ( meta.root, 1 );
+
+    return status;
+}
+
+/**
+ * Open archive output stream
+ */
+static struct ar_ostream *zbox_archive_ostream_open ( int fd, uint32_t comp, int level )
+{
+    if ( comp == COMP_ZLIB )
     {
 #ifdef ENABLE_ZLIB
-        ostream = zlib_ostream_open ( fd, level );
+        return zlib_ostream_open ( fd, level );
 #else
         UNUSED ( level );
         fprintf ( stderr, "zlib not enabled.\n" );
         errno = EINVAL;
-        close ( fd );
-        return -1;
+        return NULL;
 #endif
-    } else
+    }
+
+    return plain_ostream_open ( fd );
+}
+
+/** 
+ * Pack files to an archive
+ */
+int zbox_pack_archive ( const char *archive, uint32_t options, int level, const char *base,
+    const char *files[], size_t nfiles, struct filter_t *exclude )
+{
+    int fd;
+    int status;
+    struct stat archive_stat;
+    struct stat base_stat;
+    struct ar_ostream *ostream;
+
+    /* Base archive must not be overwritten */
+    if ( base && !stat ( archive, &archive_stat ) && !stat ( base, &base_stat )
+        && archive_stat.st_dev == base_stat.st_dev && archive_stat.st_ino == base_stat.st_ino )
     {
-        ostream = plain_ostream_open ( fd );
+        errno = EINVAL;
+        perror ( base );
+        return -1;
     }
 
-    /* Check if an error occurred */
-    if ( !ostream )
+    /* Open archive file for writing */
+    if ( ( fd = open ( archive, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0644 ) ) < 0 )
+    {
+        perror ( archive );
+        return -1;
+    }
+
+    /* Open archive stream */
+    if ( !( ostream =
+            zbox_archive_ostream_open ( fd, options & OPTION_ZLIB ? COMP_ZLIB : COMP_NONE,
+                level ) ) )
     {
         close ( fd );
         return -1;
     }
 
+    /* Archive data is written bypassing page cache if possible */
+    if ( options & OPTION_DIRECT_IO )
+    {
+        generic_direct_output ( ostream );
+    }
+
     /* Pack files into archive */
-    status = zbox_pack_archive_stream ( options, ostream, files, nfiles );
+    status = zbox_pack_archive_stream ( options, ostream, base, files, nfiles, exclude );
 
     /* Close archive stream */
     ostream->close ( ostream );
@@ -398,4 +2848,219 @@ int zbox_pack_archive ( const char *archive, uint32_t options, int level, const
     return status;
 }
 
+/**
+ * Find not shadowed file or directory by its base name
+ */
+static struct node_t *find_node ( struct node_t *node, const char *name )
+{
+    for ( ; node; node = node->next )
+    {
+        if ( ~node->entity.mode & ENTITY_SHADOWED
+            && !strcmp ( node_basename ( node->name ), name ) )
+        {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Merge new files tree into files tree loaded from an archive,
+ * replaced files are kept in the archive but shadowed
+ */
+static int merge_files_tree ( struct node_t **head, struct node_t *node )
+{
+    struct node_t *old;
+    struct node_t *next;
+    struct node_t **tail;
+
+    for ( tail = head; *tail; tail = &( *tail )->next );
+
+    for ( ; node; node = next )
+    {
+        next = node->next;
+        node->next = NULL;
+
+        if ( ( old = find_node ( *head, node_basename ( node->name ) ) ) )
+        {
+            /* Directories with the same name are merged */
+            if ( old->entity.mode & S_IFDIR && node->entity.mode & S_IFDIR )
+            {
+                if ( merge_files_tree ( &old->sub, node->sub ) < 0 )
+                {
+                    node->sub = NULL;
+                    free_files_tree ( next, 1 );
+                    free ( node->name );
+                    free ( node );
+                    return -1;
+                }
+
+                free ( node->name );
+                free ( node );
+                continue;
+            }
+
+            /* Directory cannot be replaced with a file and vice versa */
+            if ( old->entity.mode & S_IFDIR || node->entity.mode & S_IFDIR )
+            {
+                errno = EEXIST;
+                perror ( node->name );
+                node->next = next;
+                free_files_tree ( node, 1 );
+                return -1;
+            }
+
+            old->entity.mode |= ENTITY_SHADOWED;
+        }
+
+        *tail = node;
+        tail = &node->next;
+    }
+
+    return 0;
+}
+
+/**
+ * Free merged files tree, only names of new entities are allocated
+ */
+static void free_merged_tree ( struct node_t *node, uint32_t first )
+{
+    if ( !node )
+    {
+        return;
+    }
+
+    free_merged_tree ( node->sub, first );
+    free_merged_tree ( node->next, first );
+
+    if ( node->index >= first )
+    {
+        free ( node->name );
+    }
+
+    free ( node );
+}
+
+/** 
+ * Append files to an existing archive
+ */
+int zbox_append_archive ( const char *archive, uint32_t options, int level, const char *files[],
+    size_t nfiles, struct filter_t *exclude )
+{
+    int fd;
+    int status;
+    off_t size;
+    uint32_t first;
+    struct ar_istream *istream;
+    struct ar_ostream *ostream;
+    struct header_t header;
+    struct archive_meta_t meta;
+    struct node_t *root = NULL;
+
+    /* Open archive file, create it if not exists */
+    if ( ( fd = open ( archive, O_RDWR | O_BINARY ) ) < 0 )
+    {
+        if ( errno == ENOENT )
+        {
+            return zbox_pack_archive ( archive, options, level, NULL, files, nfiles, exclude );
+        }
+
+        perror ( archive );
+        return -1;
+    }
+
+    /* Open archive stream */
+    if ( !( istream = zbox_archive_istream_open ( fd, &header, options ) ) )
+    {
+        close ( fd );
+        return -1;
+    }
+
+    /* Load existing archive metadata */
+    status = zbox_load_meta ( istream, &header, &meta, HEADER_FLAG_SEGMENTED );
+
+    /* Close archive stream */
+    istream->close ( istream );
+
+    if ( status < 0 )
+    {
+        close ( fd );
+        return -1;
+    }
+
+    /* Build new files tree */
+    if ( scan_files_tree ( files, nfiles, options, exclude, &root ) < 0 )
+    {
+        meta_free ( &meta );
+        close ( fd );
+        return -1;
+    }
+
+    /* Files keep getting own segments if archive was created so */
+    if ( header.flags & HEADER_FLAG_FILE_SEGMENTS )
+    {
+        options |= OPTION_FILE_SEGMENTS;
+    }
+
+    /* Metadata copy for in-place use is kept up to date */
+    if ( header.flags & HEADER_FLAG_INPLACE )
+    {
+        options |= OPTION_INPLACE;
+    }
+
+    /* Merge new files into archive files tree */
+    first = header.nentity;
+
+    if ( merge_files_tree ( &meta.root, root ) < 0 )
+    {
+        free_merged_tree ( meta.root, first );
+        meta.root = NULL;
+        meta_free ( &meta );
+        close ( fd );
+        return -1;
+    }
+
+    /* Archive is restored to its size on failure */
+    if ( ( size = lseek ( fd, 0, SEEK_END ) ) < 0 )
+    {
+        perror ( "lseek" );
+        status = -1;
+
+    } else if ( !( ostream = zbox_archive_ostream_open ( fd, header.comp, level ) ) )
+    {
+        status = -1;
+
+    } else
+    {
+        /* New data is checksummed as existing archive declares */
+        ostream->context->checksum = header.checksum;
+
+        /* New data is written bypassing page cache if possible */
+        if ( options & OPTION_DIRECT_IO )
+        {
+            generic_direct_output ( ostream );
+        }
+
+        /* Store new files and metadata after existing data */
+        status = zbox_pack_archive_tree ( options, ostream, &meta, first, NULL, NULL );
+
+        /* Close archive stream, buffered data is written before truncation */
+        ostream->close ( ostream );
+
+        if ( status < 0 && ftruncate ( fd, size ) < 0 )
+        {
+            perror ( archive );
+        }
+    }
+
+    /* Free files tree and metadata */
+    free_merged_tree ( meta.root, first );
+    meta.root = NULL;
+    meta_free ( &meta );
+    close ( fd );
+
+    return status;
+}
+
 #endif
@@ -18,6 +18,15 @@ struct node_t *node_insert ( struct node_t **head )
 
     node->next = *head;
     node->sub = NULL;
+    node->parent = NULL;
+    node->link = NULL;
+    node->index = ENTITY_INDEX_NONE;
+    node->crc32 = 0;
+    node->location.segment = SEGMENT_NONE;
+    node->location.offset = 0;
+    node->location.size = 0;
+    memset ( &node->ext, '\0', sizeof ( node->ext ) );
+    node->ext.base = ENTITY_INDEX_NONE;
     *head = node;
 
     return node;
@@ -38,6 +47,15 @@ struct node_t *node_append ( struct node_t **head )
 
     node->next = NULL;
     node->sub = NULL;
+    node->parent = NULL;
+    node->link = NULL;
+    node->index = ENTITY_INDEX_NONE;
+    node->crc32 = 0;
+    node->location.segment = SEGMENT_NONE;
+    node->location.offset = 0;
+    node->location.size = 0;
+    memset ( &node->ext, '\0', sizeof ( node->ext ) );
+    node->ext.base = ENTITY_INDEX_NONE;
 
     if ( *head )
     {
@@ -94,6 +112,26 @@ int path_concat ( char *path, size_t path_size, const char *name )
     return 0;
 }
 
+/**
+ * Build node path from its parent nodes
+ */
+int node_path ( const struct node_t *node, char *path, size_t path_size )
+{
+    if ( node->parent )
+    {
+        if ( node_path ( node->parent, path, path_size ) < 0 )
+        {
+            return -1;
+        }
+
+    } else
+    {
+        path[0] = '\0';
+    }
+
+    return path_concat ( path, path_size, node->name );
+}
+
 /**
  * Find filesystem separator in path
  */
@@ -127,6 +165,179 @@ static int filter_check ( char *filter, const char *name )
     return ret;
 }
 
+#ifndef WIN32_BUILD
+
+/**
+ * Calculate inode hash table slot
+ */
+static size_t scan_inode_slot ( uint64_t dev, uint64_t ino, size_t size )
+{
+    uint64_t hash;
+
+    hash = ( dev * 0x9e3779b97f4a7c15ULL ) ^ ( ino * 0xc2b2ae3d27d4eb4fULL );
+    hash ^= hash >> 29;
+
+    return hash & ( size - 1 );
+}
+
+/**
+ * Find already scanned file with the same inode
+ */
+static const struct node_t *scan_find_inode ( const struct scan_context_t *context,
+    const struct stat *statbuf )
+{
+    size_t i;
+
+    if ( !context->inodes_size )
+    {
+        return NULL;
+    }
+
+    for ( i = scan_inode_slot ( statbuf->st_dev, statbuf->st_ino, context->inodes_size );
+        context->inodes[i].node; i = ( i + 1 ) & ( context->inodes_size - 1 ) )
+    {
+        if ( context->inodes[i].dev == ( uint64_t ) statbuf->st_dev
+            && context->inodes[i].ino == ( uint64_t ) statbuf->st_ino )
+        {
+            return context->inodes[i].node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Remember scanned file inode
+ */
+static int scan_insert_inode ( struct scan_context_t *context, const struct stat *statbuf,
+    const struct node_t *node )
+{
+    size_t i;
+    size_t j;
+    size_t size;
+    struct scan_inode_t *inodes;
+
+    /* Keep load factor below one half */
+    if ( ( context->inodes_count + 1 ) * 2 > context->inodes_size )
+    {
+        size = context->inodes_size ? context->inodes_size << 1 : 1024;
+
+        if ( !( inodes = ( struct scan_inode_t * ) calloc ( size, sizeof ( struct scan_inode_t ) ) ) )
+        {
+            perror ( "calloc" );
+            return -1;
+        }
+
+        for ( i = 0; i < context->inodes_size; i++ )
+        {
+            if ( !context->inodes[i].node )
+            {
+                continue;
+            }
+
+            for ( j = scan_inode_slot ( context->inodes[i].dev, context->inodes[i].ino, size );
+                inodes[j].node; j = ( j + 1 ) & ( size - 1 ) );
+
+            inodes[j] = context->inodes[i];
+        }
+
+        free ( context->inodes );
+        context->inodes = inodes;
+        context->inodes_size = size;
+    }
+
+    for ( i = scan_inode_slot ( statbuf->st_dev, statbuf->st_ino, context->inodes_size );
+        context->inodes[i].node; i = ( i + 1 ) & ( context->inodes_size - 1 ) );
+
+    context->inodes[i].dev = statbuf->st_dev;
+    context->inodes[i].ino = statbuf->st_ino;
+    context->inodes[i].node = node;
+    context->inodes_count++;
+
+    return 0;
+}
+
+/**
+ * Store repeated inode as hard link, only files with more than one link
+ * are tracked, symbolic links are stored as their targets
+ */
+static int scan_hard_link ( struct scan_context_t *context, const struct stat *statbuf,
+    struct node_t *node )
+{
+    struct stat linkbuf;
+
+    if ( statbuf->st_nlink < 2 || lstat ( context->path, &linkbuf ) < 0
+        || S_ISLNK ( linkbuf.st_mode ) )
+    {
+        return 0;
+    }
+
+    if ( ( node->link = scan_find_inode ( context, statbuf ) ) )
+    {
+        node->entity.mode |= ENTITY_LINK;
+        node->entity.size = 0;
+        return 0;
+    }
+
+    return scan_insert_inode ( context, statbuf, node );
+}
+
+/**
+ * Check if directory is already being scanned
+ */
+static int scan_dir_loop ( const struct scan_context_t *context, const struct stat *statbuf )
+{
+    const struct scan_dir_t *dir;
+
+    for ( dir = context->dirs; dir; dir = dir->parent )
+    {
+        if ( dir->dev == ( uint64_t ) statbuf->st_dev && dir->ino == ( uint64_t ) statbuf->st_ino )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#endif
+
+/**
+ * Save file state used to detect changes
+ */
+static void scan_file_state ( const struct stat *statbuf, struct entity_ext_t *ext )
+{
+#ifndef WIN32_BUILD
+    ext->mtime = ( uint64_t ) statbuf->st_mtim.tv_sec * 1000000000 + statbuf->st_mtim.tv_nsec;
+    ext->ctime = ( uint64_t ) statbuf->st_ctim.tv_sec * 1000000000 + statbuf->st_ctim.tv_nsec;
+#else
+    ext->mtime = ( uint64_t ) statbuf->st_mtime * 1000000000;
+    ext->ctime = ( uint64_t ) statbuf->st_ctime * 1000000000;
+#endif
+    ext->inode = statbuf->st_ino;
+}
+
+/**
+ * Check if scanned path is excluded
+ */
+static int scan_excluded ( const struct scan_context_t *context )
+{
+    const char *path = context->path;
+
+    if ( !context->exclude )
+    {
+        return 0;
+    }
+
+    /* Patterns are matched against relative paths */
+    while ( *path == '/' )
+    {
+        path++;
+    }
+
+    return filter_match ( context->exclude, path ) == FILTER_EXCLUDE;
+}
+
 /**
  * Scan input files tree
  */
@@ -141,6 +352,7 @@ static int scan_files ( const char *name, uint32_t parent_id, struct scan_contex
     struct dirent *entry;
     struct stat statbuf;
     struct node_t *node;
+    struct scan_dir_t scan_dir;
 
     path_len = strlen ( context->path );
     name_len = strlen ( name );
@@ -165,6 +377,19 @@ static int scan_files ( const char *name, uint32_t parent_id, struct scan_contex
         }
     }
 
+    /* Excluded subtree is pruned before it is stat'ed */
+    if ( scan_excluded ( context ) )
+    {
+        context->path[path_len] = '\0';
+
+        if ( filter )
+        {
+            context->filter = filter;
+        }
+
+        return 0;
+    }
+
     if ( stat ( context->path, &statbuf ) < 0 )
     {
         perror ( context->path );
@@ -184,6 +409,22 @@ static int scan_files ( const char *name, uint32_t parent_id, struct scan_contex
         return -1;
     }
 
+#ifndef WIN32_BUILD
+    /* Cut off directory loops */
+    if ( statbuf.st_mode & S_IFDIR && scan_dir_loop ( context, &statbuf ) )
+    {
+        fprintf ( stderr, "%s: directory loop skipped\n", context->path );
+        context->path[path_len] = '\0';
+
+        if ( filter )
+        {
+            context->filter = filter;
+        }
+
+        return 0;
+    }
+#endif
+
     if ( !( node = node_insert ( head ) ) )
     {
         return -1;
@@ -197,10 +438,17 @@ static int scan_files ( const char *name, uint32_t parent_id, struct scan_contex
     memcpy ( node->name, name, name_len + 1 );
     node->entity.parent = parent_id;
     node->entity.mode = statbuf.st_mode;
+    scan_file_state ( &statbuf, &node->ext );
 
     if ( ~statbuf.st_mode & S_IFDIR )
     {
         node->entity.size = statbuf.st_size;
+#ifndef WIN32_BUILD
+        if ( scan_hard_link ( context, &statbuf, node ) < 0 )
+        {
+            return -1;
+        }
+#endif
         context->path[path_len] = '\0';
         context->filter = filter;
         return 0;
@@ -208,12 +456,25 @@ static int scan_files ( const char *name, uint32_t parent_id, struct scan_contex
 
     node->entity.id = context->next_id++;
 
+    /* Directories on other filesystems are stored empty */
+    if ( context->one_fs && !filter && ( uint64_t ) statbuf.st_dev != context->dev )
+    {
+        context->path[path_len] = '\0';
+        return 0;
+    }
+
     if ( !( dir = opendir ( context->path ) ) )
     {
         perror ( context->path );
         return -1;
     }
 
+    /* Track directories being scanned */
+    scan_dir.dev = statbuf.st_dev;
+    scan_dir.ino = statbuf.st_ino;
+    scan_dir.parent = context->dirs;
+    context->dirs = &scan_dir;
+
     while ( ( entry = readdir ( dir ) ) )
     {
         if ( !strcmp ( entry->d_name, "." ) || !strcmp ( entry->d_name, ".." ) )
@@ -228,6 +489,8 @@ static int scan_files ( const char *name, uint32_t parent_id, struct scan_contex
         }
     }
 
+    context->dirs = scan_dir.parent;
+
     closedir ( dir );
 
     context->path[path_len] = '\0';
@@ -259,6 +522,9 @@ static int begin_scan_files_in ( const char *path, uint32_t parent_id,
         return -1;
     }
 
+    /* Scanned tree filesystem */
+    context->dev = statbuf.st_dev;
+
     /* Validate filter buffer size */
     if ( ( len = strlen ( path ) ) >= sizeof ( filter ) )
     {
@@ -348,21 +614,315 @@ int scan_files_tree_in ( const char *files[], size_t nfiles, struct scan_context
         return -1;
     }
 
-    /* Scan for next file tree */
-    return scan_files_tree_in ( files + 1, nfiles - 1, context, &( *root )->next );
+    /* Scan for next file tree, excluded one added no node */
+    return scan_files_tree_in ( files + 1, nfiles - 1, context, *root ? &( *root )->next : root );
+}
+
+/**
+ * Find listed entry by its parent directory and name
+ */
+static struct node_t *scan_find_name ( const struct scan_context_t *context, uint64_t hash,
+    uint32_t parent_id, const char *name )
+{
+    size_t i;
+
+    if ( !context->names_size )
+    {
+        return NULL;
+    }
+
+    for ( i = hash & ( context->names_size - 1 ); context->names[i].node;
+        i = ( i + 1 ) & ( context->names_size - 1 ) )
+    {
+        if ( context->names[i].hash == hash && context->names[i].node->entity.parent == parent_id
+            && !strcmp ( context->names[i].node->name, name ) )
+        {
+            return context->names[i].node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Remember listed entry
+ */
+static int scan_insert_name ( struct scan_context_t *context, uint64_t hash,
+    struct node_t *node )
+{
+    size_t i;
+    size_t j;
+    size_t size;
+    struct scan_name_t *names;
+
+    /* Keep load factor below one half */
+    if ( ( context->names_count + 1 ) * 2 > context->names_size )
+    {
+        size = context->names_size ? context->names_size << 1 : 1024;
+
+        if ( !( names = ( struct scan_name_t * ) calloc ( size, sizeof ( struct scan_name_t ) ) ) )
+        {
+            perror ( "calloc" );
+            return -1;
+        }
+
+        for ( i = 0; i < context->names_size; i++ )
+        {
+            if ( !context->names[i].node )
+            {
+                continue;
+            }
+
+            for ( j = context->names[i].hash & ( size - 1 ); names[j].node;
+                j = ( j + 1 ) & ( size - 1 ) );
+
+            names[j] = context->names[i];
+        }
+
+        free ( context->names );
+        context->names = names;
+        context->names_size = size;
+    }
+
+    for ( i = hash & ( context->names_size - 1 ); context->names[i].node;
+        i = ( i + 1 ) & ( context->names_size - 1 ) );
+
+    context->names[i].hash = hash;
+    context->names[i].node = node;
+    context->names_count++;
+
+    return 0;
+}
+
+/**
+ * Add listed file to files tree, missing parent directories are added too
+ */
+static int scan_list_entry ( struct scan_context_t *context, struct node_t **root )
+{
+    int status;
+    char sep;
+    char *name;
+    char *end;
+    char *rest;
+    size_t name_len;
+    uint64_t hash;
+    uint32_t parent_id = 0;
+    struct stat statbuf;
+    struct node_t *node;
+    struct node_t **head = root;
+
+    for ( name = context->path; name[0] == '.' && name[1] == '/'; )
+    {
+        for ( name++; *name == '/'; name++ );
+    }
+
+    for ( ; *name; name = rest )
+    {
+        /* Files are read by stored path, absolute path keeps its root in first name */
+        name_len = strspn ( name, "/" );
+        name_len += strcspn ( name + name_len, "/" );
+        end = name + name_len;
+
+        for ( rest = end; *rest == '/'; rest++ );
+
+        /* Current directory names are skipped, parent ones are not allowed */
+        if ( name_len == 1 && name[0] == '.' )
+        {
+            continue;
+        }
+
+        if ( name_len == 2 && name[0] == '.' && name[1] == '.' )
+        {
+            errno = EINVAL;
+            perror ( context->path );
+            return -1;
+        }
+
+        /* Each prefix is looked up as path up to current name */
+        sep = *end;
+        *end = '\0';
+        hash = xxh64 ( parent_id, ( const uint8_t * ) name, name_len );
+
+        if ( !( node = scan_find_name ( context, hash, parent_id, name ) ) )
+        {
+            if ( scan_excluded ( context ) )
+            {
+                return 0;
+            }
+
+            if ( stat ( context->path, &statbuf ) < 0 )
+            {
+                /* Files removed since listed are skipped */
+                status = errno == ENOENT ? 0 : -1;
+                perror ( context->path );
+                return status;
+            }
+
+            if ( !( node = node_insert ( head ) ) )
+            {
+                return -1;
+            }
+
+            if ( !( node->name = ( char * ) malloc ( name_len + 1 ) ) )
+            {
+                return -1;
+            }
+
+            memcpy ( node->name, name, name_len + 1 );
+            node->entity.parent = parent_id;
+            node->entity.mode = statbuf.st_mode;
+            scan_file_state ( &statbuf, &node->ext );
+
+            if ( statbuf.st_mode & S_IFDIR )
+            {
+                node->entity.id = context->next_id++;
+
+            } else
+            {
+                node->entity.size = statbuf.st_size;
+#ifndef WIN32_BUILD
+                if ( scan_hard_link ( context, &statbuf, node ) < 0 )
+                {
+                    return -1;
+                }
+#endif
+            }
+
+            if ( scan_insert_name ( context, hash, node ) < 0 )
+            {
+                return -1;
+            }
+        }
+
+        *end = sep;
+
+        if ( !*rest )
+        {
+            break;
+        }
+
+        /* Listed paths may only go through directories */
+        if ( ~node->entity.mode & S_IFDIR )
+        {
+            errno = ENOTDIR;
+            perror ( context->path );
+            return -1;
+        }
+
+        parent_id = node->entity.id;
+        head = &node->sub;
+    }
+
+    return 0;
+}
+
+/**
+ * Build files tree from list files, listed directories are not scanned
+ */
+static int scan_files_list_in ( const char *files[], size_t nfiles, uint32_t options,
+    struct scan_context_t *context, struct node_t **root )
+{
+    int c;
+    int delim;
+    int status = 0;
+    size_t i;
+    size_t len;
+    FILE *file;
+
+    /* List entries are separated with newline or NUL character */
+    delim = options & OPTION_NULL ? '\0' : '\n';
+
+    for ( i = 0; i < nfiles && status >= 0; i++ )
+    {
+        if ( !strcmp ( files[i], "-" ) )
+        {
+            file = stdin;
+
+        } else if ( !( file = fopen ( files[i], "r" ) ) )
+        {
+            perror ( files[i] );
+            return -1;
+        }
+
+        for ( len = 0; status >= 0 && ( c = getc ( file ) ) != EOF; )
+        {
+            if ( c != delim )
+            {
+                if ( len + 1 >= sizeof ( context->path ) )
+                {
+                    errno = ENAMETOOLONG;
+                    perror ( files[i] );
+                    status = -1;
+                    break;
+                }
+
+                context->path[len++] = c;
+                continue;
+            }
+
+            context->path[len] = '\0';
+
+            if ( len )
+            {
+                status = scan_list_entry ( context, root );
+            }
+
+            len = 0;
+        }
+
+        /* Last entry may have no delimiter */
+        if ( status >= 0 && len )
+        {
+            context->path[len] = '\0';
+            status = scan_list_entry ( context, root );
+        }
+
+        if ( file != stdin )
+        {
+            fclose ( file );
+        }
+    }
+
+    return status;
 }
 
 /**
- * Scan files tree for archive building
+ * Scan files tree for archive building, excluded paths are pruned,
+ * files are read from list files instead if list option is set
  */
-int scan_files_tree ( const char *files[], size_t nfiles, struct node_t **root )
+int scan_files_tree ( const char *files[], size_t nfiles, uint32_t options,
+    struct filter_t *exclude, struct node_t **root )
 {
+    int status;
     struct scan_context_t context;
 
     /* Prepare scan context */
     context.next_id = 1;
+    context.inodes = NULL;
+    context.inodes_size = 0;
+    context.inodes_count = 0;
+    context.dirs = NULL;
+    context.exclude = exclude;
+    context.one_fs = options & OPTION_ONE_FS ? 1 : 0;
+    context.dev = 0;
+    context.names = NULL;
+    context.names_size = 0;
+    context.names_count = 0;
 
-    return scan_files_tree_in ( files, nfiles, &context, root );
+    if ( options & OPTION_LIST )
+    {
+        status = scan_files_list_in ( files, nfiles, options, &context, root );
+
+    } else
+    {
+        status = scan_files_tree_in ( files, nfiles, &context, root );
+    }
+
+    /* Free inode and name tables */
+    free ( context.inodes );
+    free ( context.names );
+
+    return status;
 }
 
 /**
@@ -9,16 +9,38 @@
  */
 int generic_ostream_open ( struct stream_base_context_t *context, int fd )
 {
-    context->fd = fd;
+    off_t size;
 
-    if ( ftruncate ( context->fd, sizeof ( struct header_t ) ) < 0 )
+    context->fd = fd;
+    context->crc32 = 0xffffffff;
+    context->length = 0;
+    context->checksum = CHECKSUM_CRC32;
+    context->map = NULL;
+    context->map_offset = 0;
+    context->map_size = 0;
+    context->pos = 0;
+    context->buffer = NULL;
+    context->buffer_len = 0;
+    context->buffer_offset = DIRECT_OFFSET_NONE;
+    context->direct_fd = -1;
+
+    if ( ( size = lseek ( context->fd, 0, SEEK_END ) ) < 0 )
     {
         return -1;
     }
 
-    if ( lseek ( context->fd, sizeof ( struct header_t ), SEEK_SET ) < 0 )
+    /* Reserve space for header, existing archive is appended */
+    if ( size < ( off_t ) sizeof ( struct header_t ) )
     {
-        return -1;
+        if ( ftruncate ( context->fd, sizeof ( struct header_t ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( lseek ( context->fd, sizeof ( struct header_t ), SEEK_SET ) < 0 )
+        {
+            return -1;
+        }
     }
 
     return 0;
@@ -30,13 +52,156 @@ int generic_ostream_open ( struct stream_base_context_t *context, int fd )
 int generic_istream_open ( struct stream_base_context_t *context, int fd )
 {
     context->fd = fd;
+    context->crc32 = 0xffffffff;
+    context->length = 0;
+    context->checksum = CHECKSUM_CRC32;
+    context->map = NULL;
+    context->map_offset = 0;
+    context->map_size = 0;
+    context->pos = 0;
+    context->buffer = NULL;
+    context->buffer_len = 0;
+    context->buffer_offset = DIRECT_OFFSET_NONE;
+    context->direct_fd = -1;
 
     if ( lseek ( context->fd, sizeof ( struct header_t ), SEEK_SET ) < 0 )
     {
         return -1;
     }
 
+    context->pos = sizeof ( struct header_t );
+
+    return 0;
+}
+
+/**
+ * Map archive file for reading, input stream keeps using reads if mapping fails
+ */
+void generic_map_input ( struct ar_istream *stream, int populate )
+{
+#ifndef WIN32_BUILD
+    void *map;
+    off_t offset;
+    struct stat st;
+    struct stream_base_context_t *context = stream->context;
+
+    if ( fstat ( context->fd, &st ) < 0 || !S_ISREG ( st.st_mode ) || !st.st_size
+        || ( uint64_t ) st.st_size != ( size_t ) st.st_size )
+    {
+        return;
+    }
+
+    if ( ( offset = lseek ( context->fd, 0, SEEK_CUR ) ) < 0 )
+    {
+        return;
+    }
+
+    /* Archive may be paged in at once if requested */
+    if ( ( map =
+            mmap ( NULL, st.st_size, PROT_READ, MAP_SHARED | ( populate ? MAP_POPULATE : 0 ),
+                context->fd, 0 ) ) == MAP_FAILED )
+    {
+        return;
+    }
+
+    madvise ( map, st.st_size, MADV_SEQUENTIAL );
+
+    context->map = ( const unsigned char * ) map;
+    context->map_size = st.st_size;
+    context->pos = offset;
+
+    /* Data is referenced in place if not decompressed */
+    if ( stream->read == generic_read )
+    {
+        stream->view = generic_view;
+    }
+#else
+    UNUSED ( stream );
+    UNUSED ( populate );
+#endif
+}
+
+#ifdef O_DIRECT
+/**
+ * Open archive file again with direct I/O and allocate aligned buffer
+ */
+static int generic_direct_open ( struct stream_base_context_t *context, int flags )
+{
+    char path[64];
+    struct stat st;
+
+    if ( fstat ( context->fd, &st ) < 0 || !S_ISREG ( st.st_mode ) )
+    {
+        return -1;
+    }
+
+    snprintf ( path, sizeof ( path ), "/proc/self/fd/%i", context->fd );
+
+    /* Filesystems without direct I/O support refuse the flag */
+    if ( ( context->direct_fd = open ( path, flags | O_DIRECT | O_BINARY ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( posix_memalign ( ( void ** ) &context->buffer, DIRECT_ALIGN, DIRECT_BUFFER ) )
+    {
+        close ( context->direct_fd );
+        context->direct_fd = -1;
+        context->buffer = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * Write archive data bypassing page cache through aligned buffer
+ */
+int generic_direct_output ( struct ar_ostream *stream )
+{
+#ifdef O_DIRECT
+    /* Data before stream position in first block is read back */
+    if ( generic_direct_open ( stream->context, O_RDWR ) < 0 )
+    {
+        return -1;
+    }
+
+    stream->copy = NULL;
+
+    return 0;
+#else
+    UNUSED ( stream );
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/**
+ * Read archive data bypassing page cache through aligned buffer
+ */
+int generic_direct_input ( struct ar_istream *stream )
+{
+#ifdef O_DIRECT
+    if ( generic_direct_open ( stream->context, O_RDONLY ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Buffer window is filled on first read */
+    stream->copy = NULL;
+
+    if ( stream->read == generic_read )
+    {
+        stream->view = generic_view;
+    }
+
     return 0;
+#else
+    UNUSED ( stream );
+    errno = ENOTSUP;
+    return -1;
+#endif
 }
 
 /**
@@ -50,6 +215,14 @@ static void header_hton ( const struct header_t *header, struct header_t *net_he
     net_header->nentity = htonl ( header->nentity );
     net_header->nameslen = htonl ( header->nameslen );
     net_header->crc32 = htonl ( header->crc32 );
+    net_header->flags = htonl ( header->flags );
+    net_header->meta_offset = hton64 ( header->meta_offset );
+    net_header->meta_size = hton64 ( header->meta_size );
+    net_header->meta_crc32 = htonl ( header->meta_crc32 );
+    net_header->checksum = htonl ( header->checksum );
+    net_header->nameslen_high = htonl ( header->nameslen_high );
+    net_header->inplace_offset = hton64 ( header->inplace_offset );
+    net_header->inplace_crc32 = htonl ( header->inplace_crc32 );
 }
 
 /**
@@ -63,6 +236,14 @@ static void header_ntoh ( const struct header_t *net_header, struct header_t *he
     header->nentity = ntohl ( net_header->nentity );
     header->nameslen = ntohl ( net_header->nameslen );
     header->crc32 = ntohl ( net_header->crc32 );
+    header->flags = ntohl ( net_header->flags );
+    header->meta_offset = ntoh64 ( net_header->meta_offset );
+    header->meta_size = ntoh64 ( net_header->meta_size );
+    header->meta_crc32 = ntohl ( net_header->meta_crc32 );
+    header->checksum = ntohl ( net_header->checksum );
+    header->nameslen_high = ntohl ( net_header->nameslen_high );
+    header->inplace_offset = ntoh64 ( net_header->inplace_offset );
+    header->inplace_crc32 = ntohl ( net_header->inplace_crc32 );
 }
 
 /** 
@@ -75,6 +256,11 @@ int generic_set_header ( struct ar_ostream *stream, const struct header_t *heade
 
     header_hton ( header, &net_header );
 
+    if ( generic_drain_output ( stream->context ) < 0 )
+    {
+        return -1;
+    }
+
     if ( ( offset_backup = lseek ( stream->context->fd, 0, SEEK_CUR ) ) < 0 )
     {
         return -1;
@@ -137,29 +323,195 @@ int generic_get_header ( struct ar_istream *stream, struct header_t *header )
  */
 int generic_write ( struct ar_ostream *stream, const void *data, size_t len )
 {
-    size_t ret;
+    stream->context->crc32 =
+        checksum_update ( stream->context->checksum, stream->context->crc32,
+        ( const unsigned char * ) data, len );
+    stream->context->length += len;
+
+    return generic_output ( stream->context, data, len );
+}
+
+/**
+ * Write stream output data, direct I/O output is gathered in aligned buffer
+ */
+int generic_output ( struct stream_base_context_t *context, const void *data, size_t len )
+{
+    size_t part;
+    off_t offset;
+    const unsigned char *ptr = ( const unsigned char * ) data;
+
+    if ( context->direct_fd < 0 )
+    {
+        return write ( context->fd, data, len ) == ( ssize_t ) len ? 0 : -1;
+    }
+
+    /* Buffer starts at aligned offset, stream data already in that block is read back */
+    if ( context->buffer_offset == DIRECT_OFFSET_NONE )
+    {
+        if ( ( offset = lseek ( context->fd, 0, SEEK_CUR ) ) < 0 )
+        {
+            return -1;
+        }
+
+        context->buffer_offset = offset & ~( ( off_t ) DIRECT_ALIGN - 1 );
+        context->buffer_len = offset - context->buffer_offset;
+
+        if ( context->buffer_len && read_at ( context->direct_fd, context->buffer,
+                DIRECT_ALIGN, context->buffer_offset ) < ( ssize_t ) context->buffer_len )
+        {
+            return -1;
+        }
+    }
+
+    for ( ; len; len -= part, ptr += part )
+    {
+        part = DIRECT_BUFFER - context->buffer_len;
+
+        if ( part > len )
+        {
+            part = len;
+        }
+
+        memcpy ( context->buffer + context->buffer_len, ptr, part );
+        context->buffer_len += part;
+
+        if ( context->buffer_len == DIRECT_BUFFER )
+        {
+            if ( write_at ( context->direct_fd, context->buffer, DIRECT_BUFFER,
+                    context->buffer_offset ) != DIRECT_BUFFER )
+            {
+                return -1;
+            }
+
+            context->buffer_offset += DIRECT_BUFFER;
+            context->buffer_len = 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Write out data gathered for direct I/O, file position follows written data
+ */
+int generic_drain_output ( struct stream_base_context_t *context )
+{
+    size_t aligned;
+    size_t tail;
+
+    if ( context->buffer_offset == DIRECT_OFFSET_NONE )
+    {
+        return 0;
+    }
 
-    stream->context->crc32 = crc32b ( stream->context->crc32, ( const unsigned char * ) data, len );
+    /* Partial last block goes through page cache */
+    aligned = context->buffer_len & ~( ( size_t ) DIRECT_ALIGN - 1 );
+    tail = context->buffer_len - aligned;
 
-    if ( ( ret = write ( stream->context->fd, data, len ) ) == ( size_t ) - 1 )
+    if ( aligned && write_at ( context->direct_fd, context->buffer, aligned,
+            context->buffer_offset ) != ( ssize_t ) aligned )
     {
         return -1;
     }
 
-    if ( ret != len )
+    if ( tail && write_at ( context->fd, context->buffer + aligned, tail,
+            context->buffer_offset + aligned ) != ( ssize_t ) tail )
+    {
+        return -1;
+    }
+
+    if ( lseek ( context->fd, context->buffer_offset + context->buffer_len, SEEK_SET ) < 0 )
     {
         return -1;
     }
 
+    context->buffer_offset = DIRECT_OFFSET_NONE;
+    context->buffer_len = 0;
+
     return 0;
 }
 
+/**
+ * Take input data at stream position from mapping or direct I/O buffer,
+ * buffer is refilled if needed, length is cut at end of archive
+ */
+static const unsigned char *generic_take ( struct stream_base_context_t *context, size_t *len )
+{
+    ssize_t ret;
+    uint64_t end;
+    uint64_t start;
+    size_t need = *len < DIRECT_BUFFER - DIRECT_ALIGN ? *len : DIRECT_BUFFER - DIRECT_ALIGN;
+
+    /* Buffer is read at aligned offset covering wanted data */
+    if ( context->buffer && ( context->pos < context->map_offset
+            || context->pos + need > context->map_offset + context->map_size ) )
+    {
+        start = context->pos & ~( ( uint64_t ) DIRECT_ALIGN - 1 );
+
+        if ( ( ret = read_at ( context->direct_fd, context->buffer, DIRECT_BUFFER, start ) ) < 0 )
+        {
+            return NULL;
+        }
+
+        context->map = context->buffer;
+        context->map_offset = start;
+        context->map_size = ret;
+    }
+
+    end = context->map_offset + context->map_size;
+
+    if ( context->pos >= end )
+    {
+        *len = 0;
+        return context->map;
+    }
+
+    if ( *len > end - context->pos )
+    {
+        *len = end - context->pos;
+    }
+
+    context->pos += *len;
+
+    return context->map + ( context->pos - *len - context->map_offset );
+}
+
 /**
  * Read data from input stream
  */
 int generic_read ( struct ar_istream *stream, void *data, size_t len )
 {
     size_t ret;
+    size_t part;
+    const unsigned char *src;
+    unsigned char *dst = ( unsigned char * ) data;
+    struct stream_base_context_t *context = stream->context;
+
+    /* Mapped or buffered data may come in several parts */
+    for ( ; ( context->map || context->buffer ) && len; len -= part, dst += part )
+    {
+        part = len;
+
+        if ( !( src = generic_take ( context, &part ) ) )
+        {
+            return -1;
+        }
+
+        if ( !part )
+        {
+            errno = ENODATA;
+            return -1;
+        }
+
+        memcpy ( dst, src, part );
+        context->crc32 = checksum_update ( context->checksum, context->crc32, dst, part );
+        context->length += part;
+    }
+
+    if ( context->map || context->buffer )
+    {
+        return 0;
+    }
 
     if ( ( ret = read ( stream->context->fd, data, len ) ) == ( size_t ) - 1 )
     {
@@ -171,20 +523,297 @@ int generic_read ( struct ar_istream *stream, void *data, size_t len )
         return -1;
     }
 
-    stream->context->crc32 = crc32b ( stream->context->crc32, ( unsigned char * ) data, len );
+    stream->context->crc32 =
+        checksum_update ( stream->context->checksum, stream->context->crc32,
+        ( unsigned char * ) data, len );
+    stream->context->length += len;
+
+    return 0;
+}
+
+#ifndef WIN32_BUILD
+/**
+ * Copy file data between descriptors in kernel, checksum is calculated
+ * over mapped input pages, data is written from mapping if not supported
+ */
+static int generic_copy ( struct stream_base_context_t *context, int in, int out, uint64_t len )
+{
+    int zero_copy = 1;
+    size_t skip;
+    size_t chunk;
+    size_t done;
+    ssize_t ret;
+    loff_t offset;
+    long page;
+    void *map;
+    struct stat st;
+
+    if ( ( offset = lseek ( in, 0, SEEK_CUR ) ) < 0 || fstat ( in, &st ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Mapping past end of file would fault on access */
+    if ( ( uint64_t ) st.st_size < ( uint64_t ) offset + len )
+    {
+        errno = ENODATA;
+        return -1;
+    }
+
+    page = sysconf ( _SC_PAGESIZE );
+
+    for ( ; len; len -= chunk )
+    {
+        chunk = len > COPY_WINDOW ? COPY_WINDOW : len;
+        skip = offset % page;
+
+        if ( ( map =
+                mmap ( NULL, skip + chunk, PROT_READ, MAP_SHARED, in,
+                    offset - skip ) ) == MAP_FAILED )
+        {
+            return -1;
+        }
+
+        context->crc32 =
+            checksum_update ( context->checksum, context->crc32,
+            ( const unsigned char * ) map + skip, chunk );
+        context->length += chunk;
+
+        for ( done = 0; done < chunk; done += ret )
+        {
+            if ( zero_copy )
+            {
+                ret = copy_file_range ( in, &offset, out, NULL, chunk - done, 0 );
+
+                /* Other filesystem or old kernel, fall back to plain write */
+                if ( ret < 0 && ( errno == EXDEV || errno == ENOSYS || errno == EINVAL
+                        || errno == EOPNOTSUPP ) )
+                {
+                    zero_copy = 0;
+                    ret = 0;
+                    continue;
+                }
+
+            } else if ( ( ret = write ( out, ( unsigned char * ) map + skip + done,
+                        chunk - done ) ) > 0 )
+            {
+                offset += ret;
+            }
+
+            if ( ret <= 0 )
+            {
+                if ( !ret )
+                {
+                    errno = ENODATA;
+                }
+
+                munmap ( map, skip + chunk );
+                return -1;
+            }
+        }
+
+        munmap ( map, skip + chunk );
+    }
+
+    /* Input position is advanced past copied data */
+    if ( lseek ( in, offset, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Copy file data into output stream
+ */
+int generic_copy_from ( struct ar_ostream *stream, int fd, uint64_t len )
+{
+    return generic_copy ( stream->context, fd, stream->context->fd, len );
+}
+
+/**
+ * Copy input stream data into file
+ */
+int generic_copy_to ( struct ar_istream *stream, int fd, uint64_t len )
+{
+    off_t offset;
+    struct stream_base_context_t *context = stream->context;
+
+    /* File position follows mapped reading position during copy */
+    if ( context->map && lseek ( context->fd, context->pos, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( generic_copy ( context, context->fd, fd, len ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( context->map )
+    {
+        if ( ( offset = lseek ( context->fd, 0, SEEK_CUR ) ) < 0 )
+        {
+            return -1;
+        }
+
+        context->pos = offset;
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * Reference input stream data in archive mapping
+ */
+int generic_view ( struct ar_istream *stream, const void **data, size_t len )
+{
+    size_t part = len;
+    struct stream_base_context_t *context = stream->context;
+
+    if ( !( *data = generic_take ( context, &part ) ) )
+    {
+        return -1;
+    }
+
+    if ( part < len )
+    {
+        errno = ENODATA;
+        return -1;
+    }
+
+    context->crc32 = checksum_update ( context->checksum, context->crc32, *data, len );
+    context->length += len;
 
     return 0;
 }
 
+/**
+ * Take input stream data, mapped data is referenced in place
+ */
+ssize_t generic_input ( struct stream_base_context_t *context, void *buf, size_t len,
+    const unsigned char **data )
+{
+    if ( !context->map && !context->buffer )
+    {
+        *data = ( const unsigned char * ) buf;
+        return read ( context->fd, buf, len );
+    }
+
+    if ( !( *data = generic_take ( context, &len ) ) )
+    {
+        return -1;
+    }
+
+    return len;
+}
+
 /*
  * Finalize output stream
  */
 int generic_flush ( struct ar_ostream *stream )
 {
-    UNUSED ( stream );
+    return generic_drain_output ( stream->context );
+}
+
+/*
+ * Begin new output stream segment at current position
+ */
+int generic_reset_output ( struct ar_ostream *stream )
+{
+    /* Segment offset is taken from file position */
+    if ( generic_drain_output ( stream->context ) < 0 )
+    {
+        return -1;
+    }
+
+    stream->context->crc32 = 0xffffffff;
+    stream->context->length = 0;
+
+    return 0;
+}
+
+/*
+ * Begin reading input stream segment at given offset
+ */
+int generic_reset_input ( struct ar_istream *stream, uint64_t offset )
+{
+    struct stream_base_context_t *context = stream->context;
+#ifndef WIN32_BUILD
+    uint64_t start;
+    uint64_t end;
+#endif
+
+    if ( context->buffer )
+    {
+        /* Buffer is refilled on read if offset is outside of it */
+        context->pos = offset;
+
+    } else if ( context->map )
+    {
+        if ( offset > context->map_size )
+        {
+            errno = ENODATA;
+            return -1;
+        }
+#ifndef WIN32_BUILD
+        /* Segment beginning is paged in ahead of reading */
+        start = offset & ~( ( uint64_t ) sysconf ( _SC_PAGESIZE ) - 1 );
+        end = context->map_size - offset > MAP_WINDOW ? offset + MAP_WINDOW : context->map_size;
+        madvise ( ( void * ) ( context->map + start ), end - start, MADV_WILLNEED );
+#endif
+        context->pos = offset;
+
+    } else if ( lseek ( context->fd, offset, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+
+    stream->context->crc32 = 0xffffffff;
+    stream->context->length = 0;
+
     return 0;
 }
 
+/*
+ * Calculate archive header checksum
+ */
+uint32_t header_crc32 ( const struct header_t *header )
+{
+    struct header_t net_header;
+
+    header_hton ( header, &net_header );
+
+    return ~checksum_update ( header->checksum, 0xffffffff, ( unsigned char * ) &net_header,
+        sizeof ( net_header ) );
+}
+
+/*
+ * Begin separate checksum of stream data part, return checksum so far
+ */
+uint32_t stream_split_crc32 ( struct stream_base_context_t *context )
+{
+    uint32_t crc32 = ~context->crc32;
+
+    context->crc32 = 0xffffffff;
+
+    return crc32;
+}
+
+/*
+ * Finish separate checksum of stream data part and merge it back
+ */
+uint32_t stream_merge_crc32 ( struct stream_base_context_t *context, uint32_t crc32, uint64_t len )
+{
+    uint32_t part = ~context->crc32;
+
+    context->crc32 = ~checksum_combine ( context->checksum, crc32, part, len );
+
+    return part;
+}
+
 /*
  * Set crc32 checksum for stream
  */
@@ -194,7 +823,8 @@ void generic_seed_crc32 ( struct ar_stream *stream, const struct header_t *heade
 
     header_hton ( header, &net_header );
     stream->context->crc32 =
-        crc32b ( 0xffffffff, ( unsigned char * ) &net_header, sizeof ( net_header ) );
+        checksum_update ( stream->context->checksum, 0xffffffff, ( unsigned char * ) &net_header,
+        sizeof ( net_header ) );
 }
 
 /*
@@ -212,6 +842,18 @@ void generic_close ( struct ar_stream *stream )
 {
     if ( stream )
     {
+#ifndef WIN32_BUILD
+        if ( stream->context->buffer )
+        {
+            generic_drain_output ( stream->context );
+            close ( stream->context->direct_fd );
+            free ( stream->context->buffer );
+
+        } else if ( stream->context->map )
+        {
+            munmap ( ( void * ) stream->context->map, stream->context->map_size );
+        }
+#endif
         free ( stream->context );
         free ( stream );
     }
@@ -239,7 +881,13 @@ struct ar_ostream *plain_ostream_open ( int fd )
 
     stream->set_header = generic_set_header;
     stream->write = generic_write;
+#ifndef WIN32_BUILD
+    stream->copy = generic_copy_from;
+#else
+    stream->copy = NULL;
+#endif
     stream->flush = generic_flush;
+    stream->reset = generic_reset_output;
     stream->seed_crc32 =
         ( void ( * )( struct ar_ostream *, const struct header_t * ) ) generic_seed_crc32;
     stream->finalize_crc32 = ( uint32_t ( * )( struct ar_ostream * ) ) generic_finalize_crc32;
@@ -276,6 +924,13 @@ struct ar_istream *plain_istream_open ( int fd )
 
     stream->get_header = generic_get_header;
     stream->read = generic_read;
+#ifndef WIN32_BUILD
+    stream->copy = generic_copy_to;
+#else
+    stream->copy = NULL;
+#endif
+    stream->view = NULL;
+    stream->reset = generic_reset_input;
     stream->seed_crc32 =
         ( void ( * )( struct ar_istream *, const struct header_t * ) ) generic_seed_crc32;
     stream->finalize_crc32 = ( uint32_t ( * )( struct ar_istream * ) ) generic_finalize_crc32;
@@ -4,261 +4,2216 @@
 
 #include "zbox.h"
 
+#define VERIFY_THREADS_MAX 16
+
 /**
- * Parse single entity from archive metadata
+ * Parallel archive verification context
  */
-static int unpack_parse_entity ( struct unpack_parse_context *context, struct node_t **head )
+struct verify_context_t
 {
-    struct node_t *node;
+    const char *archive;
+    uint32_t options;
+    const struct archive_meta_t *meta;
+    struct node_t **files;
+    uint32_t *first;
+    uint32_t next;
+    int failed;
+#ifndef WIN32_BUILD
+    pthread_mutex_t lock;
+#endif
+};
+
+/**
+ * Extract file stored as data records, only consume records if fd is negative
+ */
+static int zbox_extract_records ( struct unpack_context_t *context, const struct node_t *node,
+    int fd );
+
+/**
+ * Print byte range of file version stored in base archive
+ */
+static int zbox_print_base ( struct unpack_context_t *context, int fd, uint64_t offset,
+    uint64_t length );
+
+/**
+ * Unpack files from an archive, byte range of files is printed if needed
+ */
+static int zbox_unpack_archive_in ( const char *archive, uint32_t options,
+    struct filter_t *filter, uint64_t offset, uint64_t length, int out_fd );
 
-    if ( context->position >= context->count )
+/**
+ * Build extracted entity path
+ */
+static int zbox_entity_path ( const struct unpack_context_t *context, const struct node_t *node,
+    char *path, size_t path_size )
+{
+    /* Replaced file version is extracted as its first hard link */
+    if ( context->standin && node->entity.mode & ENTITY_SHADOWED
+        && context->standin[node->index] != ENTITY_INDEX_NONE )
     {
-        return 0;
+        node = context->node_table[context->standin[node->index]];
     }
 
-    if ( context->name_table >= context->name_limit )
+    if ( context->options & OPTION_NOPATHS )
     {
-        return -1;
+        path[0] = '\0';
+        return path_concat ( path, path_size, node->name );
     }
 
-    if ( !( node = node_append ( head ) ) )
+    return node_path ( node, path, path_size );
+}
+
+/**
+ * Read archive stream data, mapped uncompressed data is referenced in place
+ */
+static int zbox_read_data ( struct ar_istream *istream, unsigned char *buf, size_t len,
+    const unsigned char **data )
+{
+    if ( istream->view )
     {
-        return -1;
+        return istream->view ( istream, ( const void ** ) data, len );
     }
 
-    node->name = ( char * ) context->name_table;
-    context->name_table += strlen ( node->name ) + 1;
-    memcpy ( &node->entity, &context->entity_table[context->position], sizeof ( struct entity_t ) );
-    context->position++;
+    *data = buf;
 
-    if ( node->entity.mode & S_IFDIR )
+    return istream->read ( istream, buf, len );
+}
+
+/**
+ * Skip archive stream data
+ */
+static int zbox_skip_data ( struct unpack_context_t *context, uint64_t left )
+{
+    size_t len;
+    const unsigned char *data;
+
+    for ( ; left; left -= len )
     {
-        while ( context->entity_table[context->position].parent == node->entity.id )
+        len = left > context->workbuf_size ? context->workbuf_size : left;
+
+        if ( zbox_read_data ( context->istream, context->workbuf, len, &data ) < 0 )
         {
-            unpack_parse_entity ( context, &node->sub );
+            return -1;
         }
     }
 
-    if ( context->position < context->count && !node->entity.parent &&
-        !context->entity_table[context->position].parent )
+    return 0;
+}
+
+/**
+ * Copy archive stream data into file
+ */
+static int zbox_spool_data ( struct unpack_context_t *context, int fd, uint64_t left )
+{
+    size_t len;
+    const unsigned char *data;
+
+    for ( ; left; left -= len )
     {
-        return unpack_parse_entity ( context, &node->next );
+        len = left > context->workbuf_size ? context->workbuf_size : left;
+
+        if ( zbox_read_data ( context->istream, context->workbuf, len, &data ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( write ( fd, data, len ) != ( ssize_t ) len )
+        {
+            perror ( "write" );
+            return -1;
+        }
     }
 
     return 0;
 }
 
-/** 
- * Parse archive nodes into memory
+/**
+ * Rebuild referenced file in temporary file, its data is read with own archive stream
  */
-static int zbox_unpack_parse ( const struct header_t *header, const struct entity_t *entity_table,
-    const char *name_table, struct node_t **root )
+static int zbox_spool_source ( struct unpack_context_t *context, const struct node_t *source )
 {
-    const char *name_limit;
-    struct unpack_parse_context context;
+    int fd;
+    int archive_fd;
+    int status;
+    FILE *spool;
+    struct header_t header;
+    struct unpack_context_t sub;
+    const struct segment_t *segment;
+
+    /* Data location is known in segmented archives only */
+    if ( source->location.segment >= context->nsegment )
+    {
+        fprintf ( stderr, "%s: refers to data of another file\n", context->path );
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    segment = &context->segment_table[source->location.segment];
+
+    if ( ( archive_fd = open ( context->archive, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        perror ( context->archive );
+        return -1;
+    }
+
+    if ( !( spool = tmpfile (  ) ) )
+    {
+        perror ( "tmpfile" );
+        close ( archive_fd );
+        return -1;
+    }
 
-    /* At least one name required */
-    if ( !header->nameslen )
+    /* Work buffer is shared, it holds no data while chunk source is opened */
+    memcpy ( &sub, context, sizeof ( sub ) );
+    sub.ref_fd = -1;
+    sub.compare = 0;
+    sub.out_fd = -1;
+
+    if ( !( sub.istream =
+            zbox_archive_istream_open ( archive_fd, &header,
+                context->options & ~OPTION_POPULATE ) ) )
     {
+        fclose ( spool );
+        close ( archive_fd );
         return -1;
     }
 
-    name_limit = name_table + header->nameslen;
+    if ( ( status = sub.istream->reset ( sub.istream, segment->offset ) ) < 0 )
+    {
+        perror ( "lseek" );
+
+    } else if ( ( status = zbox_skip_data ( &sub, source->location.offset ) ) >= 0 )
+    {
+        if ( source->entity.mode & ENTITY_FRAMED )
+        {
+            status = zbox_extract_records ( &sub, source, fileno ( spool ) );
+
+        } else
+        {
+            status = zbox_spool_data ( &sub, fileno ( spool ), source->entity.size );
+        }
+    }
+
+    if ( sub.ref_fd >= 0 )
+    {
+        close ( sub.ref_fd );
+    }
 
-    /* Name table must ends with zero byte */
-    if ( name_limit[-1] != '\0' )
+    sub.istream->close ( sub.istream );
+    close ( archive_fd );
+
+    /* Temporary file lives as long as its descriptor */
+    if ( status < 0 || ( fd = dup ( fileno ( spool ) ) ) < 0 )
     {
+        fclose ( spool );
         return -1;
     }
 
-    /* Prepare parse context */
-    context.entity_table = entity_table;
-    context.name_table = name_table;
-    context.name_limit = name_limit;
-    context.count = header->nentity;
-    context.position = 0;
+    fclose ( spool );
 
-    /* Parse files tree */
-    return unpack_parse_entity ( &context, root );
+    return fd;
 }
 
 /**
- * Extract single archive iles
+ * Open source file of referenced chunk
  */
-static int zbox_extract_file ( struct unpack_context_t *context, struct entity_t *entity )
+static int zbox_ref_source ( struct unpack_context_t *context, const struct node_t *node, int fd,
+    const struct record_t *record, uint64_t written )
 {
-    int fd;
-    ssize_t len;
-    uint32_t left;
+    uint32_t index = record->entity;
+    char path[PATH_LIMIT];
+    const struct node_t *source;
 
-    /* Show only filename if list only mode selected */
-    if ( context->options & OPTION_LISTONLY && ~entity->mode & S_IFDIR )
+    /* Chunk may refer to already written part of current file */
+    if ( index == node->index || index == ENTITY_INDEX_NONE )
+    {
+        if ( record->offset + record->len > written )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        /* Printed data cannot be read back, file is rebuilt from archive then */
+        if ( context->out_fd < 0 )
+        {
+            return fd;
+        }
+
+        index = node->index;
+
+    } else if ( index >= context->nentity || !context->node_table[index]
+        || context->node_table[index]->entity.mode & ( S_IFDIR | ENTITY_LINK )
+        || record->offset + record->len > context->node_table[index]->entity.size )
+    {
+        /* Referenced entity is not valid */
+        errno = EINVAL;
+        return -1;
+    }
+
+    source = context->node_table[index];
+
+    /* Reuse recently opened source file */
+    if ( context->ref_fd >= 0 && context->ref_index == index )
+    {
+        return context->ref_fd;
+    }
+
+    if ( context->ref_fd >= 0 )
+    {
+        close ( context->ref_fd );
+        context->ref_fd = -1;
+    }
+
+    /* Source not extracted to disk or replaced there by another file is rebuilt from archive */
+    if ( context->options & OPTION_STDOUT || source->entity.mode & ENTITY_SHADOWED
+        || ( context->selected && !context->selected[index] )
+        || ( context->shared && context->shared[index] ) )
+    {
+        if ( ( context->ref_fd = zbox_spool_source ( context, source ) ) < 0 )
+        {
+            return -1;
+        }
+
+    } else
+    {
+        if ( zbox_entity_path ( context, source, path, sizeof ( path ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( ( context->ref_fd = open ( path, O_RDONLY | O_BINARY ) ) < 0 )
+        {
+            perror ( path );
+            return -1;
+        }
+    }
+
+    context->ref_index = index;
+
+    return context->ref_fd;
+}
+
+/**
+ * Write part of file data within requested byte range to output file
+ */
+static int zbox_write_range ( struct unpack_context_t *context, const unsigned char *data,
+    size_t len )
+{
+    size_t skip = 0;
+    ssize_t ret;
+    uint64_t pos = context->written;
+
+    context->written += len;
+
+    if ( pos < context->range_offset )
+    {
+        if ( context->range_offset - pos >= len )
+        {
+            return 0;
+        }
+
+        skip = context->range_offset - pos;
+        pos = context->range_offset;
+    }
+
+    if ( pos >= context->range_end )
     {
-        show_progress ( 'l', context->path );
         return 0;
     }
 
-    /* Create a directory if needed */
-    if ( entity->mode & S_IFDIR )
+    if ( len - skip > context->range_end - pos )
     {
-        if ( context->options & OPTION_TESTONLY )
+        len = skip + ( context->range_end - pos );
+    }
+
+    for ( data += skip, len -= skip; len; data += ret, len -= ret )
+    {
+        if ( ( ret = write ( context->out_fd, data, len ) ) < 0 )
+        {
+            perror ( "write" );
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Stop comparing with existing file content, rest of file is rewritten
+ */
+static int zbox_compare_end ( struct unpack_context_t *context, int fd )
+{
+    off_t offset;
+
+    if ( ( offset = lseek ( fd, 0, SEEK_CUR ) ) < 0 || ftruncate ( fd, offset ) < 0 )
+    {
+        perror ( context->path );
+        return -1;
+    }
+
+    context->compare = 0;
+
+    return 0;
+}
+
+/**
+ * Write extracted file data, data already present in file is skipped if needed
+ */
+static int zbox_write_data ( struct unpack_context_t *context, int fd, const void *data,
+    size_t len )
+{
+    off_t offset;
+
+    /* Existing file content is compared until first difference */
+    if ( context->compare )
+    {
+        if ( ( offset = lseek ( fd, 0, SEEK_CUR ) ) < 0 )
+        {
+            perror ( context->path );
+            return -1;
+        }
+
+        if ( read_at ( fd, context->cmpbuf, len, offset ) == ( ssize_t ) len
+            && !memcmp ( context->cmpbuf, data, len ) )
         {
+            if ( lseek ( fd, len, SEEK_CUR ) < 0 )
+            {
+                perror ( context->path );
+                return -1;
+            }
+
             return 0;
         }
-#ifndef WIN32_BUILD
-        if ( mkdir ( context->path, entity->mode & ( ~S_IFMT ) ) < 0 && errno != EEXIST )
+
+        if ( zbox_compare_end ( context, fd ) < 0 )
         {
             return -1;
         }
-#else
-        if ( mkdir ( context->path ) < 0 && errno != EEXIST )
+    }
+
+    if ( write ( fd, data, len ) < 0 )
+    {
+        perror ( "write" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Skip over file hole, existing file content must be zero there
+ */
+static int zbox_write_hole ( struct unpack_context_t *context, int fd, uint64_t len )
+{
+    size_t chunk;
+    off_t offset;
+    uint64_t left;
+
+    if ( context->compare )
+    {
+        if ( ( offset = lseek ( fd, 0, SEEK_CUR ) ) < 0 )
         {
+            perror ( context->path );
             return -1;
         }
-#endif
 
-        return 0;
+        for ( left = len; left; left -= chunk, offset += chunk )
+        {
+            chunk = left > context->workbuf_size ? context->workbuf_size : left;
+
+            if ( read_at ( fd, context->cmpbuf, chunk, offset ) != ( ssize_t ) chunk
+                || !is_zero_block ( context->cmpbuf, chunk ) )
+            {
+                if ( zbox_compare_end ( context, fd ) < 0 )
+                {
+                    return -1;
+                }
+
+                break;
+            }
+        }
+    }
+
+    /* Hole is allocated on truncate */
+    if ( lseek ( fd, len, SEEK_CUR ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Skip printed file part out of requested byte range, it is only counted
+ */
+static int zbox_print_skip ( struct unpack_context_t *context, uint64_t len )
+{
+    if ( context->out_fd < 0 || ( context->written < context->range_end
+            && context->written + len > context->range_offset ) )
+    {
+        return 0;
+    }
+
+    context->written += len;
+
+    return 1;
+}
+
+/**
+ * Print zeros of file hole within requested byte range
+ */
+static int zbox_print_hole ( struct unpack_context_t *context, uint64_t len )
+{
+    size_t chunk;
+
+    if ( zbox_print_skip ( context, len ) )
+    {
+        return 0;
+    }
+
+    /* Hole part before byte range is only counted */
+    if ( context->written < context->range_offset )
+    {
+        len -= context->range_offset - context->written;
+        context->written = context->range_offset;
+    }
+
+    memset ( context->workbuf, '\0',
+        len > context->workbuf_size ? context->workbuf_size : len );
+
+    for ( ; len && context->written < context->range_end; len -= chunk )
+    {
+        chunk = len > context->workbuf_size ? context->workbuf_size : len;
+
+        if ( zbox_write_range ( context, context->workbuf, chunk ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    context->written += len;
+
+    return 0;
+}
+
+/**
+ * Write rebuilt file data to file or within printed byte range
+ */
+static int zbox_output_data ( struct unpack_context_t *context, int fd, const void *data,
+    size_t len )
+{
+    if ( context->out_fd >= 0 )
+    {
+        return zbox_write_range ( context, ( const unsigned char * ) data, len );
+    }
+
+    return zbox_write_data ( context, fd, data, len );
+}
+
+/**
+ * Extract file stored as data records, only consume records if fd is negative
+ */
+static int zbox_extract_records ( struct unpack_context_t *context, const struct node_t *node,
+    int fd )
+{
+    int src;
+    size_t len;
+    uint32_t remaining;
+    uint64_t left;
+    uint64_t offset;
+    uint64_t hash;
+    const unsigned char *data;
+    struct record_t record;
+
+    for ( left = node->entity.size; left; left -= record.len )
+    {
+        /* Read next record header */
+        if ( context->istream->read ( context->istream, &record, sizeof ( record ) ) < 0 )
+        {
+            return -1;
+        }
+
+        record.type = ntohl ( record.type );
+        record.len = ntohl ( record.len );
+        record.entity = ntohl ( record.entity );
+        record.offset = ntoh64 ( record.offset );
+
+        if ( !record.len || record.len > left )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( record.type == RECORD_DATA )
+        {
+            /* Copy stored chunk data */
+            for ( remaining = record.len; remaining; remaining -= len )
+            {
+                len = remaining > context->workbuf_size ? context->workbuf_size : remaining;
+
+                if ( zbox_read_data ( context->istream, context->workbuf, len, &data ) < 0 )
+                {
+                    return -1;
+                }
+
+                if ( fd >= 0 && zbox_output_data ( context, fd, data, len ) < 0 )
+                {
+                    return -1;
+                }
+            }
+
+        } else if ( record.type == RECORD_REF_HASH )
+        {
+            /* Chunk hash is stored after record header, whole chunk fits in work buffer */
+            if ( record.len > context->workbuf_size
+                || context->istream->read ( context->istream, &hash, sizeof ( hash ) ) < 0 )
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            /* Chunk out of printed byte range is not read */
+            if ( fd < 0 || zbox_print_skip ( context, record.len ) )
+            {
+                continue;
+            }
+
+            /* Copy chunk from already extracted file */
+            if ( ( src =
+                    zbox_ref_source ( context, node, fd, &record,
+                        node->entity.size - left ) ) < 0 )
+            {
+                return -1;
+            }
+
+            if ( read_at ( src, context->workbuf, record.len,
+                    record.offset ) != ( ssize_t ) record.len )
+            {
+                errno = ENODATA;
+                return -1;
+            }
+
+            if ( xxh64 ( 0, context->workbuf, record.len ) != ntoh64 ( hash ) )
+            {
+                fprintf ( stderr, "%s: referenced chunk checksum: bad\n", context->path );
+                errno = EINVAL;
+                return -1;
+            }
+
+            if ( zbox_output_data ( context, fd, context->workbuf, record.len ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( record.type == RECORD_BASE )
+        {
+            if ( fd < 0 || zbox_print_skip ( context, record.len ) )
+            {
+                continue;
+            }
+
+            /* Copy data from file version extracted from base archive */
+            if ( context->base_fd < 0 )
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            for ( remaining = record.len, offset = record.offset; remaining;
+                remaining -= len, offset += len )
+            {
+                len = remaining > context->workbuf_size ? context->workbuf_size : remaining;
+
+                if ( read_at ( context->base_fd, context->workbuf, len,
+                        offset ) != ( ssize_t ) len )
+                {
+                    errno = ENODATA;
+                    return -1;
+                }
+
+                if ( zbox_output_data ( context, fd, context->workbuf, len ) < 0 )
+                {
+                    return -1;
+                }
+            }
+
+        } else if ( record.type == RECORD_HOLE )
+        {
+            /* Skip over file hole */
+            if ( fd >= 0 && ( context->out_fd >= 0 ? zbox_print_hole ( context, record.len )
+                    : zbox_write_hole ( context, fd, record.len ) ) < 0 )
+            {
+                return -1;
+            }
+
+        } else
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    /* Extend file if it ends with a hole, unchanged file has its size already */
+    if ( fd >= 0 && context->out_fd < 0 && !context->compare
+        && ftruncate ( fd, node->entity.size ) < 0 )
+    {
+        perror ( "ftruncate" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Check if existing file may be compared with extracted content
+ */
+static int zbox_compare_target ( const struct unpack_context_t *context,
+    const struct entity_t *entity )
+{
+    struct stat statbuf;
+
+    if ( stat ( context->path, &statbuf ) < 0 || !S_ISREG ( statbuf.st_mode )
+        || ( uint64_t ) statbuf.st_size != entity->size )
+    {
+        return 0;
+    }
+
+    /* File extracted from base archive may be hard linked, it is replaced */
+    return !context->replace || statbuf.st_nlink < 2;
+}
+
+/**
+ * Check if file stored alone in segment is unchanged on disk, its
+ * content must match segment checksum
+ */
+static int zbox_segment_unchanged ( struct unpack_context_t *context,
+    const struct segment_t *segment, const struct node_t *node )
+{
+    int fd;
+    ssize_t len;
+    uint32_t crc32 = 0xffffffff;
+    struct stat statbuf;
+
+    if ( ~context->options & OPTION_COMPARE || context->options & OPTION_TESTONLY
+        || node->entity.mode & ENTITY_FRAMED || node->location.offset
+        || node->location.size != segment->rawsize
+        || stat ( context->path, &statbuf ) < 0 || !S_ISREG ( statbuf.st_mode )
+        || ( uint64_t ) statbuf.st_size != node->entity.size )
+    {
+        return 0;
+    }
+
+    if ( ( fd = open ( context->path, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        return 0;
+    }
+
+    while ( ( len = read ( fd, context->workbuf, context->workbuf_size ) ) > 0 )
+    {
+        crc32 =
+            checksum_update ( context->istream->context->checksum, crc32, context->workbuf, len );
+    }
+
+    close ( fd );
+
+    return !len && ~crc32 == segment->crc32;
+}
+
+/**
+ * Print file stored as data records, records are written out as they are read
+ */
+static int zbox_print_framed ( struct unpack_context_t *context, const struct node_t *node )
+{
+    int status;
+    FILE *spool;
+
+    if ( ~node->entity.mode & ENTITY_DELTA )
+    {
+        return zbox_extract_records ( context, node, context->out_fd );
+    }
+
+    /* Delta is applied to file version rebuilt from base archive */
+    if ( !( spool = tmpfile (  ) ) )
+    {
+        perror ( "tmpfile" );
+        return -1;
+    }
+
+    if ( zbox_print_base ( context, fileno ( spool ), 0, ( uint64_t ) - 1 ) < 0 )
+    {
+        fclose ( spool );
+        return -1;
+    }
+
+    context->base_fd = fileno ( spool );
+    status = zbox_extract_records ( context, node, context->out_fd );
+    context->base_fd = -1;
+    fclose ( spool );
+
+    return status;
+}
+
+/**
+ * Print archive file data to standard output
+ */
+static int zbox_print_file ( struct unpack_context_t *context, const struct node_t *node )
+{
+    size_t len;
+    uint64_t left;
+    const unsigned char *data;
+    const struct entity_t *entity = &node->entity;
+
+    /* Hard link target is printed instead */
+    if ( entity->mode & ( S_IFDIR | ENTITY_LINK ) )
+    {
+        return 0;
+    }
+
+    /* Unchanged file is printed from base archive */
+    if ( entity->mode & ENTITY_BASE )
+    {
+        return zbox_print_base ( context, context->out_fd, context->range_offset,
+            context->range_end - context->range_offset );
+    }
+
+    context->written = 0;
+
+    /* File stored as data records is rebuilt while printed */
+    if ( entity->mode & ENTITY_FRAMED )
+    {
+        return zbox_print_framed ( context, node );
+    }
+
+    for ( left = entity->size; left; left -= len )
+    {
+        len = left > context->workbuf_size ? context->workbuf_size : left;
+
+        if ( zbox_read_data ( context->istream, context->workbuf, len, &data ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( zbox_write_range ( context, data, len ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Extract single archive iles
+ */
+static int zbox_extract_file ( struct unpack_context_t *context, const struct node_t *node )
+{
+    int fd;
+    ssize_t len;
+    uint64_t left;
+    const unsigned char *data;
+    const struct entity_t *entity = &node->entity;
+
+    /* Data of files not selected and of replaced file versions
+       not kept by hard links is only consumed from stream */
+    if ( ( context->selected && !context->selected[node->index] )
+        || ( entity->mode & ENTITY_SHADOWED && ( !context->standin
+                || context->standin[node->index] == ENTITY_INDEX_NONE ) ) )
+    {
+        if ( context->options & OPTION_LISTONLY
+            || entity->mode & ( S_IFDIR | ENTITY_LINK | ENTITY_BASE ) )
+        {
+            return 0;
+        }
+
+        if ( entity->mode & ENTITY_FRAMED )
+        {
+            return zbox_extract_records ( context, node, -1 );
+        }
+
+        return zbox_skip_data ( context, entity->size );
+    }
+
+    /* File content is written to standard output only */
+    if ( context->options & OPTION_STDOUT )
+    {
+        return zbox_print_file ( context, node );
+    }
+
+    /* Show only filename if list only mode selected */
+    if ( context->options & OPTION_LISTONLY && ~entity->mode & S_IFDIR )
+    {
+        show_progress ( 'l', context->path );
+        return 0;
+    }
+
+    /* Create a directory if needed */
+    if ( entity->mode & S_IFDIR )
+    {
+        if ( context->options & OPTION_TESTONLY )
+        {
+            return 0;
+        }
+#ifndef WIN32_BUILD
+        if ( mkdir ( context->path, entity->mode & ENTITY_PERM ) < 0 && errno != EEXIST )
+        {
+            return -1;
+        }
+#else
+        if ( mkdir ( context->path ) < 0 && errno != EEXIST )
+        {
+            return -1;
+        }
+#endif
+
+        return 0;
+    }
+
+    /* Hard links are created after all files are extracted,
+       files stored in base archive are already extracted */
+    if ( entity->mode & ( ENTITY_LINK | ENTITY_BASE ) )
+    {
+        return 0;
+    }
+
+    /* Set needed data length */
+    left = entity->size;
+
+    /* Update archive checksum only if needed */
+    if ( context->options & OPTION_TESTONLY )
+    {
+        if ( entity->mode & ENTITY_FRAMED )
+        {
+            if ( zbox_extract_records ( context, node, -1 ) < 0 )
+            {
+                return -1;
+            }
+
+            left = 0;
+        }
+
+        while ( ( len = left > context->workbuf_size ? context->workbuf_size : left ) > 0 )
+        {
+            if ( zbox_read_data ( context->istream, context->workbuf, len, &data ) < 0 )
+            {
+                return -1;
+            }
+
+            left -= len;
+        }
+
+        if ( context->options & OPTION_VERBOSE )
+        {
+            show_progress ( 't', context->path );
+        }
+
+        return 0;
+    }
+
+    /* Existing file of the same size is compared before being rewritten */
+    context->compare = context->options & OPTION_COMPARE && ~entity->mode & ENTITY_DELTA
+        && zbox_compare_target ( context, entity );
+
+    /* Delta is applied to file version extracted from base archive */
+    if ( entity->mode & ENTITY_DELTA )
+    {
+        if ( !context->replace )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( ( context->base_fd = open ( context->path, O_RDONLY | O_BINARY ) ) < 0 )
+        {
+            perror ( context->path );
+            return -1;
+        }
+    }
+
+    /* File extracted from base archive may be hard linked */
+    if ( context->replace && !context->compare && unlink ( context->path ) < 0
+        && errno != ENOENT )
+    {
+        perror ( context->path );
+        return -1;
+    }
+
+    /* Open input file for reading */
+    if ( ( fd =
+            open ( context->path,
+                ( context->compare ? 0 : O_CREAT | O_TRUNC ) | ( entity->mode & ENTITY_FRAMED
+                    || context->compare ? O_RDWR : O_WRONLY ) | O_BINARY,
+                entity->mode & ENTITY_PERM ) ) < 0 )
+    {
+        perror ( context->path );
+        return -1;
+    }
+
+    /* Rebuild file content from data records if needed */
+    if ( entity->mode & ENTITY_FRAMED )
+    {
+        if ( zbox_extract_records ( context, node, fd ) < 0 )
+        {
+            close ( fd );
+            return -1;
+        }
+
+        if ( context->base_fd >= 0 )
+        {
+            close ( context->base_fd );
+            context->base_fd = -1;
+        }
+
+        left = 0;
+    }
+
+    /* Large file is copied from uncompressed archive in kernel */
+    if ( context->istream->copy && !context->compare && left >= COPY_MIN_SIZE )
+    {
+        if ( context->istream->copy ( context->istream, fd, left ) < 0 )
+        {
+            perror ( context->path );
+            close ( fd );
+            return -1;
+        }
+
+        left = 0;
+    }
+
+    /* Store file content into archive */
+    while ( ( len = left > context->workbuf_size ? context->workbuf_size : left ) > 0 )
+    {
+        if ( zbox_read_data ( context->istream, context->workbuf, len, &data ) < 0 )
+        {
+            close ( fd );
+            return -1;
+        }
+
+        if ( zbox_write_data ( context, fd, data, len ) < 0 )
+        {
+            close ( fd );
+            return -1;
+        }
+
+        left -= len;
+    }
+
+    /* Close file fd */
+    close ( fd );
+
+    /* All bytes must have been written to file */
+    if ( left )
+    {
+        errno = ENODATA;
+        return -1;
+    }
+
+    /* Files found unchanged on disk are shown separately */
+    if ( context->options & OPTION_VERBOSE )
+    {
+        show_progress ( context->compare ? '=' : context->options & OPTION_NOPATHS ? 'e' : 'x',
+            context->path );
+    }
+
+    return 0;
+}
+
+/**
+ * Check if file path is forbidden
+ */
+static int check_forbidden ( const char *path )
+{
+    return !path[0] || strchr ( path, '/' ) || strchr ( path, '\\' ) || !strcmp ( path, ".." );
+}
+
+/** 
+ * Manage archive extract process
+ */
+static int zbox_extract_next ( struct unpack_context_t *context, struct node_t *node )
+{
+    size_t path_len = 0;
+
+    if ( !node )
+    {
+        return 0;
+    }
+
+    if ( check_forbidden ( node->name ) )
+    {
+        errno = EINVAL;
+        perror ( node->name );
+        return -1;
+    }
+
+    if ( ~context->options & OPTION_NOPATHS || ~node->entity.mode & S_IFDIR )
+    {
+        path_len = strlen ( context->path );
+
+        if ( path_concat ( context->path, sizeof ( context->path ), node->name ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Printed files stored in base archive have no data in segments */
+        if ( ( !context->dirs_only || node->entity.mode & S_IFDIR
+                || ( context->out_fd >= 0 && node->entity.mode & ENTITY_BASE ) )
+            && zbox_extract_file ( context, node ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    if ( zbox_extract_next ( context, node->sub ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( ~context->options & OPTION_NOPATHS || ~node->entity.mode & S_IFDIR )
+    {
+        context->path[path_len] = '\0';
+    }
+
+    return zbox_extract_next ( context, node->next );
+}
+
+/**
+ * Mark archive entities selected by filter, directories are
+ * also selected if any of their entries is selected
+ */
+static int zbox_select_next ( struct unpack_context_t *context, const struct node_t *node,
+    int included )
+{
+    int match;
+    int status;
+    int found = 0;
+    int selected;
+    size_t path_len;
+
+    for ( ; node; node = node->next )
+    {
+        /* Only the latest version of a file is selected by its path */
+        if ( node->entity.mode & ENTITY_SHADOWED )
+        {
+            continue;
+        }
+
+        path_len = strlen ( context->path );
+
+        if ( path_concat ( context->path, sizeof ( context->path ), node->name ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Excluded entity is skipped with its contents */
+        if ( ( match = filter_match ( context->filter, context->path ) ) != FILTER_EXCLUDE )
+        {
+            /* Only files are printed */
+            if ( context->options & OPTION_STDOUT && match == FILTER_INCLUDE
+                && node->entity.mode & S_IFDIR )
+            {
+                errno = EISDIR;
+                perror ( context->path );
+                return -1;
+            }
+
+            selected = included || match == FILTER_INCLUDE || !context->filter->ninclude;
+
+            if ( ( status = zbox_select_next ( context, node->sub, selected ) ) < 0 )
+            {
+                return -1;
+            }
+
+            if ( selected || status )
+            {
+                context->selected[node->index] = 1;
+                found = 1;
+            }
+        }
+
+        context->path[path_len] = '\0';
+    }
+
+    return found;
+}
+
+/**
+ * Select archive entities matching filter, hard link targets are
+ * selected too if files are extracted
+ */
+static int zbox_select ( struct unpack_context_t *context, const struct node_t *root )
+{
+    uint32_t i;
+    const struct node_t *node;
+
+    if ( !( context->selected = ( uint8_t * ) calloc ( context->nentity, sizeof ( uint8_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    if ( zbox_select_next ( context, root, 0 ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Listed or tested links do not need their targets */
+    if ( context->options & ( OPTION_LISTONLY | OPTION_TESTONLY ) )
+    {
+        return 0;
+    }
+
+    for ( i = 0; i < context->nentity; i++ )
+    {
+        if ( !( node = context->node_table[i] ) || !context->selected[i]
+            || ~node->entity.mode & ENTITY_LINK
+            || node->entity.size >= context->nentity )
+        {
+            continue;
+        }
+
+        for ( node = context->node_table[node->entity.size]; node
+            && !context->selected[node->index]; node = node->parent )
+        {
+            context->selected[node->index] = 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Compare archive files by their names
+ */
+static int zbox_name_compare ( const void *a, const void *b )
+{
+    return strcmp ( ( *( const struct node_t ** ) a )->name,
+        ( *( const struct node_t ** ) b )->name );
+}
+
+/**
+ * Mark files extracted without paths under the same name, data
+ * they share with other files is not read back from disk
+ */
+static int zbox_mark_shared ( struct unpack_context_t *context )
+{
+    uint32_t i;
+    uint32_t count;
+    struct node_t *node;
+    struct node_t **files;
+
+    if ( !( context->shared = ( uint8_t * ) calloc ( context->nentity, sizeof ( uint8_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    if ( !( files =
+            ( struct node_t ** ) malloc ( context->nentity * sizeof ( struct node_t * ) ) ) )
+    {
+        perror ( "malloc" );
+        return -1;
+    }
+
+    for ( i = 0, count = 0; i < context->nentity; i++ )
+    {
+        if ( ( node = context->node_table[i] )
+            && !( node->entity.mode & ( S_IFDIR | ENTITY_LINK ) ) )
+        {
+            files[count++] = node;
+        }
+    }
+
+    qsort ( files, count, sizeof ( struct node_t * ), zbox_name_compare );
+
+    for ( i = 1; i < count; i++ )
+    {
+        if ( !strcmp ( files[i - 1]->name, files[i]->name ) )
+        {
+            context->shared[files[i - 1]->index] = 1;
+            context->shared[files[i]->index] = 1;
+        }
+    }
+
+    free ( files );
+
+    return 0;
+}
+
+/**
+ * Find first hard link to each replaced file version, the version
+ * is extracted in its place so other links may refer to it
+ */
+static int zbox_find_standins ( struct unpack_context_t *context )
+{
+    uint32_t i;
+    const struct node_t *node;
+    const struct node_t *source;
+
+    for ( i = 0; i < context->nentity; i++ )
+    {
+        if ( !( node = context->node_table[i] ) || ~node->entity.mode & ENTITY_LINK
+            || node->entity.mode & ENTITY_SHADOWED
+            || ( context->selected && !context->selected[i] )
+            || node->entity.size >= context->nentity
+            || !( source = context->node_table[node->entity.size] )
+            || ~source->entity.mode & ENTITY_SHADOWED )
+        {
+            continue;
+        }
+
+        if ( !context->standin )
+        {
+            if ( !( context->standin =
+                    ( uint32_t * ) malloc ( context->nentity * sizeof ( uint32_t ) ) ) )
+            {
+                perror ( "malloc" );
+                return -1;
+            }
+
+            memset ( context->standin, 0xff, context->nentity * sizeof ( uint32_t ) );
+        }
+
+        if ( context->standin[source->index] == ENTITY_INDEX_NONE )
+        {
+            context->standin[source->index] = i;
+        }
+    }
+
+    return 0;
+}
+
+/** 
+ * Create hard links to already extracted files
+ */
+static int zbox_extract_links ( struct unpack_context_t *context )
+{
+    uint32_t i;
+    char target[PATH_LIMIT];
+    const struct node_t *node;
+    const struct node_t *source;
+#ifndef WIN32_BUILD
+    struct stat path_stat;
+    struct stat target_stat;
+#endif
+
+    for ( i = 0; i < context->nentity; i++ )
+    {
+        if ( !( node = context->node_table[i] ) || ~node->entity.mode & ENTITY_LINK
+            || node->entity.mode & ENTITY_SHADOWED
+            || ( context->selected && !context->selected[i] ) )
+        {
+            continue;
+        }
+
+        /* Validate link target entity */
+        if ( node->entity.size >= context->nentity
+            || !( source = context->node_table[node->entity.size] )
+            || source->entity.mode & ( S_IFDIR | ENTITY_LINK ) )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( zbox_entity_path ( context, node, context->path, sizeof ( context->path ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( zbox_entity_path ( context, source, target, sizeof ( target ) ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Both paths may be the same when paths are not extracted */
+        if ( !strcmp ( target, context->path ) )
+        {
+            continue;
+        }
+#ifndef WIN32_BUILD
+        /* Link already in place is kept if unchanged files are skipped */
+        if ( context->options & OPTION_COMPARE && stat ( context->path, &path_stat ) >= 0
+            && stat ( target, &target_stat ) >= 0 && path_stat.st_dev == target_stat.st_dev
+            && path_stat.st_ino == target_stat.st_ino )
+        {
+            if ( context->options & OPTION_VERBOSE )
+            {
+                show_progress ( '=', context->path );
+            }
+            continue;
+        }
+#endif
+
+        /* Replace existing file with a link */
+        if ( unlink ( context->path ) < 0 && errno != ENOENT )
+        {
+            perror ( context->path );
+            return -1;
+        }
+#ifndef WIN32_BUILD
+        if ( link ( target, context->path ) < 0 )
+        {
+            perror ( context->path );
+            return -1;
+        }
+#else
+        if ( !CreateHardLinkA ( context->path, target, NULL ) )
+        {
+            errno = EACCES;
+            perror ( context->path );
+            return -1;
+        }
+#endif
+
+        if ( context->options & OPTION_VERBOSE )
+        {
+            show_progress ( context->options & OPTION_NOPATHS ? 'e' : 'x', context->path );
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Compare archive files by their data location
+ */
+static int zbox_location_compare ( const void *a, const void *b )
+{
+    const struct location_t *la = &( *( const struct node_t ** ) a )->location;
+    const struct location_t *lb = &( *( const struct node_t ** ) b )->location;
+
+    if ( la->segment != lb->segment )
+    {
+        return la->segment < lb->segment ? -1 : 1;
+    }
+
+    if ( la->offset != lb->offset )
+    {
+        return la->offset < lb->offset ? -1 : 1;
+    }
+
+    /* Empty files share offset with the following file */
+    return la->size < lb->size ? -1 : la->size > lb->size;
+}
+
+/**
+ * Print byte range of file stored without compression, data is read at its offset
+ */
+static int zbox_print_range ( struct unpack_context_t *context, const struct segment_t *segment,
+    const struct node_t *node )
+{
+    size_t len;
+    uint64_t left;
+    uint64_t end;
+    const unsigned char *data;
+
+    if ( context->range_offset >= node->entity.size )
+    {
+        return 0;
+    }
+
+    end = context->range_end < node->entity.size ? context->range_end : node->entity.size;
+
+    if ( context->istream->reset ( context->istream,
+            segment->offset + node->location.offset + context->range_offset ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    context->written = context->range_offset;
+
+    for ( left = end - context->range_offset; left; left -= len )
+    {
+        len = left > context->workbuf_size ? context->workbuf_size : left;
+
+        if ( zbox_read_data ( context->istream, context->workbuf, len, &data ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( zbox_write_range ( context, data, len ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Extract files of single archive data segment
+ */
+static int zbox_extract_segment ( struct unpack_context_t *context,
+    const struct segment_t *segment, struct node_t **files, uint32_t count )
+{
+    uint32_t i;
+    uint32_t crc32 = 0;
+    struct node_t *node;
+
+    /* Segment without selected files is not read at all */
+    if ( context->selected )
+    {
+        for ( i = 0; i < count && !context->selected[files[i]->index]; i++ );
+
+        if ( i == count )
+        {
+            return 0;
+        }
+    }
+
+    /* File unchanged on disk does not need its segment decompressed */
+    if ( count == 1 )
+    {
+        if ( zbox_entity_path ( context, files[0], context->path, sizeof ( context->path ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( zbox_segment_unchanged ( context, segment, files[0] ) )
+        {
+            if ( context->options & OPTION_VERBOSE )
+            {
+                show_progress ( '=', context->path );
+            }
+
+            return 0;
+        }
+    }
+
+    /* Start reading segment data stream */
+    if ( context->istream->reset ( context->istream, segment->offset ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        node = files[i];
+
+        /* Data of files not selected is skipped as a gap */
+        if ( context->selected && !context->selected[node->index] )
+        {
+            continue;
+        }
+
+        /* Data of files must not overlap */
+        if ( node->location.offset < context->istream->context->length )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        /* Gap is seeked over if files have own checksums and data is not compressed */
+        if ( context->file_crc32 && context->seekable
+            && node->location.offset > context->istream->context->length )
+        {
+            if ( context->istream->reset ( context->istream,
+                    segment->offset + node->location.offset ) < 0 )
+            {
+                perror ( "lseek" );
+                return -1;
+            }
+
+            context->istream->context->length = node->location.offset;
+
+        } else if ( zbox_skip_data ( context,
+                node->location.offset - context->istream->context->length ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( zbox_entity_path ( context, node, context->path, sizeof ( context->path ) ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Byte range of stored file is read in place, it cannot be verified */
+        if ( context->options & OPTION_STDOUT && context->seekable
+            && !( node->entity.mode & ( ENTITY_FRAMED | ENTITY_LINK ) ) && ( context->range_offset
+                || context->range_end < node->entity.size ) )
+        {
+            return zbox_print_range ( context, segment, node );
+        }
+
+        if ( context->file_crc32 )
+        {
+            crc32 = stream_split_crc32 ( context->istream->context );
+        }
+
+        if ( zbox_extract_file ( context, node ) < 0 )
+        {
+            return -1;
+        }
+
+        /* File data must match its stored location */
+        if ( context->istream->context->length != node->location.offset + node->location.size )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( context->file_crc32
+            && stream_merge_crc32 ( context->istream->context, crc32,
+                node->location.size ) != node->crc32 )
+        {
+            fprintf ( stderr, "%s: checksum bad\n", context->path );
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    /* Rest of segment is not needed if files have own checksums */
+    if ( context->file_crc32 )
+    {
+        return 0;
+    }
+
+    /* Consume remaining segment data for its checksum */
+    if ( zbox_skip_data ( context, segment->rawsize - context->istream->context->length ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( context->istream->finalize_crc32 ( context->istream ) != segment->crc32 )
+    {
+        fprintf ( stderr, "archive checksum: bad\n" );
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Collect archive files with stored data in data order
+ */
+static struct node_t **zbox_data_files ( const struct archive_meta_t *meta, uint32_t * count )
+{
+    uint32_t i;
+    struct node_t **files;
+
+    if ( !( files =
+            ( struct node_t ** ) malloc ( ( meta->header.nentity ? meta->header.nentity : 1 ) *
+                sizeof ( struct node_t * ) ) ) )
+    {
+        perror ( "malloc" );
+        return NULL;
+    }
+
+    /* Collect files with stored data */
+    for ( i = 0, *count = 0; i < meta->header.nentity; i++ )
+    {
+        if ( meta->node_table[i]->location.segment != SEGMENT_NONE
+            && !( meta->node_table[i]->entity.mode & ( S_IFDIR | ENTITY_LINK ) ) )
+        {
+            files[( *count )++] = meta->node_table[i];
+        }
+    }
+
+    qsort ( files, *count, sizeof ( struct node_t * ), zbox_location_compare );
+
+    return files;
+}
+
+/** 
+ * Extract archive files segment by segment in stored data order
+ */
+static int zbox_extract_segments ( struct unpack_context_t *context,
+    const struct archive_meta_t *meta, uint32_t * crc32 )
+{
+    int status = 0;
+    uint32_t i;
+    uint32_t s;
+    uint32_t count;
+    uint32_t first;
+    struct node_t **files;
+
+    /* Files are extracted in stored data order */
+    if ( !( files = zbox_data_files ( meta, &count ) ) )
+    {
+        return -1;
+    }
+
+    for ( s = 0, i = 0; s < meta->nsegment; s++ )
+    {
+        for ( first = i; i < count && files[i]->location.segment == s; i++ );
+
+        if ( zbox_extract_segment ( context, &meta->segment_table[s], files + first,
+                i - first ) < 0 )
+        {
+            status = -1;
+            break;
+        }
+
+        *crc32 =
+            checksum_combine ( meta->header.checksum, *crc32, meta->segment_table[s].crc32,
+            meta->segment_table[s].rawsize );
+    }
+
+    free ( files );
+
+    return status;
+}
+
+/**
+ * Read archive stream data into buffer, data is only checksummed
+ */
+static int zbox_verify_data ( struct ar_istream *istream, unsigned char *buf, uint64_t left )
+{
+    size_t len;
+    const unsigned char *data;
+
+    for ( ; left; left -= len )
+    {
+        len = left > WORKBUF_LIMIT ? WORKBUF_LIMIT : left;
+
+        if ( zbox_read_data ( istream, buf, len, &data ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Verify files data checksums of single archive segment
+ */
+static int zbox_verify_segment ( struct verify_context_t *verify, struct ar_istream *istream,
+    unsigned char *buf, uint32_t s )
+{
+    int status = 0;
+    uint32_t i;
+    uint32_t crc32;
+    char path[PATH_LIMIT];
+    struct node_t *node;
+    const struct segment_t *segment = &verify->meta->segment_table[s];
+
+    /* Start reading segment data stream */
+    if ( istream->reset ( istream, segment->offset ) < 0 )
+    {
+        perror ( "lseek" );
+        return -1;
+    }
+
+    for ( i = verify->first[s]; i < verify->first[s + 1]; i++ )
+    {
+        node = verify->files[i];
+
+        if ( node_path ( node, path, sizeof ( path ) ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Data of files must not overlap */
+        if ( node->location.offset < istream->context->length )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( zbox_verify_data ( istream, buf,
+                node->location.offset - istream->context->length ) < 0 )
+        {
+            return -1;
+        }
+
+        /* File data has its own checksum */
+        crc32 = stream_split_crc32 ( istream->context );
+
+        if ( zbox_verify_data ( istream, buf, node->location.size ) < 0 )
+        {
+            fprintf ( stderr, "%s: data damaged\n", path );
+            return -1;
+        }
+
+        if ( stream_merge_crc32 ( istream->context, crc32, node->location.size ) != node->crc32 )
+        {
+            fprintf ( stderr, "%s: checksum bad\n", path );
+            status = -1;
+            continue;
+        }
+
+        /* Replaced file versions are verified but not shown */
+        if ( verify->options & OPTION_VERBOSE && ~node->entity.mode & ENTITY_SHADOWED )
+        {
+            show_progress ( 't', path );
+        }
+    }
+
+    /* Consume remaining segment data for its checksum */
+    if ( zbox_verify_data ( istream, buf, segment->rawsize - istream->context->length ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Damage outside of files data is reported for segment */
+    if ( istream->finalize_crc32 ( istream ) != segment->crc32 && !status )
+    {
+        fprintf ( stderr, "archive checksum: bad\n" );
+        return -1;
+    }
+
+    return status;
+}
+
+/**
+ * Take next archive segment to be verified, none is left after a failure
+ */
+static int zbox_verify_next ( struct verify_context_t *verify, uint32_t * s, int failed )
+{
+    int found;
+
+#ifndef WIN32_BUILD
+    pthread_mutex_lock ( &verify->lock );
+#endif
+    verify->failed |= failed;
+    found = !verify->failed && verify->next < verify->meta->nsegment;
+    *s = verify->next++;
+#ifndef WIN32_BUILD
+    pthread_mutex_unlock ( &verify->lock );
+#endif
+
+    return found;
+}
+
+/**
+ * Verify archive segments with own archive stream
+ */
+static void *zbox_verify_worker ( void *arg )
+{
+    int fd;
+    int failed = 0;
+    uint32_t s;
+    unsigned char *buf;
+    struct header_t header;
+    struct ar_istream *istream;
+    struct verify_context_t *verify = ( struct verify_context_t * ) arg;
+
+    if ( !( buf = ( unsigned char * ) malloc ( WORKBUF_LIMIT ) ) )
+    {
+        perror ( "malloc" );
+        zbox_verify_next ( verify, &s, 1 );
+        return NULL;
+    }
+
+    /* Each worker reads archive at its own file position */
+    if ( ( fd = open ( verify->archive, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        perror ( verify->archive );
+        free ( buf );
+        zbox_verify_next ( verify, &s, 1 );
+        return NULL;
+    }
+
+    if ( !( istream = zbox_archive_istream_open ( fd, &header, verify->options ) ) )
+    {
+        close ( fd );
+        free ( buf );
+        zbox_verify_next ( verify, &s, 1 );
+        return NULL;
+    }
+
+    while ( zbox_verify_next ( verify, &s, failed ) )
+    {
+        failed = zbox_verify_segment ( verify, istream, buf, s ) < 0;
+    }
+
+    istream->close ( istream );
+    close ( fd );
+    free ( buf );
+
+    return NULL;
+}
+
+/**
+ * Verify archive files data checksums in parallel, segments
+ * are verified independently and damaged files are reported
+ */
+static int zbox_verify_segments ( const char *archive, uint32_t options,
+    const struct archive_meta_t *meta, uint32_t * crc32 )
+{
+    uint32_t i;
+    uint32_t s;
+    uint32_t count;
+    struct verify_context_t verify;
+#ifndef WIN32_BUILD
+    long nthread;
+    long started;
+    pthread_t threads[VERIFY_THREADS_MAX];
+#endif
+
+    if ( !( verify.files = zbox_data_files ( meta, &count ) ) )
+    {
+        return -1;
+    }
+
+    /* Find first file of each segment */
+    if ( !( verify.first =
+            ( uint32_t * ) malloc ( ( meta->nsegment + 1 ) * sizeof ( uint32_t ) ) ) )
+    {
+        perror ( "malloc" );
+        free ( verify.files );
+        return -1;
+    }
+
+    for ( s = 0, i = 0; s <= meta->nsegment; s++ )
+    {
+        verify.first[s] = i;
+
+        for ( ; s < meta->nsegment && i < count && verify.files[i]->location.segment == s; i++ );
+    }
+
+    verify.archive = archive;
+    verify.options = options;
+    verify.meta = meta;
+    verify.next = 0;
+    verify.failed = 0;
+
+#ifndef WIN32_BUILD
+    /* Use a thread per processor, up to segments count */
+    if ( ( nthread = sysconf ( _SC_NPROCESSORS_ONLN ) ) < 1 )
+    {
+        nthread = 1;
+    }
+
+    if ( nthread > VERIFY_THREADS_MAX )
+    {
+        nthread = VERIFY_THREADS_MAX;
+    }
+
+    if ( nthread > ( long ) meta->nsegment )
+    {
+        nthread = meta->nsegment ? meta->nsegment : 1;
+    }
+
+    pthread_mutex_init ( &verify.lock, NULL );
+
+    for ( started = 0; started < nthread; started++ )
+    {
+        if ( pthread_create ( &threads[started], NULL, zbox_verify_worker, &verify ) )
+        {
+            break;
+        }
+    }
+
+    /* Verify in this thread if none could be started */
+    if ( !started )
+    {
+        zbox_verify_worker ( &verify );
+    }
+
+    while ( started )
+    {
+        pthread_join ( threads[--started], NULL );
+    }
+
+    pthread_mutex_destroy ( &verify.lock );
+#else
+    UNUSED ( options );
+    zbox_verify_worker ( &verify );
+#endif
+
+    free ( verify.first );
+    free ( verify.files );
+
+    if ( verify.failed )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* All segment checksums were verified */
+    for ( s = 0; s < meta->nsegment; s++ )
+    {
+        *crc32 =
+            checksum_combine ( meta->header.checksum, *crc32, meta->segment_table[s].crc32,
+            meta->segment_table[s].rawsize );
+    }
+
+    return 0;
+}
+
+/**
+ * Build base archive path, it is placed next to the archive
+ */
+static int zbox_base_path ( const char *archive, const char *base_name, char *path,
+    size_t path_size )
+{
+    size_t i;
+    size_t len = 0;
+
+    if ( check_forbidden ( base_name ) )
+    {
+        errno = EINVAL;
+        perror ( base_name );
+        return -1;
+    }
+
+    for ( i = 0; archive[i]; i++ )
+    {
+        if ( archive[i] == '/' || archive[i] == '\\' )
+        {
+            len = i + 1;
+        }
+    }
+
+    if ( len + strlen ( base_name ) >= path_size )
+    {
+        errno = ENAMETOOLONG;
+        perror ( base_name );
+        return -1;
+    }
+
+    memcpy ( path, archive, len );
+    strcpy ( path + len, base_name );
+
+    return 0;
+}
+
+/**
+ * Print byte range of file version stored in base archive
+ */
+static int zbox_print_base ( struct unpack_context_t *context, int fd, uint64_t offset,
+    uint64_t length )
+{
+    int status;
+    size_t i;
+    size_t len;
+    char path[PATH_LIMIT];
+    char pattern[2 * PATH_LIMIT];
+    struct filter_t filter;
+
+    if ( !context->base_name )
+    {
+        fprintf ( stderr, "%s: base archive not known\n", context->path );
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( zbox_base_path ( context->archive, context->base_name, path, sizeof ( path ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* File is looked up by its path, glob characters are escaped */
+    for ( i = 0, len = 0; context->path[i]; i++ )
+    {
+        if ( strchr ( "*?[\\", context->path[i] ) )
+        {
+            pattern[len++] = '\\';
+        }
+
+        pattern[len++] = context->path[i];
+    }
+
+    pattern[len] = '\0';
+    memset ( &filter, '\0', sizeof ( filter ) );
+
+    if ( ( status = filter_add ( &filter, pattern, 0 ) ) >= 0
+        && ( status =
+            zbox_unpack_archive_in ( path, context->options, &filter, offset, length,
+                fd ) ) >= 0 )
+    {
+        status = filter_unmatched ( &filter );
+    }
+
+    filter_free ( &filter );
+
+    return status;
+}
+
+/**
+ * Remove base archive files selected by filter, but not present in the archive anymore
+ */
+static int zbox_prune_base ( const char *base, const struct archive_meta_t *meta,
+    struct filter_t *filter )
+{
+    int fd;
+    int status;
+    uint32_t i;
+    uint8_t *kept;
+    char path[PATH_LIMIT];
+    const struct node_t *node;
+    struct ar_istream *istream;
+    struct header_t header;
+    struct archive_meta_t base_meta;
+    struct unpack_context_t context;
+
+    /* Open base archive file for reading */
+    if ( ( fd = open ( base, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        perror ( base );
+        return -1;
     }
 
-    /* Set needed data length */
-    left = entity->size;
-
-    /* Update archive checksum only if needed */
-    if ( context->options & OPTION_TESTONLY )
+    /* Open base archive stream */
+    if ( !( istream = zbox_archive_istream_open ( fd, &header, 0 ) ) )
     {
-        while ( ( len = left > context->workbuf_size ? context->workbuf_size : left ) > 0 )
-        {
-            if ( context->istream->read ( context->istream, context->workbuf, len ) < 0 )
-            {
-                return -1;
-            }
+        close ( fd );
+        return -1;
+    }
 
-            left -= len;
-        }
+    /* Load base archive metadata */
+    if ( ( status = istream->reset ( istream, header.meta_offset ) ) >= 0
+        && ( status = meta_load ( istream, &header, &base_meta ) ) >= 0
+        && ( status = meta_parse ( &base_meta ) ) < 0 )
+    {
+        meta_free ( &base_meta );
+    }
 
-        if ( context->options & OPTION_VERBOSE )
-        {
-            show_progress ( 't', context->path );
-        }
+    /* Close base archive stream */
+    istream->close ( istream );
+    close ( fd );
 
-        return 0;
+    if ( status < 0 )
+    {
+        return -1;
     }
 
-    /* Open input file for reading */
-    if ( ( fd =
-            open ( context->path, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY,
-                entity->mode & ( ~S_IFMT ) ) ) < 0 )
+    if ( !( kept = ( uint8_t * ) calloc ( header.nentity, sizeof ( uint8_t ) ) ) )
     {
-        perror ( context->path );
+        perror ( "calloc" );
+        meta_free ( &base_meta );
         return -1;
     }
 
-    /* Store file content into archive */
-    while ( ( len = left > context->workbuf_size ? context->workbuf_size : left ) > 0 )
+    /* Only entities selected by filter were extracted from base archive */
+    context.selected = NULL;
+
+    if ( filter->ninclude || filter->nexclude )
     {
-        if ( context->istream->read ( context->istream, context->workbuf, len ) < 0 )
-        {
-            close ( fd );
-            return -1;
-        }
+        context.options = 0;
+        context.path[0] = '\0';
+        context.node_table = base_meta.node_table;
+        context.nentity = header.nentity;
+        context.filter = filter;
 
-        if ( write ( fd, context->workbuf, len ) < 0 )
+        if ( zbox_select ( &context, base_meta.root ) < 0 )
         {
-            perror ( "write" );
-            close ( fd );
+            free ( context.selected );
+            free ( kept );
+            meta_free ( &base_meta );
             return -1;
         }
-
-        left -= len;
     }
 
-    /* Close file fd */
-    close ( fd );
-
-    /* All bytes must have been written to file */
-    if ( left )
+    /* Mark base entities still present at the same path */
+    for ( i = 0; i < meta->header.nentity; i++ )
     {
-        errno = ENODATA;
-        return -1;
+        if ( meta->node_table[i]->ext.base < header.nentity )
+        {
+            kept[meta->node_table[i]->ext.base] = 1;
+        }
     }
 
-    if ( context->options & OPTION_VERBOSE )
+    /* Remove other entities, children before their parents */
+    for ( i = header.nentity; i--; )
     {
-        show_progress ( context->options & OPTION_NOPATHS ? 'e' : 'x', context->path );
+        node = base_meta.node_table[i];
+
+        if ( kept[i] || node->entity.mode & ENTITY_SHADOWED
+            || ( context.selected && !context.selected[i] ) )
+        {
+            continue;
+        }
+
+        if ( node_path ( node, path, sizeof ( path ) ) < 0 )
+        {
+            status = -1;
+            break;
+        }
+
+        if ( node->entity.mode & S_IFDIR )
+        {
+            rmdir ( path );
+
+        } else if ( unlink ( path ) < 0 && errno != ENOENT )
+        {
+            perror ( path );
+            status = -1;
+            break;
+        }
     }
 
-    return 0;
-}
+    free ( context.selected );
+    free ( kept );
+    meta_free ( &base_meta );
 
-/**
- * Check if file path is forbidden
- */
-static int check_forbidden ( const char *path )
-{
-    return !path[0] || strchr ( path, '/' ) || strchr ( path, '\\' ) || !strcmp ( path, ".." );
+    return status;
 }
 
-/** 
- * Manage archive extract process
+/**
+ * Extract base archive chain of an incremental archive
  */
-static int zbox_extract_next ( struct unpack_context_t *context, struct node_t *node )
+static int zbox_unpack_base ( const char *archive, const struct archive_meta_t *meta,
+    uint32_t options, struct filter_t *filter )
 {
-    size_t path_len = 0;
+    int fd;
+    char path[PATH_LIMIT];
+    struct ar_istream *istream;
+    struct header_t header;
 
-    if ( !node )
+    if ( zbox_base_path ( archive, meta->base_name, path, sizeof ( path ) ) < 0 )
     {
-        return 0;
+        return -1;
     }
 
-    if ( check_forbidden ( node->name ) )
+    /* Open base archive file for reading */
+    if ( ( fd = open ( path, O_RDONLY | O_BINARY ) ) < 0 )
     {
-        errno = EINVAL;
-        perror ( node->name );
+        perror ( path );
         return -1;
     }
 
-    if ( ~context->options & OPTION_NOPATHS || ~node->entity.mode & S_IFDIR )
+    /* Base archive must be the one used to build the archive */
+    if ( !( istream = zbox_archive_istream_open ( fd, &header, options ) ) )
     {
-        path_len = strlen ( context->path );
+        close ( fd );
+        return -1;
+    }
 
-        if ( path_concat ( context->path, sizeof ( context->path ), node->name ) < 0 )
-        {
-            return -1;
-        }
+    istream->close ( istream );
+    close ( fd );
 
-        if ( zbox_extract_file ( context, &node->entity ) < 0 )
-        {
-            return -1;
-        }
+    if ( header.crc32 != meta->base_crc32 )
+    {
+        fprintf ( stderr, "%s: base archive changed\n", path );
+        errno = EINVAL;
+        return -1;
     }
 
-    if ( zbox_extract_next ( context, node->sub ) < 0 )
+    /* Extract base archive, its own base first */
+    if ( zbox_unpack_archive ( path, options, filter ) < 0 )
     {
         return -1;
     }
 
-    if ( ~context->options & OPTION_NOPATHS || ~node->entity.mode & S_IFDIR )
+    /* Files are flattened when paths are not extracted */
+    if ( options & OPTION_NOPATHS )
     {
-        context->path[path_len] = '\0';
+        return 0;
     }
 
-    return zbox_extract_next ( context, node->next );
+    return zbox_prune_base ( path, meta, filter );
 }
 
 /** 
  * Load metadata of archive files
  */
-static int zbox_unpack_archive_load ( struct header_t *header, struct ar_istream *istream,
-    uint32_t options )
+static int zbox_unpack_archive_load ( const char *archive, struct header_t *header,
+    struct ar_istream *istream, uint32_t options, struct filter_t *filter, uint64_t offset,
+    uint64_t length, int out_fd )
 {
     int status = 0;
+    int segmented;
+    int partial;
     uint32_t crc32_backup;
-    uint32_t crc32_recalc;
-    size_t i;
-    size_t entity_table_size;
-    struct entity_t *entity_table;
-    char *name_table;
-    struct node_t *root = NULL;
+    uint32_t crc32_recalc = 0;
+    uint32_t meta_crc32 = 0;
+    uint64_t meta_length = 0;
+    struct archive_meta_t meta;
     struct unpack_context_t context;
 
     /* Validate header magic field */
@@ -270,115 +2225,230 @@ static int zbox_unpack_archive_load ( struct header_t *header, struct ar_istream
         return -1;
     }
 
+    if ( header->checksum > CHECKSUM_CRC32C )
+    {
+        fprintf ( stderr, "checksum type not supported.\n" );
+        errno = EINVAL;
+        return -1;
+    }
+
     /* At least one entity required */
     if ( !header->nentity )
     {
         return 0;
     }
 
+    segmented = header->flags & HEADER_FLAG_SEGMENTED;
+
     /* Seed archive stream checksum */
     crc32_backup = header->crc32;
     header->crc32 = 0;
 
-    istream->seed_crc32 ( istream, header );
-
-    /* Calculate entity table size */
-    entity_table_size = header->nentity * sizeof ( struct entity_t );
+    if ( segmented )
+    {
+        /* Metadata is stored after files data */
+        if ( istream->reset ( istream, header->meta_offset ) < 0 )
+        {
+            perror ( "lseek" );
+            return -1;
+        }
 
-    /* Allocate entity table */
-    if ( !( entity_table = ( struct entity_t * ) malloc ( entity_table_size ) ) )
+    } else
     {
-        perror ( "malloc" );
-        return -1;
+        istream->seed_crc32 ( istream, header );
     }
 
-    /* Read entity table */
-    if ( istream->read ( istream, entity_table, entity_table_size ) < 0 )
+    /* Load archive metadata tables */
+    if ( meta_load ( istream, header, &meta ) < 0 )
     {
-        free ( entity_table );
         return -1;
     }
 
-    /* Convert entities to host byte order */
-    for ( i = 0; i < header->nentity; i++ )
+    if ( segmented )
     {
-        entity_table[i].parent = ntohl ( entity_table[i].parent );
-        entity_table[i].mode = ntohl ( entity_table[i].mode );
-        entity_table[i].size = ntohl ( entity_table[i].size );
+        meta_crc32 = istream->finalize_crc32 ( istream );
+        meta_length = istream->context->length;
+
+        /* Metadata is validated before any file data is read */
+        if ( header->flags & HEADER_FLAG_META_CRC32
+            && zbox_calculate_meta_crc32 ( header, meta_crc32,
+                meta_length ) != header->meta_crc32 )
+        {
+            fprintf ( stderr, "archive metadata checksum: bad\n" );
+            errno = EINVAL;
+            meta_free ( &meta );
+            return -1;
+        }
     }
 
-    /* At least one name required */
-    if ( !header->nameslen )
+    /* Parse archive nodes into memory */
+    if ( meta_parse ( &meta ) < 0 )
     {
-        errno = EINVAL;
-        free ( entity_table );
+        meta_free ( &meta );
         return -1;
     }
 
-    /* Allocate name table */
-    if ( !( name_table = ( char * ) malloc ( header->nameslen ) ) )
+    /* Prepare path buffer */
+    context.options = options;
+    context.istream = istream;
+    context.path[0] = '\0';
+    context.dirs_only = segmented && ~options & OPTION_LISTONLY;
+    context.replace = 0;
+    context.node_table = meta.node_table;
+    context.nentity = header->nentity;
+    context.ref_fd = -1;
+    context.base_fd = -1;
+    context.compare = 0;
+    context.cmpbuf = NULL;
+    context.ref_index = 0;
+    context.filter = filter;
+    context.selected = NULL;
+    context.shared = NULL;
+    context.standin = NULL;
+    context.seekable = header->comp == COMP_NONE;
+    context.file_crc32 = 0;
+    context.archive = archive;
+    context.segment_table = meta.segment_table;
+    context.nsegment = meta.nsegment;
+    context.range_offset = offset;
+    context.range_end = length < ( uint64_t ) - 1 - offset ? offset + length : ( uint64_t ) - 1;
+    context.written = 0;
+    context.out_fd = options & OPTION_STDOUT ? out_fd : -1;
+    context.base_name = meta.base_name;
+
+    /* Allocate work buffer */
+    if ( !( context.workbuf = ( unsigned char * ) malloc ( WORKBUF_LIMIT ) ) )
     {
         perror ( "malloc" );
-        free ( entity_table );
+        meta_free ( &meta );
         return -1;
     }
 
-    /* Read name table */
-    if ( istream->read ( istream, name_table, header->nameslen ) < 0 )
+    context.workbuf_size = WORKBUF_LIMIT;
+
+    /* Allocate compare buffer if needed */
+    if ( options & OPTION_COMPARE
+        && !( context.cmpbuf = ( unsigned char * ) malloc ( WORKBUF_LIMIT ) ) )
     {
-        free ( entity_table );
-        free ( name_table );
+        perror ( "malloc" );
+        free ( context.workbuf );
+        meta_free ( &meta );
         return -1;
     }
 
-    /* Parse archive nodes into memory */
-    if ( zbox_unpack_parse ( ( const struct header_t * ) header,
-            ( const struct entity_t * ) entity_table, ( const char * ) name_table, &root ) < 0 )
+    /* Extract base archive chain first, changed files are replaced */
+    if ( meta.base_name && !( options & ( OPTION_LISTONLY | OPTION_TESTONLY | OPTION_STDOUT ) ) )
     {
-        free ( entity_table );
-        free ( name_table );
-        free_files_tree ( root, 0 );
-        return -1;
+        if ( zbox_unpack_base ( archive, &meta, options, filter ) < 0 )
+        {
+            free ( context.cmpbuf );
+            free ( context.workbuf );
+            meta_free ( &meta );
+            return -1;
+        }
+
+        context.replace = 1;
     }
 
-    /* Entity table no longer needed */
-    free ( entity_table );
+    /* Only data segments with selected files are read, files
+       are verified by own checksums if stored */
+    if ( filter && ( filter->ninclude || filter->nexclude ) )
+    {
+        status = zbox_select ( &context, meta.root );
+        context.file_crc32 = segmented && header->flags & HEADER_FLAG_CHECKSUMS;
+        context.path[0] = '\0';
+    }
 
-    /* Prepare path buffer */
-    context.options = options;
-    context.istream = istream;
-    context.path[0] = '\0';
+    /* Files flattened to the same name overwrite each other */
+    if ( !status && options & OPTION_NOPATHS
+        && !( options & ( OPTION_LISTONLY | OPTION_TESTONLY | OPTION_STDOUT ) ) )
+    {
+        status = zbox_mark_shared ( &context );
+    }
 
-    /* Allocate work buffer */
-    if ( !( context.workbuf = ( unsigned char * ) malloc ( WORKBUF_LIMIT ) ) )
+    /* Replaced file versions are extracted only for their hard links */
+    if ( !status && !( options & ( OPTION_LISTONLY | OPTION_TESTONLY ) ) )
     {
-        perror ( "malloc" );
-        free ( entity_table );
-        free ( name_table );
-        free_files_tree ( root, 0 );
-        return -1;
+        status = zbox_find_standins ( &context );
     }
 
-    context.workbuf_size = WORKBUF_LIMIT;
+    partial = segmented && context.selected;
+
+    /* Extract files, only directories if data is stored in segments */
+    if ( !status )
+    {
+        status = zbox_extract_next ( &context, meta.root );
+    }
+
+    /* Extract data segments, checksum covers them in archive order */
+    if ( !status && context.dirs_only && segmented )
+    {
+        crc32_recalc = header_crc32 ( header );
+
+        /* Files data checksums are verified in parallel if stored */
+        if ( options & OPTION_TESTONLY && header->flags & HEADER_FLAG_CHECKSUMS && !partial )
+        {
+            status = zbox_verify_segments ( archive, options, &meta, &crc32_recalc );
+
+        } else
+        {
+            status = zbox_extract_segments ( &context, &meta, &crc32_recalc );
+        }
+
+        crc32_recalc =
+            checksum_combine ( header->checksum, crc32_recalc, meta_crc32, meta_length );
+    }
+
+    /* Create hard links once their targets exist */
+    if ( !status && !( options & ( OPTION_LISTONLY | OPTION_TESTONLY | OPTION_STDOUT ) ) )
+    {
+        status = zbox_extract_links ( &context );
+    }
+
+    /* Close referenced chunk source file */
+    if ( context.ref_fd >= 0 )
+    {
+        close ( context.ref_fd );
+    }
 
-    /* Extract files */
-    status = zbox_extract_next ( &context, root );
+    /* Close base version of delta file */
+    if ( context.base_fd >= 0 )
+    {
+        close ( context.base_fd );
+    }
 
-    /* Free work buffer */
+    /* Free work and compare buffers */
     free ( context.workbuf );
+    free ( context.cmpbuf );
+    free ( context.selected );
+    free ( context.shared );
+    free ( context.standin );
 
-    /* Free name tables */
-    free ( name_table );
+    /* Free metadata */
+    meta_free ( &meta );
 
-    /* Free files tree */
-    free_files_tree ( root, 0 );
+    /* Metadata copy for in-place use has own checksum */
+    if ( !status && options & OPTION_TESTONLY && header->flags & HEADER_FLAG_INPLACE
+        && inplace_verify ( istream->context->fd, header ) < 0 )
+    {
+        fprintf ( stderr, "archive in-place metadata checksum: bad\n" );
+        status = -1;
+    }
 
     /* Validate archive checksum if needed */
     if ( !status )
     {
-        crc32_recalc = istream->finalize_crc32 ( istream );
+        if ( !segmented )
+        {
+            crc32_recalc = istream->finalize_crc32 ( istream );
+        }
+
+        /* Archive checksum does not cover partially read segments */
+        if ( options & OPTION_TESTONLY && partial )
+        {
+            printf ( "selected files checksums: ok\n" );
 
-        if ( ~options & OPTION_LISTONLY && crc32_backup != crc32_recalc )
+        } else if ( ~options & OPTION_LISTONLY && !partial && crc32_backup != crc32_recalc )
         {
             fprintf ( stderr, "archive checksum: bad\n" );
             errno = EINVAL;
@@ -393,56 +2463,110 @@ static int zbox_unpack_archive_load ( struct header_t *header, struct ar_istream
     return status;
 }
 
-/** 
- * Unpack files from an archive
+/**
+ * Calculate archive metadata checksum, it covers header and metadata segment
  */
-int zbox_unpack_archive ( const char *archive, uint32_t options )
+uint32_t zbox_calculate_meta_crc32 ( const struct header_t *header, uint32_t crc32, uint64_t len )
 {
-    int fd;
-    int status;
-    struct ar_istream *istream;
-    struct header_t header;
+    struct header_t seed;
 
-    /* Open archive file for reading */
-    if ( ( fd = open ( archive, O_RDONLY | O_BINARY ) ) < 0 )
-    {
-        perror ( archive );
-        return -1;
-    }
+    /* Checksum fields are set to zero before calculation */
+    memcpy ( &seed, header, sizeof ( seed ) );
+    seed.crc32 = 0;
+    seed.meta_crc32 = 0;
+
+    return checksum_combine ( header->checksum, header_crc32 ( &seed ), crc32, len );
+}
+
+/**
+ * Open archive input stream and read its header
+ */
+struct ar_istream *zbox_archive_istream_open ( int fd, struct header_t *header,
+    uint32_t options )
+{
+    struct ar_istream *istream;
 
     /* Open archive stream */
     if ( !( istream = plain_istream_open ( fd ) ) )
     {
-        close ( fd );
-        return -1;
+        return NULL;
     }
 
     /* Get archive header */
-    if ( istream->get_header ( istream, &header ) < 0 )
+    if ( istream->get_header ( istream, header ) < 0 )
     {
-        return -1;
+        istream->close ( istream );
+        return NULL;
     }
 
     /* Re-open archive stream if needed */
-    if ( header.comp == COMP_ZLIB )
+    if ( header->comp == COMP_ZLIB )
     {
         istream->close ( istream );
 #ifdef ENABLE_ZLIB
         if ( !( istream = zlib_istream_open ( fd ) ) )
         {
-            close ( fd );
-            return -1;
+            return NULL;
         }
 #else
         fprintf ( stderr, "zlib not enabled.\n" );
         errno = EINVAL;
+        return NULL;
+#endif
+    }
+
+    /* Data is checksummed as declared by archive */
+    istream->context->checksum = header->checksum;
+
+    /* Archive is read bypassing page cache or from its mapping if possible */
+    if ( ~options & OPTION_DIRECT_IO || generic_direct_input ( istream ) < 0 )
+    {
+        generic_map_input ( istream, options & OPTION_POPULATE );
+    }
+
+    return istream;
+}
+
+/**
+ * Unpack files from an archive, byte range of files is printed if needed
+ */
+static int zbox_unpack_archive_in ( const char *archive, uint32_t options,
+    struct filter_t *filter, uint64_t offset, uint64_t length, int out_fd )
+{
+    int fd;
+    int status;
+    struct ar_istream *istream;
+    struct header_t header;
+    struct inplace_meta_t inplace;
+
+    /* Open archive file for reading */
+    if ( ( fd = open ( archive, O_RDONLY | O_BINARY ) ) < 0 )
+    {
+        perror ( archive );
+        return -1;
+    }
+
+    /* Open archive stream */
+    if ( !( istream = zbox_archive_istream_open ( fd, &header, options ) ) )
+    {
         close ( fd );
         return -1;
-#endif
     }
 
-    /* Load archive metadata and unpack */
-    status = zbox_unpack_archive_load ( &header, istream, options );
+    /* List files with in-place metadata if stored, no parsing needed */
+    if ( options & OPTION_LISTONLY && header.flags & HEADER_FLAG_INPLACE
+        && inplace_open ( fd, &header, &inplace ) >= 0 )
+    {
+        status = inplace_list ( &inplace, options, filter );
+        inplace_close ( &inplace );
+
+    } else
+    {
+        /* Load archive metadata and unpack */
+        status =
+            zbox_unpack_archive_load ( archive, &header, istream, options, filter, offset,
+            length, out_fd );
+    }
 
     /* Close archive stream */
     istream->close ( istream );
@@ -450,3 +2574,21 @@ int zbox_unpack_archive ( const char *archive, uint32_t options )
 
     return status;
 }
+
+/** 
+ * Unpack files from an archive, only files selected by filter if given
+ */
+int zbox_unpack_archive ( const char *archive, uint32_t options, struct filter_t *filter )
+{
+    return zbox_unpack_archive_in ( archive, options, filter, 0, ( uint64_t ) - 1, -1 );
+}
+
+/**
+ * Print byte range of archive files selected by filter to standard output
+ */
+int zbox_print_archive ( const char *archive, uint32_t options, struct filter_t *filter,
+    uint64_t offset, uint64_t length )
+{
+    return zbox_unpack_archive_in ( archive, options | OPTION_STDOUT, filter, offset, length,
+        STDOUT_FILENO );
+}
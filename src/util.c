@@ -3,6 +3,9 @@
  * ------------------------------------------------------------------ */
 
 #include "zbox.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
  * Show operation progress with current file path
@@ -12,3 +15,150 @@ void show_progress ( char action, const char *path )
     printf ( " %c %s\n", action, path );
 }
 
+
+/**
+ * Convert 64-bit value from host to network byte order
+ */
+uint64_t hton64 ( uint64_t value )
+{
+    if ( htonl ( 1 ) == 1 )
+    {
+        return value;
+    }
+
+    return ( ( uint64_t ) htonl ( ( uint32_t ) value ) << 32 ) |
+        htonl ( ( uint32_t ) ( value >> 32 ) );
+}
+
+/**
+ * Convert 64-bit value from network to host byte order
+ */
+uint64_t ntoh64 ( uint64_t value )
+{
+    return hton64 ( value );
+}
+
+/**
+ * Convert 32-bit value between host and little-endian byte order
+ */
+uint32_t le32 ( uint32_t value )
+{
+    if ( htonl ( 1 ) != 1 )
+    {
+        return value;
+    }
+
+    return __builtin_bswap32 ( value );
+}
+
+/**
+ * Convert 64-bit value between host and little-endian byte order
+ */
+uint64_t le64 ( uint64_t value )
+{
+    if ( htonl ( 1 ) != 1 )
+    {
+        return value;
+    }
+
+    return __builtin_bswap64 ( value );
+}
+
+/**
+ * Read data from file at given offset
+ */
+ssize_t read_at ( int fd, void *data, size_t len, off_t offset )
+{
+#ifndef WIN32_BUILD
+    return pread ( fd, data, len, offset );
+#else
+    off_t offset_backup;
+    ssize_t ret;
+
+    if ( ( offset_backup = lseek ( fd, 0, SEEK_CUR ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( lseek ( fd, offset, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+
+    ret = read ( fd, data, len );
+
+    if ( lseek ( fd, offset_backup, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+
+    return ret;
+#endif
+}
+
+/**
+ * Write data to file at given offset
+ */
+ssize_t write_at ( int fd, const void *data, size_t len, off_t offset )
+{
+#ifndef WIN32_BUILD
+    return pwrite ( fd, data, len, offset );
+#else
+    off_t offset_backup;
+    ssize_t ret;
+
+    if ( ( offset_backup = lseek ( fd, 0, SEEK_CUR ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( lseek ( fd, offset, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+
+    ret = write ( fd, data, len );
+
+    if ( lseek ( fd, offset_backup, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+
+    return ret;
+#endif
+}
+
+/**
+ * Check if data block contains only zero bytes
+ */
+int is_zero_block ( const void *data, size_t len )
+{
+    const unsigned char *ptr = ( const unsigned char * ) data;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128 (  );
+
+    for ( ; len >= 64; len -= 64, ptr += 64 )
+    {
+        acc = _mm_or_si128 ( acc, _mm_loadu_si128 ( ( const __m128i * ) ptr ) );
+        acc = _mm_or_si128 ( acc, _mm_loadu_si128 ( ( const __m128i * ) ( ptr + 16 ) ) );
+        acc = _mm_or_si128 ( acc, _mm_loadu_si128 ( ( const __m128i * ) ( ptr + 32 ) ) );
+        acc = _mm_or_si128 ( acc, _mm_loadu_si128 ( ( const __m128i * ) ( ptr + 48 ) ) );
+
+        /* Stop early on the first non-zero stripe */
+        if ( _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( acc, _mm_setzero_si128 (  ) ) ) != 0xffff )
+        {
+            return 0;
+        }
+    }
+#endif
+
+    for ( ; len; len--, ptr++ )
+    {
+        if ( *ptr )
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,129 @@
+/* ------------------------------------------------------------------
+ * ZBox - Simple Data Achive Utility
+ * ------------------------------------------------------------------ */
+
+/* XXH64 hash function, implemented after the public xxHash
+ * specification by Yann Collet (BSD 2-Clause licensed algorithm). */
+
+#include "zbox.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+/**
+ * Rotate 64-bit value left
+ */
+static uint64_t xxh64_rotl ( uint64_t x, int r )
+{
+    return ( x << r ) | ( x >> ( 64 - r ) );
+}
+
+/**
+ * Read 64-bit little endian value
+ */
+static uint64_t xxh64_read64 ( const uint8_t * p )
+{
+    return ( uint64_t ) p[0] | ( ( uint64_t ) p[1] << 8 ) | ( ( uint64_t ) p[2] << 16 ) |
+        ( ( uint64_t ) p[3] << 24 ) | ( ( uint64_t ) p[4] << 32 ) | ( ( uint64_t ) p[5] << 40 ) |
+        ( ( uint64_t ) p[6] << 48 ) | ( ( uint64_t ) p[7] << 56 );
+}
+
+/**
+ * Read 32-bit little endian value
+ */
+static uint32_t xxh64_read32 ( const uint8_t * p )
+{
+    return ( uint32_t ) p[0] | ( ( uint32_t ) p[1] << 8 ) | ( ( uint32_t ) p[2] << 16 ) |
+        ( ( uint32_t ) p[3] << 24 );
+}
+
+/**
+ * Single accumulator round
+ */
+static uint64_t xxh64_round ( uint64_t acc, uint64_t input )
+{
+    acc += input * PRIME64_2;
+    acc = xxh64_rotl ( acc, 31 );
+    return acc * PRIME64_1;
+}
+
+/**
+ * Merge accumulator into hash
+ */
+static uint64_t xxh64_merge ( uint64_t acc, uint64_t val )
+{
+    acc ^= xxh64_round ( 0, val );
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * Calculate XXH64 hash of data
+ */
+uint64_t xxh64 ( uint64_t seed, const uint8_t * buf, size_t len )
+{
+    uint64_t h;
+    uint64_t v1;
+    uint64_t v2;
+    uint64_t v3;
+    uint64_t v4;
+    const uint8_t *end = buf + len;
+
+    if ( len >= 32 )
+    {
+        v1 = seed + PRIME64_1 + PRIME64_2;
+        v2 = seed + PRIME64_2;
+        v3 = seed;
+        v4 = seed - PRIME64_1;
+
+        for ( ; buf + 32 <= end; buf += 32 )
+        {
+            v1 = xxh64_round ( v1, xxh64_read64 ( buf ) );
+            v2 = xxh64_round ( v2, xxh64_read64 ( buf + 8 ) );
+            v3 = xxh64_round ( v3, xxh64_read64 ( buf + 16 ) );
+            v4 = xxh64_round ( v4, xxh64_read64 ( buf + 24 ) );
+        }
+
+        h = xxh64_rotl ( v1, 1 ) + xxh64_rotl ( v2, 7 ) + xxh64_rotl ( v3, 12 ) +
+            xxh64_rotl ( v4, 18 );
+        h = xxh64_merge ( h, v1 );
+        h = xxh64_merge ( h, v2 );
+        h = xxh64_merge ( h, v3 );
+        h = xxh64_merge ( h, v4 );
+
+    } else
+    {
+        h = seed + PRIME64_5;
+    }
+
+    h += ( uint64_t ) len;
+
+    for ( ; buf + 8 <= end; buf += 8 )
+    {
+        h ^= xxh64_round ( 0, xxh64_read64 ( buf ) );
+        h = xxh64_rotl ( h, 27 ) * PRIME64_1 + PRIME64_4;
+    }
+
+    if ( buf + 4 <= end )
+    {
+        h ^= ( uint64_t ) xxh64_read32 ( buf ) * PRIME64_1;
+        h = xxh64_rotl ( h, 23 ) * PRIME64_2 + PRIME64_3;
+        buf += 4;
+    }
+
+    for ( ; buf < end; buf++ )
+    {
+        h ^= ( *buf ) * PRIME64_5;
+        h = xxh64_rotl ( h, 11 ) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
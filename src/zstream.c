@@ -16,7 +16,18 @@ struct stream_zlib_context_t
 {
     int fd;
     uint32_t crc32;
+    uint64_t length;
+    uint32_t checksum;
+    const unsigned char *map;
+    uint64_t map_offset;
+    uint64_t map_size;
+    uint64_t pos;
+    unsigned char *buffer;
+    size_t buffer_len;
+    uint64_t buffer_offset;
+    int direct_fd;
     int strm_allocated;
+    int strm_ended;
     z_stream strm;
     unsigned char *unconsumed;
     size_t u_off;
@@ -35,7 +46,10 @@ static int zlib_write ( struct ar_ostream *stream, const void *data, size_t len
     z_stream *strm = &context->strm;
     unsigned char out[CHUNK];
 
-    stream->context->crc32 = crc32b ( stream->context->crc32, ( const unsigned char * ) data, len );
+    stream->context->crc32 =
+        checksum_update ( stream->context->checksum, stream->context->crc32,
+        ( const unsigned char * ) data, len );
+    stream->context->length += len;
 
     while ( len )
     {
@@ -54,7 +68,7 @@ static int zlib_write ( struct ar_ostream *stream, const void *data, size_t len
 
         have = sizeof ( out ) - strm->avail_out;
 
-        if ( have && ( size_t ) write ( stream->context->fd, out, have ) != have )
+        if ( have && generic_output ( stream->context, out, have ) < 0 )
         {
             return -1;
         }
@@ -73,15 +87,18 @@ static int zlib_write ( struct ar_ostream *stream, const void *data, size_t len
 static int decompress_data ( z_stream * strm, const unsigned char *in, size_t avail,
     struct stream_zlib_context_t *context )
 {
-    size_t have;
+    int ret;
     unsigned char *u_backup;
 
     context->u_off = 0;
     context->u_len = 0;
 
-    while ( avail )
+    strm->avail_in = avail;
+    strm->next_in = ( unsigned char * ) in;
+
+    do
     {
-        if ( context->u_off + CHUNK > context->u_size )
+        if ( context->u_len + CHUNK > context->u_size )
         {
             u_backup = context->unconsumed;
             context->u_size <<= 1;
@@ -94,32 +111,27 @@ static int decompress_data ( z_stream * strm, const unsigned char *in, size_t av
             }
         }
 
-        strm->avail_in = avail;
-        strm->next_in = ( unsigned char * ) in;
         strm->avail_out = CHUNK;
-        strm->next_out = context->unconsumed + context->u_off;
+        strm->next_out = context->unconsumed + context->u_len;
+
+        ret = inflate ( strm, Z_NO_FLUSH );
 
-        if ( inflate ( strm, Z_NO_FLUSH ) == Z_STREAM_ERROR )
+        if ( ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END )
         {
+            errno = EINVAL;
             return -1;
         }
 
-        have = CHUNK - strm->avail_out;
-        context->u_len += have;
+        context->u_len += CHUNK - strm->avail_out;
 
-        if ( strm->avail_in )
+        /* Data past stream end belongs to the next segment */
+        if ( ret == Z_STREAM_END )
         {
-            context->u_off += have;
-
-            have = avail - strm->avail_in;
-            in += have;
+            context->strm_ended = 1;
+            break;
         }
-
-        have = avail - strm->avail_in;
-        avail -= have;
     }
-
-    context->u_off = 0;
+    while ( strm->avail_in || !strm->avail_out );
 
     return 0;
 }
@@ -131,27 +143,40 @@ static int zlib_read ( struct ar_istream *stream, void *data, size_t len )
 {
     size_t have;
     size_t avail;
+    const unsigned char *next;
     struct stream_zlib_context_t *context = ( struct stream_zlib_context_t * ) stream->context;
     z_stream *strm = &context->strm;
     unsigned char in[CHUNK];
 
-    if ( context->u_off < context->u_len )
+    while ( len )
     {
-        have = context->u_len - context->u_off;
-        if ( len < have )
+        if ( context->u_off < context->u_len )
         {
-            have = len;
+            have = context->u_len - context->u_off;
+            if ( len < have )
+            {
+                have = len;
+            }
+            memcpy ( data, context->unconsumed + context->u_off, have );
+            stream->context->crc32 =
+                checksum_update ( stream->context->checksum, stream->context->crc32,
+                ( unsigned char * ) data, have );
+            stream->context->length += have;
+            context->u_off += have;
+            data += have;
+            len -= have;
+            continue;
         }
-        memcpy ( data, context->unconsumed + context->u_off, have );
-        stream->context->crc32 = crc32b ( stream->context->crc32, ( unsigned char * ) data, have );
-        context->u_off += have;
-        data += have;
-        len -= have;
-    }
 
-    while ( len )
-    {
-        if ( ( ssize_t ) ( avail = read ( stream->context->fd, in, sizeof ( in ) ) ) < 0 )
+        if ( context->strm_ended )
+        {
+            errno = ENODATA;
+            return -1;
+        }
+
+        /* Mapped archive is inflated in place */
+        if ( ( ssize_t ) ( avail =
+                generic_input ( stream->context, in, sizeof ( in ), &next ) ) < 0 )
         {
             return -1;
         }
@@ -162,22 +187,49 @@ static int zlib_read ( struct ar_istream *stream, void *data, size_t len )
             return -1;
         }
 
-        if ( decompress_data ( strm, in, avail, context ) < 0 )
+        if ( decompress_data ( strm, next, avail, context ) < 0 )
         {
             return -1;
         }
-
-        have = context->u_len < len ? context->u_len : len;
-        memcpy ( data, context->unconsumed, have );
-        stream->context->crc32 = crc32b ( stream->context->crc32, ( unsigned char * ) data, have );
-        context->u_off += have;
-        data += have;
-        len -= have;
     }
 
     return 0;
 }
 
+/*
+ * Begin new zlib output stream segment at current position
+ */
+static int zlib_reset_output ( struct ar_ostream *stream )
+{
+    struct stream_zlib_context_t *context = ( struct stream_zlib_context_t * ) stream->context;
+
+    if ( deflateReset ( &context->strm ) != Z_OK )
+    {
+        return -1;
+    }
+
+    return generic_reset_output ( stream );
+}
+
+/*
+ * Begin reading zlib input stream segment at given offset
+ */
+static int zlib_reset_input ( struct ar_istream *stream, uint64_t offset )
+{
+    struct stream_zlib_context_t *context = ( struct stream_zlib_context_t * ) stream->context;
+
+    if ( inflateReset ( &context->strm ) != Z_OK )
+    {
+        return -1;
+    }
+
+    context->strm_ended = 0;
+    context->u_off = 0;
+    context->u_len = 0;
+
+    return generic_reset_input ( stream, offset );
+}
+
 /*
  * Finalize zlib output stream
  */
@@ -185,27 +237,33 @@ static int zlib_flush ( struct ar_ostream *stream )
 {
     struct stream_zlib_context_t *context = ( struct stream_zlib_context_t * ) stream->context;
     z_stream *strm = &context->strm;
+    int ret;
     ssize_t len;
     unsigned char out[CHUNK];
 
     strm->avail_in = 0;
     strm->next_in = NULL;
-    strm->avail_out = sizeof ( out );
-    strm->next_out = out;
 
-    if ( deflate ( strm, Z_FINISH ) == Z_STREAM_ERROR )
+    do
     {
-        return -1;
-    }
+        strm->avail_out = sizeof ( out );
+        strm->next_out = out;
+
+        if ( ( ret = deflate ( strm, Z_FINISH ) ) == Z_STREAM_ERROR )
+        {
+            return -1;
+        }
 
-    len = sizeof ( out ) - strm->avail_out;;
+        len = sizeof ( out ) - strm->avail_out;
 
-    if ( write ( stream->context->fd, out, len ) != len )
-    {
-        return -1;
+        if ( generic_output ( stream->context, out, len ) < 0 )
+        {
+            return -1;
+        }
     }
+    while ( ret != Z_STREAM_END );
 
-    return 0;
+    return generic_drain_output ( stream->context );
 }
 
 /*
@@ -221,12 +279,17 @@ static void zlib_close ( struct ar_stream *stream )
         context->unconsumed = NULL;
     }
 
-    if ( context->strm_allocated )
+    if ( context->strm_allocated == 1 )
     {
         deflateEnd ( &context->strm );
-        context->strm_allocated = 0;
+
+    } else if ( context->strm_allocated == 2 )
+    {
+        inflateEnd ( &context->strm );
     }
 
+    context->strm_allocated = 0;
+
     generic_close ( stream );
 }
 
@@ -272,7 +335,9 @@ struct ar_ostream *zlib_ostream_open ( int fd, int level )
     stream->context = ( struct stream_base_context_t * ) context;
     stream->set_header = generic_set_header;
     stream->write = zlib_write;
+    stream->copy = NULL;
     stream->flush = zlib_flush;
+    stream->reset = zlib_reset_output;
     stream->seed_crc32 =
         ( void ( * )( struct ar_ostream *, const struct header_t * ) ) generic_seed_crc32;
     stream->finalize_crc32 = ( uint32_t ( * )( struct ar_ostream * ) ) generic_finalize_crc32;
@@ -329,22 +394,26 @@ struct ar_istream *zlib_istream_open ( int fd )
     stream->context = ( struct stream_base_context_t * ) context;
     stream->get_header = generic_get_header;
     stream->read = zlib_read;
+    stream->copy = NULL;
+    stream->view = NULL;
+    stream->reset = zlib_reset_input;
     stream->seed_crc32 =
         ( void ( * )( struct ar_istream *, const struct header_t * ) ) generic_seed_crc32;
     stream->finalize_crc32 = ( uint32_t ( * )( struct ar_istream * ) ) generic_finalize_crc32;
     stream->close = ( void ( * )( struct ar_istream * ) ) zlib_close;
     context->strm_allocated = 0;
 
+    /* Unconsumed data buffer not allocated yet */
+    context->unconsumed = NULL;
+
     if ( generic_istream_open ( stream->context, fd ) < 0 )
     {
         stream->close ( stream );
         return NULL;
     }
 
-    /* Unconsumed data buffer not allocated yet */
-    context->unconsumed = NULL;
-
     /* Allocate inflate state */
+    memset ( &context->strm, '\0', sizeof ( context->strm ) );
     context->strm.zalloc = zcalloc;
     context->strm.zfree = zcfree;
     context->strm.opaque = Z_NULL;
@@ -355,7 +424,8 @@ struct ar_istream *zlib_istream_open ( int fd )
         return NULL;
     }
 
-    context->strm_allocated = 1;
+    context->strm_allocated = 2;
+    context->strm_ended = 0;
     context->u_off = 0;
     context->u_len = 0;
     context->u_size = 4 * CHUNK;
@@ -0,0 +1,49 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Files appended to an archive are extracted with their latest version
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for FLAGS in s ns ds Bs; do
+    rm -rf "$WORK/src" "$WORK/out" "$WORK/a.zbox"
+    mkdir -p "$WORK/src/a" "$WORK/src/b"
+    seq 1 5000 > "$WORK/src/a/x"
+    head -c 100000 /dev/urandom > "$WORK/src/a/y"
+    cd "$WORK/src" || exit 1
+
+    "$ZBOX" -c$FLAGS "$WORK/a.zbox" a || exit 1
+
+    # Changed file replaces its stored version, new ones are added
+    seq 2 6000 > a/x
+    echo new > b/z
+    "$ZBOX" -a$FLAGS "$WORK/a.zbox" a/x b || exit 1
+    "$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+    LIST=$("$ZBOX" -l "$WORK/a.zbox" | sed 's/^ *l *//' | sort)
+
+    if [ "$LIST" != "$(printf 'a/x\na/y\nb/z')" ]; then
+        echo "append -$FLAGS: unexpected list: $LIST"
+        exit 1
+    fi
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "append -$FLAGS: extracted files differ"
+        exit 1
+    fi
+
+    if ! "$ZBOX" -p "$WORK/a.zbox" a/x | cmp -s - "$WORK/src/a/x"; then
+        echo "append -$FLAGS: printed file differs"
+        exit 1
+    fi
+done
+
+echo "append: ok"
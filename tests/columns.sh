@@ -0,0 +1,50 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Many entities with shared name prefixes and varied sizes are stored
+# in compact metadata columns larger than their write buffer
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src"
+cd "$WORK/src" || exit 1
+
+for D in 1 2 3 4 5 6 7 8 9 10; do
+    DIR=tree/directory_with_long_name_$D/sub_$D
+    mkdir -p "$DIR" "tree/empty_$D"
+
+    for F in $(seq 1 300); do
+        head -c $((F * D % 700)) /dev/zero > "$DIR/file_${F}_with_long_name_past_shared_prefix"
+    done
+done
+
+head -c 70000 /dev/urandom > tree/large
+
+for FLAGS in s Ms; do
+    rm -rf "$WORK/a.zbox" "$WORK/out"
+    "$ZBOX" -c$FLAGS "$WORK/a.zbox" tree || exit 1
+    "$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+    LIST=$("$ZBOX" -l "$WORK/a.zbox" | sed 's/^ *l *//' | sort)
+
+    if [ "$LIST" != "$(find tree -type f | sort)" ]; then
+        echo "columns -$FLAGS: unexpected list"
+        exit 1
+    fi
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "columns -$FLAGS: extracted files differ"
+        exit 1
+    fi
+done
+
+echo "columns: ok"
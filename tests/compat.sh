@@ -0,0 +1,50 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Archives written in format v1 are still listed, tested and extracted,
+# test data was packed by zbox 1.0.16 from the files rebuilt below
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+DATA=$(cd "$(dirname "$0")" && pwd)/data
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a/b"
+cd "$WORK/src" || exit 1
+seq 1 100 > a/one
+seq 1 3000 > a/b/two
+: > a/empty
+printf 'no newline' > a/b/last
+
+for ARCHIVE in v1.zbox v1-n.zbox; do
+    rm -rf "$WORK/out"
+    LIST=$("$ZBOX" -l "$DATA/$ARCHIVE" | sed 's/^ *l *//' | sort)
+
+    if [ "$LIST" != "$(printf 'a/b/last\na/b/two\na/empty\na/one')" ]; then
+        echo "compat $ARCHIVE: unexpected list: $LIST"
+        exit 1
+    fi
+
+    "$ZBOX" -ts "$DATA/$ARCHIVE" > /dev/null || exit 1
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$DATA/$ARCHIVE" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "compat $ARCHIVE: extracted files differ"
+        exit 1
+    fi
+
+    "$ZBOX" -p "$DATA/$ARCHIVE" a/b/two --offset 100 --length 50 > "$WORK/part" || exit 1
+
+    if ! dd if=a/b/two bs=1 skip=100 count=50 2> /dev/null | cmp -s - "$WORK/part"; then
+        echo "compat $ARCHIVE: printed range differs"
+        exit 1
+    fi
+done
+
+echo "compat: ok"
@@ -0,0 +1,41 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Large files of uncompressed archives are copied in kernel on extract
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+head -c 3000000 /dev/urandom > a/large
+head -c 262144 /dev/urandom > a/limit
+head -c 1000 /dev/urandom > a/small
+: > a/empty
+
+for FLAGS in ns nBs ngs; do
+    rm -rf "$WORK/a.zbox" "$WORK/out"
+    "$ZBOX" -c$FLAGS "$WORK/a.zbox" a || exit 1
+    "$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" || exit 1
+
+    # Selected file is copied from its offset
+    mkdir sel
+    cd sel || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" a/large || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src/a" "$WORK/out/a" > /dev/null \
+        || ! cmp -s a/large "$WORK/out/sel/a/large"; then
+        echo "copy -$FLAGS: extracted files differ"
+        exit 1
+    fi
+done
+
+echo "copy: ok"
@@ -0,0 +1,45 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Archives checksummed with CRC32C are verified with it
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+head -c 300000 /dev/urandom > a/random
+{ seq 1 5000; echo damaged here; } > a/text
+
+for FLAGS in Cs nCs nBCs; do
+    rm -rf "$WORK/a.zbox" "$WORK/out"
+    "$ZBOX" -c$FLAGS "$WORK/a.zbox" a || exit 1
+    "$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "crc32c -$FLAGS: extracted files differ"
+        exit 1
+    fi
+
+    # Damage is detected in uncompressed archive
+    OFFSET=$(grep -obUa 'damaged here' "$WORK/a.zbox" | cut -d: -f1)
+
+    if [ -n "$OFFSET" ]; then
+        printf 'D' | dd of="$WORK/a.zbox" bs=1 seek="$OFFSET" conv=notrunc 2> /dev/null
+
+        if "$ZBOX" -ts "$WORK/a.zbox" > /dev/null 2>&1; then
+            echo "crc32c -$FLAGS: damaged archive passed"
+            exit 1
+        fi
+    fi
+done
+
+echo "crc32c: ok"
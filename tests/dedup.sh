@@ -0,0 +1,52 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Repeated data is stored once and rebuilt from references on extract
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a" "$WORK/src/b"
+head -c 500000 /dev/urandom > "$WORK/src/a/one"
+cat "$WORK/src/a/one" "$WORK/src/a/one" > "$WORK/src/a/two"
+{ head -c 1000 /dev/urandom; cat "$WORK/src/a/one"; } > "$WORK/src/b/shifted"
+cp "$WORK/src/a/one" "$WORK/src/b/copy"
+
+cd "$WORK/src" || exit 1
+"$ZBOX" -cnds "$WORK/a.zbox" a b || exit 1
+"$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+# Four copies of the same data take little more than one
+SIZE=$(wc -c < "$WORK/a.zbox")
+
+if [ "$SIZE" -gt 700000 ]; then
+    echo "dedup: archive too large: $SIZE"
+    exit 1
+fi
+
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/a.zbox" || exit 1
+
+if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+    echo "dedup: extracted files differ"
+    exit 1
+fi
+
+# Referenced files are rebuilt from archive when not extracted
+for FILE in a/one a/two b/shifted b/copy; do
+    rm -rf "$WORK/sel"
+    mkdir "$WORK/sel"
+    cd "$WORK/sel" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" "$FILE" || exit 1
+
+    if ! cmp -s "$WORK/src/$FILE" "$FILE" || [ "$(find . -type f)" != "./$FILE" ]; then
+        echo "dedup: selected $FILE differs"
+        exit 1
+    fi
+done
+
+echo "dedup: ok"
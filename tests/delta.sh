@@ -0,0 +1,58 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Changed files are stored as delta to their base archive version
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src"
+cd "$WORK/src" || exit 1
+head -c 2000000 /dev/urandom > edited
+head -c 500000 /dev/urandom > grown
+head -c 300000 /dev/urandom > replaced
+
+"$ZBOX" -cs "$WORK/base.zbox" edited grown replaced || exit 1
+
+# Bytes changed in place, data inserted and appended, file rewritten
+printf 'changed' | dd of=edited bs=1 seek=1000000 conv=notrunc 2> /dev/null
+{ head -c 1000 grown; echo inserted; tail -c +1001 grown; echo appended; } > grown.new
+mv grown.new grown
+head -c 300000 /dev/urandom > replaced
+
+"$ZBOX" -cIDs "$WORK/delta.zbox" "$WORK/base.zbox" edited grown replaced || exit 1
+"$ZBOX" -ts "$WORK/delta.zbox" > /dev/null || exit 1
+
+# Only changed parts and rewritten file are stored
+if [ "$(wc -c < "$WORK/delta.zbox")" -gt 500000 ]; then
+    echo "delta: changed files stored whole"
+    exit 1
+fi
+
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/delta.zbox" || exit 1
+
+if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+    echo "delta: extracted files differ"
+    exit 1
+fi
+
+# Delta of delta archive is applied to rebuilt versions
+cd "$WORK/src" || exit 1
+printf 'again' | dd of=edited bs=1 seek=10 conv=notrunc 2> /dev/null
+"$ZBOX" -cIDs "$WORK/delta2.zbox" "$WORK/delta.zbox" edited grown replaced || exit 1
+rm -rf "$WORK/out"
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/delta2.zbox" || exit 1
+
+if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+    echo "delta: second level extracted files differ"
+    exit 1
+fi
+
+echo "delta: ok"
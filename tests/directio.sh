@@ -0,0 +1,46 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Archives written and read with direct I/O match buffered ones
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+head -c 5000000 /dev/urandom > a/large
+seq 1 100000 > a/text
+head -c 4097 /dev/urandom > a/odd
+
+for FLAGS in s ns Bs; do
+    rm -rf "$WORK"/*.zbox "$WORK/out"
+    "$ZBOX" -c$FLAGS "$WORK/plain.zbox" a || exit 1
+    "$ZBOX" -c$FLAGS "$WORK/direct.zbox" a --direct-io || exit 1
+
+    if ! cmp -s "$WORK/plain.zbox" "$WORK/direct.zbox"; then
+        echo "directio -$FLAGS: archives differ"
+        exit 1
+    fi
+
+    # Append writes at unaligned archive end
+    seq 1 10 > b
+    "$ZBOX" -a$FLAGS "$WORK/direct.zbox" b --direct-io || exit 1
+    rm b
+
+    "$ZBOX" -ts "$WORK/direct.zbox" --direct-io > /dev/null || exit 1
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/direct.zbox" --direct-io || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src/a" "$WORK/out/a" > /dev/null \
+        || [ "$(cat "$WORK/out/b")" != "$(seq 1 10)" ]; then
+        echo "directio -$FLAGS: extracted files differ"
+        exit 1
+    fi
+done
+
+echo "directio: ok"
@@ -0,0 +1,50 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Exclude patterns without separator prune matching names at any depth
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/p/node_modules/x" "$WORK/src/q/r"
+echo 1 > "$WORK/src/p/node_modules/x/m.js"
+echo 2 > "$WORK/src/p/a.txt"
+echo 3 > "$WORK/src/q/r/b.txt"
+echo 4 > "$WORK/src/q/r/c.bin"
+
+cd "$WORK/src" || exit 1
+
+# Pruned while scanning
+"$ZBOX" -cs "$WORK/a.zbox" p q --exclude=node_modules --exclude='*.txt' || exit 1
+LIST=$("$ZBOX" -l "$WORK/a.zbox" | sed 's/^ *l *//')
+
+if [ "$LIST" != "q/r/c.bin" ]; then
+    echo "exclude on create: unexpected list: $LIST"
+    exit 1
+fi
+
+"$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/a.zbox" || exit 1
+cd "$WORK/src" || exit 1
+
+if [ "$(find "$WORK/out" -type f)" != "$WORK/out/q/r/c.bin" ] \
+    || ! cmp -s q/r/c.bin "$WORK/out/q/r/c.bin"; then
+    echo "exclude on create: unexpected files extracted"
+    exit 1
+fi
+
+# Skipped while listing, pattern with separator stays anchored
+"$ZBOX" -cs "$WORK/b.zbox" p q || exit 1
+LIST=$("$ZBOX" -l "$WORK/b.zbox" --exclude='*.txt' --exclude='p/*.js' | sed 's/^ *l *//' | sort)
+
+if [ "$LIST" != "$(printf 'p/node_modules/x/m.js\nq/r/c.bin')" ]; then
+    echo "exclude on list: unexpected list: $LIST"
+    exit 1
+fi
+
+echo "exclude: ok"
@@ -0,0 +1,38 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Files stored in similarity grouped order are extracted to their paths
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a/b" "$WORK/src/c"
+head -c 100000 /dev/urandom > "$WORK/src/a/r.bin"
+seq 1 20000 > "$WORK/src/a/b/n.txt"
+seq 5 20000 > "$WORK/src/c/m.txt"
+seq 1 300 | sed 's/^/line /' > "$WORK/src/c/l.log"
+head -c 50000 /dev/urandom > "$WORK/src/c/s.bin"
+: > "$WORK/src/c/empty.txt"
+
+cd "$WORK/src" || exit 1
+
+for FLAGS in -cgs -cgbs -cgBs; do
+    rm -rf "$WORK/a.zbox" "$WORK/out"
+    "$ZBOX" $FLAGS "$WORK/a.zbox" a c || exit 1
+    "$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "group $FLAGS: extracted files differ"
+        exit 1
+    fi
+done
+
+echo "group: ok"
@@ -0,0 +1,69 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Incremental archive chain is extracted to the latest file versions
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Extract archive into new directory and compare it with sources
+check_extract ()
+{
+    rm -rf "$WORK/out"
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/$1" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "incremental $1: extracted files differ"
+        exit 1
+    fi
+}
+
+mkdir -p "$WORK/src/a" "$WORK/src/b"
+head -c 1000000 /dev/urandom > "$WORK/src/a/big"
+seq 1 1000 > "$WORK/src/a/small"
+echo gone > "$WORK/src/b/gone"
+cd "$WORK/src" || exit 1
+
+"$ZBOX" -cs "$WORK/base.zbox" a b || exit 1
+check_extract base.zbox
+
+# Changed, added and removed files
+seq 1 2000 > a/small
+echo new > b/new
+rm b/gone
+"$ZBOX" -cIs "$WORK/inc1.zbox" "$WORK/base.zbox" a b || exit 1
+"$ZBOX" -ts "$WORK/inc1.zbox" > /dev/null || exit 1
+
+# Unchanged data is not stored again
+if [ "$(wc -c < "$WORK/inc1.zbox")" -gt 100000 ]; then
+    echo "incremental: unchanged file stored"
+    exit 1
+fi
+
+check_extract inc1.zbox
+
+# Second level, directory removed and file added back
+rm -r b
+mkdir c
+echo back > c/gone
+"$ZBOX" -cIs "$WORK/inc2.zbox" "$WORK/inc1.zbox" a c || exit 1
+"$ZBOX" -ts "$WORK/inc2.zbox" > /dev/null || exit 1
+check_extract inc2.zbox
+
+# Missing base archive is reported
+mv "$WORK/inc1.zbox" "$WORK/moved.zbox"
+mkdir "$WORK/fail"
+cd "$WORK/fail" || exit 1
+
+if "$ZBOX" -xs "$WORK/inc2.zbox" 2> /dev/null; then
+    echo "incremental: missing base archive not reported"
+    exit 1
+fi
+
+echo "incremental: ok"
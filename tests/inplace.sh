@@ -0,0 +1,62 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Archive listed with in-place metadata shows the same files, damaged
+# in-place metadata is not used for listing and fails archive test
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a/b" "$WORK/src/c"
+cd "$WORK/src" || exit 1
+seq 1 1000 > a/one
+seq 1 2000 > a/b/two
+echo three > c/inplace_marker_name
+: > c/empty
+
+# List archive with given options, paths sorted
+list ()
+{
+    ARCHIVE=$1
+    shift
+    "$ZBOX" -l "$ARCHIVE" "$@" | sed 's/^ *l *//' | sort
+}
+
+"$ZBOX" -cs "$WORK/plain.zbox" a c || exit 1
+"$ZBOX" -cMs "$WORK/a.zbox" a c || exit 1
+"$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+for ARGS in "" "a/*" "--exclude=b" "c/e*"; do
+    if [ "$(list "$WORK/a.zbox" $ARGS)" != "$(list "$WORK/plain.zbox" $ARGS)" ]; then
+        echo "inplace $ARGS: list differs"
+        exit 1
+    fi
+done
+
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/a.zbox" || exit 1
+
+if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+    echo "inplace: extracted files differ"
+    exit 1
+fi
+
+# Name is stored uncompressed only in in-place metadata
+OFFSET=$(grep -obUa 'inplace_marker_name' "$WORK/a.zbox" | cut -d: -f1)
+printf 'X' | dd of="$WORK/a.zbox" bs=1 seek="$OFFSET" conv=notrunc 2> /dev/null
+
+if [ "$(list "$WORK/a.zbox")" != "$(list "$WORK/plain.zbox")" ]; then
+    echo "inplace: damaged in-place metadata used for listing"
+    exit 1
+fi
+
+if "$ZBOX" -ts "$WORK/a.zbox" > /dev/null 2>&1; then
+    echo "inplace: damaged in-place metadata passed test"
+    exit 1
+fi
+
+echo "inplace: ok"
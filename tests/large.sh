@@ -0,0 +1,43 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Files larger than 4 GiB keep their size and data past 4 GiB
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src"
+cd "$WORK/src" || exit 1
+
+# Sparse file with data before and after 4 GiB boundary
+printf 'head' > big
+printf 'past4g' | dd of=big bs=1 seek=4294967300 conv=notrunc 2> /dev/null
+dd if=/dev/zero of=big bs=1 count=0 seek=5368709120 2> /dev/null
+echo small > small
+
+"$ZBOX" -cSs "$WORK/a.zbox" big small || exit 1
+"$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+PART=$("$ZBOX" -p "$WORK/a.zbox" big --offset 4294967300 --length 6)
+
+if [ "$PART" != past4g ]; then
+    echo "large: printed range past 4 GiB differs: $PART"
+    exit 1
+fi
+
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/a.zbox" || exit 1
+
+SIZE=$(ls -ln big | awk '{ print $5 }')
+PART=$(dd if=big bs=1 skip=4294967300 count=6 2> /dev/null)
+
+if [ "$SIZE" != 5368709120 ] || [ "$PART" != past4g ] || ! cmp -s small "$WORK/src/small"; then
+    echo "large: extracted file differs, size $SIZE"
+    exit 1
+fi
+
+echo "large: ok"
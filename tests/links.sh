@@ -0,0 +1,61 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Hard links are extracted as links to one file, symbolic links are
+# not turned into hard links and directory loops are cut off
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a" "$WORK/src/b"
+head -c 100000 /dev/urandom > "$WORK/src/a/file"
+ln "$WORK/src/a/file" "$WORK/src/b/hard"
+ln "$WORK/src/a/file" "$WORK/src/a/hard2"
+ln -s file "$WORK/src/a/soft"
+ln -s .. "$WORK/src/b/loop"
+echo single > "$WORK/src/b/single"
+
+cd "$WORK/src" || exit 1
+"$ZBOX" -cs "$WORK/a.zbox" a b 2> /dev/null || exit 1
+"$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/a.zbox" || exit 1
+
+if ! cmp -s "$WORK/src/a/file" a/file || ! cmp -s "$WORK/src/b/single" b/single; then
+    echo "links: extracted files differ"
+    exit 1
+fi
+
+if [ ! a/file -ef b/hard ] || [ ! a/file -ef a/hard2 ]; then
+    echo "links: hard links not restored"
+    exit 1
+fi
+
+# Followed symbolic link is stored as separate file
+if [ a/file -ef a/soft ] || ! cmp -s a/file a/soft; then
+    echo "links: symbolic link not stored as file"
+    exit 1
+fi
+
+# Directory loop is stored only once
+if [ -e b/loop/b/loop ] || [ ! b/loop/a/file -ef a/file ]; then
+    echo "links: directory loop not cut off"
+    exit 1
+fi
+
+# Link extracted alone brings its target data
+mkdir "$WORK/sel"
+cd "$WORK/sel" || exit 1
+"$ZBOX" -xs "$WORK/a.zbox" b/hard || exit 1
+
+if ! cmp -s "$WORK/src/a/file" b/hard; then
+    echo "links: selected hard link differs"
+    exit 1
+fi
+
+echo "links: ok"
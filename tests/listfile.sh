@@ -0,0 +1,69 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Files listed on standard input or in NUL separated list are stored
+# whole, absolute path arguments are stored from their last name
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/d/sub"
+echo 1 > "$WORK/src/d/sub/f"
+echo 2 > "$WORK/src/d/new
+line"
+echo 3 > "$WORK/src/d/g"
+
+cd "$WORK/src" || exit 1
+
+# Newline separated list from standard input
+printf 'd/sub/f\n./d/g\n' | "$ZBOX" -cs "$WORK/a.zbox" -T - || exit 1
+"$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+LIST=$("$ZBOX" -l "$WORK/a.zbox" | sed 's/^ *l *//' | sort)
+
+if [ "$LIST" != "$(printf 'd/g\nd/sub/f')" ]; then
+    echo "list from stdin: unexpected list: $LIST"
+    exit 1
+fi
+
+# NUL separated list keeps names with newlines
+printf 'd/new\nline\000d/g\000' > "$WORK/list"
+"$ZBOX" -cs "$WORK/b.zbox" -T "$WORK/list" --null || exit 1
+mkdir "$WORK/b"
+cd "$WORK/b" || exit 1
+"$ZBOX" -xs "$WORK/b.zbox" || exit 1
+
+if ! cmp -s "$WORK/src/d/new
+line" "d/new
+line" || ! cmp -s "$WORK/src/d/g" d/g || [ -e d/sub/f ]; then
+    echo "null list: unexpected files extracted"
+    exit 1
+fi
+
+# Absolute listed path is stored whole, absolute argument by last name
+cd "$WORK/src" || exit 1
+echo "$WORK/src/d/sub/f" | "$ZBOX" -cs "$WORK/c.zbox" -T - || exit 1
+"$ZBOX" -cs "$WORK/e.zbox" "$WORK/src/d/sub" || exit 1
+LIST=$("$ZBOX" -l "$WORK/c.zbox" | sed 's/^ *l *//')
+
+if [ "$LIST" != "${WORK#/}/src/d/sub/f" ]; then
+    echo "absolute list entry: unexpected list: $LIST"
+    exit 1
+fi
+
+LIST=$("$ZBOX" -l "$WORK/e.zbox" | sed 's/^ *l *//')
+
+if [ "$LIST" != "sub/f" ]; then
+    echo "absolute argument: unexpected list: $LIST"
+    exit 1
+fi
+
+# Parent references are refused in list
+if echo "../src/d/g" | "$ZBOX" -cs "$WORK/f.zbox" -T - 2>/dev/null; then
+    echo "parent reference in list: accepted"
+    exit 1
+fi
+
+echo "listfile: ok"
@@ -0,0 +1,45 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Exact paths are looked up in in-place metadata index, results match
+# archive listed without the index
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src"
+cd "$WORK/src" || exit 1
+
+for D in 1 2 3 4 5; do
+    mkdir -p "d$D/sub"
+
+    for F in $(seq 1 100); do
+        echo "$D $F" > "d$D/sub/f$F"
+    done
+done
+
+"$ZBOX" -cs "$WORK/plain.zbox" d1 d2 d3 d4 d5 || exit 1
+"$ZBOX" -cMs "$WORK/a.zbox" d1 d2 d3 d4 d5 || exit 1
+
+for ARGS in "d3/sub/f42" "d1/sub/f1 d5/sub/f100" "d2" "d4/sub/" "./d1/sub/f7"; do
+    for ARCHIVE in a.zbox plain.zbox; do
+        # Word splitting gives one argument per path
+        "$ZBOX" -l "$WORK/$ARCHIVE" $ARGS | sed 's/^ *l *//' | sort > "$WORK/$ARCHIVE.list"
+    done
+
+    if ! cmp -s "$WORK/a.zbox.list" "$WORK/plain.zbox.list" || [ ! -s "$WORK/a.zbox.list" ]; then
+        echo "lookup $ARGS: list differs"
+        exit 1
+    fi
+done
+
+# Missing path is reported
+if "$ZBOX" -l "$WORK/a.zbox" d1/sub/f101 > /dev/null 2>&1; then
+    echo "lookup: missing path not reported"
+    exit 1
+fi
+
+echo "lookup: ok"
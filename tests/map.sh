@@ -0,0 +1,42 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Source files read from a mapping give the same archive as read ones
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+head -c 3000000 /dev/urandom > a/large
+seq 1 100000 > a/text
+dd if=/dev/zero of=a/sparse bs=1 count=0 seek=2000000 2> /dev/null
+printf 'data' >> a/sparse
+: > a/empty
+
+for FLAGS in s ns ds Ss; do
+    rm -rf "$WORK"/*.zbox "$WORK/out"
+    "$ZBOX" -c$FLAGS "$WORK/read.zbox" a --map-min=1G || exit 1
+    "$ZBOX" -c$FLAGS "$WORK/map.zbox" a --map-min=1 || exit 1
+
+    if ! cmp -s "$WORK/read.zbox" "$WORK/map.zbox"; then
+        echo "map -$FLAGS: archives differ"
+        exit 1
+    fi
+
+    "$ZBOX" -ts "$WORK/map.zbox" > /dev/null || exit 1
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/map.zbox" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "map -$FLAGS: extracted files differ"
+        exit 1
+    fi
+done
+
+echo "map: ok"
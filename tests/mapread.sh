@@ -0,0 +1,53 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Archives read through a mapping extract, test and print as read ones,
+# truncated archive is reported instead of faulting
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+head -c 2000000 /dev/urandom > a/large
+seq 1 50000 > a/text
+echo small > a/small
+
+for FLAGS in s ns nBs; do
+    "$ZBOX" -c$FLAGS "$WORK/a.zbox" a || exit 1
+
+    for READ in "" --populate; do
+        rm -rf "$WORK/out"
+        "$ZBOX" -ts "$WORK/a.zbox" $READ > /dev/null || exit 1
+
+        mkdir "$WORK/out"
+        cd "$WORK/out" || exit 1
+        "$ZBOX" -xs "$WORK/a.zbox" $READ || exit 1
+        cd "$WORK/src" || exit 1
+
+        if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+            echo "mapread -$FLAGS $READ: extracted files differ"
+            exit 1
+        fi
+    done
+
+    if ! "$ZBOX" -p "$WORK/a.zbox" a/text | cmp -s - a/text; then
+        echo "mapread -$FLAGS: printed file differs"
+        exit 1
+    fi
+
+    # Data cut off at end of archive
+    SIZE=$(wc -c < "$WORK/a.zbox")
+    dd if="$WORK/a.zbox" of="$WORK/cut.zbox" bs=$((SIZE / 2)) count=1 2> /dev/null
+    "$ZBOX" -ts "$WORK/cut.zbox" > /dev/null 2>&1
+
+    if [ $? -ne 1 ]; then
+        echo "mapread -$FLAGS: truncated archive not reported"
+        exit 1
+    fi
+done
+
+echo "mapread: ok"
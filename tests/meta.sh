@@ -0,0 +1,47 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Listing checks metadata by its own checksum without reading file data
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+{ seq 1 1000; echo payload marker; } > a/data_file_name
+
+# Damage one byte found in uncompressed archive
+damage ()
+{
+    cp "$WORK/a.zbox" "$WORK/b.zbox"
+    OFFSET=$(grep -obUa "$1" "$WORK/b.zbox" | cut -d: -f1)
+    printf 'X' | dd of="$WORK/b.zbox" bs=1 seek="$OFFSET" conv=notrunc 2> /dev/null
+}
+
+"$ZBOX" -cns "$WORK/a.zbox" a || exit 1
+
+# Damaged file data does not affect listing, only test
+damage 'payload marker'
+
+if [ "$("$ZBOX" -l "$WORK/b.zbox" | sed 's/^ *l *//')" != a/data_file_name ]; then
+    echo "meta: listing with damaged data failed"
+    exit 1
+fi
+
+if "$ZBOX" -ts "$WORK/b.zbox" > /dev/null 2>&1; then
+    echo "meta: damaged data passed test"
+    exit 1
+fi
+
+# Damaged metadata is reported on listing
+damage 'data_file_name'
+
+if "$ZBOX" -l "$WORK/b.zbox" > /dev/null 2>&1; then
+    echo "meta: damaged metadata listed"
+    exit 1
+fi
+
+echo "meta: ok"
@@ -0,0 +1,75 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Byte ranges of plain, deduplicated, sparse and base archive files
+# are printed as stored
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src"
+cd "$WORK/src" || exit 1
+
+head -c 200000 /dev/urandom > plain
+cat plain plain plain > dup
+dd if=/dev/zero of=sparse bs=1 count=0 seek=3000000 2> /dev/null
+printf 'mid' | dd of=sparse bs=1 seek=1500000 conv=notrunc 2> /dev/null
+printf 'end' >> sparse
+
+# Print range and compare with the same range of source file
+check_range ()
+{
+    "$ZBOX" -p "$1" "$2" --offset "$3" --length "$4" > "$WORK/out" || exit 1
+    dd if="$2" bs=1 skip="$3" count="$4" 2> /dev/null | cmp -s - "$WORK/out" || {
+        echo "print $1 $2 at $3 length $4: differs"
+        exit 1
+    }
+}
+
+# Compare whole printed file with source file
+check_file ()
+{
+    "$ZBOX" -p "$1" "$2" > "$WORK/out" || exit 1
+    cmp -s "$2" "$WORK/out" || {
+        echo "print $1 $2: differs"
+        exit 1
+    }
+}
+
+"$ZBOX" -cs "$WORK/a.zbox" plain dup sparse || exit 1
+"$ZBOX" -cnds "$WORK/b.zbox" plain dup || exit 1
+"$ZBOX" -cSs "$WORK/c.zbox" sparse || exit 1
+
+for ARCHIVE in a.zbox b.zbox; do
+    for FILE in plain dup; do
+        check_file "$WORK/$ARCHIVE" "$FILE"
+    done
+
+    check_range "$WORK/$ARCHIVE" plain 0 10
+    check_range "$WORK/$ARCHIVE" plain 199990 100
+    check_range "$WORK/$ARCHIVE" dup 199990 30
+    check_range "$WORK/$ARCHIVE" dup 400000 1000
+done
+
+check_file "$WORK/c.zbox" sparse
+check_range "$WORK/c.zbox" sparse 1499990 20
+check_range "$WORK/c.zbox" sparse 2999999 10
+
+# Unchanged and delta files are printed through base archive chain
+touch dup
+printf 'XX' | dd of=plain bs=1 seek=1000 conv=notrunc 2> /dev/null
+"$ZBOX" -cIDs "$WORK/d.zbox" "$WORK/a.zbox" plain dup sparse || exit 1
+echo more >> sparse
+"$ZBOX" -cIs "$WORK/e.zbox" "$WORK/d.zbox" plain dup sparse || exit 1
+
+for FILE in plain dup sparse; do
+    check_file "$WORK/e.zbox" "$FILE"
+done
+
+check_range "$WORK/e.zbox" plain 990 20
+check_range "$WORK/e.zbox" dup 399990 20
+
+echo "print: ok"
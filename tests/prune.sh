@@ -0,0 +1,47 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Files removed since base archive are pruned only within the selection
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a" "$WORK/src/b"
+echo 1 > "$WORK/src/a/x"
+echo 2 > "$WORK/src/a/z"
+echo 3 > "$WORK/src/b/y"
+
+cd "$WORK/src" || exit 1
+"$ZBOX" -cs "$WORK/base.zbox" a b || exit 1
+
+rm a/z b/y
+echo 4 > a/w
+"$ZBOX" -cIs "$WORK/top.zbox" "$WORK/base.zbox" a b || exit 1
+
+# Selective extraction leaves files outside the selection alone
+mkdir -p "$WORK/sel/b"
+echo 5 > "$WORK/sel/b/y"
+cd "$WORK/sel" || exit 1
+"$ZBOX" -xs "$WORK/top.zbox" 'a/*' || exit 1
+LIST=$(find . -type f | sort)
+
+if [ "$LIST" != "$(printf './a/w\n./a/x\n./b/y')" ]; then
+    echo "prune on selective extract: unexpected files: $LIST"
+    exit 1
+fi
+
+# Full extraction removes files deleted since base archive
+mkdir "$WORK/all"
+cd "$WORK/all" || exit 1
+"$ZBOX" -xs "$WORK/top.zbox" || exit 1
+LIST=$(find . -type f | sort)
+
+if [ "$LIST" != "$(printf './a/w\n./a/x')" ]; then
+    echo "prune on extract: unexpected files: $LIST"
+    exit 1
+fi
+
+echo "prune: ok"
@@ -0,0 +1,51 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Readahead hints do not change archive content, bad values are refused
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+
+for F in $(seq 1 40); do
+    head -c $((F * 5000)) /dev/urandom > "a/f$F"
+done
+
+"$ZBOX" -cs "$WORK/plain.zbox" a --readahead=0 || exit 1
+
+for ARGS in --readahead=1 --readahead=64 "--readahead=8 --readahead-size=100K" \
+    "--readahead-size=1"; do
+    # Word splitting gives one argument per option
+    "$ZBOX" -cs "$WORK/a.zbox" a $ARGS || exit 1
+
+    if ! cmp -s "$WORK/plain.zbox" "$WORK/a.zbox"; then
+        echo "readahead $ARGS: archives differ"
+        exit 1
+    fi
+done
+
+"$ZBOX" -cgs "$WORK/g.zbox" a --readahead=4 || exit 1
+"$ZBOX" -ts "$WORK/g.zbox" > /dev/null || exit 1
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/g.zbox" || exit 1
+
+if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+    echo "readahead: extracted files differ"
+    exit 1
+fi
+
+# Counts must be plain numbers in range
+for ARGS in --readahead=1K --readahead=-1 --readahead=70000 --readahead=; do
+    if "$ZBOX" -cs "$WORK/bad.zbox" "$WORK/src/a" $ARGS > /dev/null 2>&1; then
+        echo "readahead $ARGS: accepted"
+        exit 1
+    fi
+done
+
+echo "readahead: ok"
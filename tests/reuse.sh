@@ -0,0 +1,39 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Compressed data of unchanged files is copied from previous archive,
+# new archive does not depend on it
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for FLAGS in Bs dBs; do
+    rm -rf "$WORK/src" "$WORK/out" "$WORK"/*.zbox
+    mkdir -p "$WORK/src/a"
+    head -c 300000 /dev/urandom > "$WORK/src/a/big"
+    cat "$WORK/src/a/big" "$WORK/src/a/big" > "$WORK/src/a/twice"
+    seq 1 1000 > "$WORK/src/a/small"
+    cd "$WORK/src" || exit 1
+
+    "$ZBOX" -c$FLAGS "$WORK/old.zbox" a || exit 1
+
+    seq 1 3000 > a/small
+    echo new > a/new
+    "$ZBOX" -cR$FLAGS "$WORK/new.zbox" "$WORK/old.zbox" a || exit 1
+    rm "$WORK/old.zbox"
+    "$ZBOX" -ts "$WORK/new.zbox" > /dev/null || exit 1
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/new.zbox" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "reuse -$FLAGS: extracted files differ"
+        exit 1
+    fi
+done
+
+echo "reuse: ok"
@@ -0,0 +1,72 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Include and exclude globs select files to extract, list and test
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a/b/c" "$WORK/src/d"
+cd "$WORK/src" || exit 1
+echo 1 > a/x.txt
+echo 2 > a/b/y.txt
+echo 3 > a/b/c/z.txt
+echo 4 > a/b/c/w.bin
+echo 5 > d/v1.txt
+echo 6 > d/v2.txt
+ln a/b/c/w.bin d/link
+
+"$ZBOX" -cs "$WORK/a.zbox" a d || exit 1
+
+# Extract selection into new directory and compare its files
+check_select ()
+{
+    EXPECT=$1
+    shift
+    rm -rf "$WORK/out"
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" "$@" || exit 1
+    LIST=$(find . -type f | sed 's|^\./||' | sort | tr '\n' ' ')
+
+    if [ "$LIST" != "$EXPECT" ]; then
+        echo "select $*: unexpected files: $LIST"
+        exit 1
+    fi
+
+    for FILE in $LIST; do
+        cmp -s "$FILE" "$WORK/src/$FILE" || {
+            echo "select $*: $FILE differs"
+            exit 1
+        }
+    done
+}
+
+check_select "a/x.txt " 'a/*.txt'
+check_select "a/b/c/z.txt a/b/y.txt a/x.txt " 'a/**/*.txt'
+check_select "d/v1.txt " 'd/v[1]*'
+check_select "a/b/c/w.bin a/b/c/z.txt " a/b/c
+check_select "a/b/c/w.bin d/link d/v2.txt " d --exclude='*1.txt'
+check_select "a/b/c/w.bin d/link " d/link
+check_select "a/x.txt d/v1.txt d/v2.txt " --exclude=b --exclude=link
+
+# Selection applies to listing and test too
+LIST=$("$ZBOX" -l "$WORK/a.zbox" 'a/**' --exclude='*.txt' | sed 's/^ *l *//')
+
+if [ "$LIST" != a/b/c/w.bin ]; then
+    echo "select: unexpected list: $LIST"
+    exit 1
+fi
+
+"$ZBOX" -ts "$WORK/a.zbox" 'd/*' > /dev/null || exit 1
+
+# Pattern matching nothing is reported
+if "$ZBOX" -xs "$WORK/a.zbox" a/x.txt a/none 2> /dev/null; then
+    echo "select: unmatched pattern not reported"
+    exit 1
+fi
+
+echo "select: ok"
@@ -0,0 +1,50 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# File holes are stored as records and extracted as holes
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src"
+cd "$WORK/src" || exit 1
+
+# Data at start, in the middle and file ending with hole
+head -c 70000 /dev/urandom > holes
+dd if=/dev/urandom of=holes bs=4096 count=4 seek=2048 conv=notrunc 2> /dev/null
+dd if=/dev/zero of=holes bs=1 count=0 seek=67108864 2> /dev/null
+dd if=/dev/zero of=empty bs=1 count=0 seek=1048576 2> /dev/null
+seq 1 1000 > plain
+
+for FLAGS in -cSs -cnSs -cdSs; do
+    rm -rf "$WORK/a.zbox" "$WORK/out"
+    "$ZBOX" $FLAGS "$WORK/a.zbox" holes empty plain || exit 1
+    "$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+    # Holes take no archive space
+    if [ "$(wc -c < "$WORK/a.zbox")" -gt 1048576 ]; then
+        echo "sparse $FLAGS: archive too large"
+        exit 1
+    fi
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "sparse $FLAGS: extracted files differ"
+        exit 1
+    fi
+
+    # Extracted holes are not allocated
+    if [ "$(du -k "$WORK/out/holes" | cut -f1)" -gt 4096 ]; then
+        echo "sparse $FLAGS: extracted holes allocated"
+        exit 1
+    fi
+done
+
+echo "sparse: ok"
@@ -0,0 +1,49 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Files unchanged on disk are not written again, changed ones are restored
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+head -c 300000 /dev/urandom > "$WORK/src/a/same"
+head -c 300000 /dev/urandom > "$WORK/src/a/edited"
+seq 1 1000 > "$WORK/src/a/shorter"
+ln "$WORK/src/a/same" "$WORK/src/a/link"
+cd "$WORK/src" || exit 1
+
+for FLAGS in s Bs ds; do
+    rm -rf "$WORK/out" "$WORK/a.zbox"
+    "$ZBOX" -c$FLAGS "$WORK/a.zbox" a || exit 1
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" || exit 1
+
+    # Old timestamps show which files were written
+    touch -t 200001010000 a/same a/edited a/shorter
+    touch "$WORK/mark"
+    printf 'XX' | dd of=a/edited bs=1 seek=5000 conv=notrunc 2> /dev/null
+    touch -t 200001010000 a/edited
+    seq 1 10 > a/shorter
+
+    "$ZBOX" -xus "$WORK/a.zbox" || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+        echo "unchanged -$FLAGS: extracted files differ"
+        exit 1
+    fi
+
+    if [ "$WORK/out/a/same" -nt "$WORK/mark" ] \
+        || [ ! "$WORK/out/a/same" -ef "$WORK/out/a/link" ]; then
+        echo "unchanged -$FLAGS: unchanged file written"
+        exit 1
+    fi
+done
+
+echo "unchanged: ok"
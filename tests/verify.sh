@@ -0,0 +1,73 @@
+#!/bin/sh
+# ------------------------------------------------------------------
+# ZBox - Simple Data Achive Utility
+# ------------------------------------------------------------------
+
+# Damaged file data is reported by its own checksum, other files
+# are still verified and extracted
+
+ZBOX=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/src/a"
+cd "$WORK/src" || exit 1
+seq 1 20000 > a/first
+{ seq 1 1000; echo damaged here; seq 1 1000; } > a/second
+seq 5 20000 > a/third
+
+for FLAGS in ns nBs; do
+    rm -rf "$WORK/a.zbox" "$WORK/out"
+    "$ZBOX" -c$FLAGS "$WORK/a.zbox" a || exit 1
+    "$ZBOX" -ts "$WORK/a.zbox" > /dev/null || exit 1
+
+    # Damage one byte of second file data
+    OFFSET=$(grep -obUa 'damaged here' "$WORK/a.zbox" | cut -d: -f1)
+    printf 'D' | dd of="$WORK/a.zbox" bs=1 seek="$OFFSET" conv=notrunc 2> /dev/null
+
+    if "$ZBOX" -ts "$WORK/a.zbox" > /dev/null 2>&1; then
+        echo "verify -$FLAGS: damaged archive passed"
+        exit 1
+    fi
+
+    if "$ZBOX" -ts "$WORK/a.zbox" a/second > /dev/null 2>&1; then
+        echo "verify -$FLAGS: damaged file passed"
+        exit 1
+    fi
+
+    if ! "$ZBOX" -ts "$WORK/a.zbox" a/first a/third > /dev/null; then
+        echo "verify -$FLAGS: intact files failed"
+        exit 1
+    fi
+
+    mkdir "$WORK/out"
+    cd "$WORK/out" || exit 1
+    "$ZBOX" -xs "$WORK/a.zbox" a/third || exit 1
+    cd "$WORK/src" || exit 1
+
+    if ! cmp -s a/third "$WORK/out/a/third"; then
+        echo "verify -$FLAGS: intact file differs"
+        exit 1
+    fi
+done
+
+# Large data is split into segments verified in parallel
+rm -rf "$WORK/src" "$WORK/out"
+mkdir -p "$WORK/src/b"
+cd "$WORK/src" || exit 1
+dd if=/dev/zero of=b/zero1 bs=1048576 count=40 2> /dev/null
+dd if=/dev/zero of=b/zero2 bs=1048576 count=40 2> /dev/null
+seq 1 1000 > b/last
+
+"$ZBOX" -cs "$WORK/b.zbox" b || exit 1
+"$ZBOX" -ts "$WORK/b.zbox" > /dev/null || exit 1
+mkdir "$WORK/out"
+cd "$WORK/out" || exit 1
+"$ZBOX" -xs "$WORK/b.zbox" || exit 1
+
+if ! diff -r "$WORK/src" "$WORK/out" > /dev/null; then
+    echo "verify: split archive files differ"
+    exit 1
+fi
+
+echo "verify: ok"